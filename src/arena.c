@@ -0,0 +1,207 @@
+/**
+ * arena.c
+ * The region allocator of the client intermediates.
+ **/
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// the arena of the client the calling thread serves
+static __thread Arena* current_arena = NULL;
+
+static size_t size_class(size_t size) {
+    size_t c = 0;
+    while (((size_t)1 << (c + ARENA_MIN_CLASS)) < size) {
+        c++;
+    }
+    return c;
+}
+
+static size_t block_capacity(const ArenaBlock* block) {
+    return block->size_class < ARENA_CLASSES ? (size_t)1 << (block->size_class + ARENA_MIN_CLASS) : block->size;
+}
+
+static void account(Arena* arena, size_t bytes) {
+    arena->in_use += bytes;
+    if (arena->in_use > arena->high_water) {
+        arena->high_water = arena->in_use;
+    }
+}
+
+/**
+ * carve a block of class c out of the current chunk, starting a new chunk
+ * if it does not fit
+ **/
+static ArenaBlock* carve(Arena* arena, size_t c) {
+    size_t bytes = sizeof(ArenaBlock) + ((size_t)1 << (c + ARENA_MIN_CLASS));
+    ArenaChunk* chunk = arena->chunks;
+    if (chunk == NULL || chunk->used + bytes > chunk->size) {
+        chunk = malloc(sizeof(ArenaChunk) + ARENA_CHUNK_SIZE);
+        chunk->next = arena->chunks;
+        chunk->used = 0;
+        chunk->size = ARENA_CHUNK_SIZE;
+        arena->chunks = chunk;
+        arena->reserved += ARENA_CHUNK_SIZE;
+    }
+    ArenaBlock* block = (ArenaBlock*)((char*)(chunk + 1) + chunk->used);
+    chunk->used += bytes;
+    return block;
+}
+
+static ArenaBlock* allocate_large(Arena* arena, size_t size) {
+    ArenaBlock** link = &arena->cached;
+    while (*link != NULL) {
+        ArenaBlock* block = *link;
+        // a cached block is reused if it wastes at most half of itself
+        if (block->size >= size && block->size / 2 <= size) {
+            *link = block->next;
+            arena->num_cached--;
+            return block;
+        }
+        link = &block->next;
+    }
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+    block->size = size;
+    arena->reserved += size;
+    return block;
+}
+
+static void* allocate(Arena* arena, size_t size) {
+    ArenaBlock* block;
+    if (arena == NULL) {
+        block = malloc(sizeof(ArenaBlock) + size);
+        block->arena = NULL;
+        block->size_class = ARENA_CLASSES;
+        block->size = size;
+        return block + 1;
+    }
+    size_t c = size_class(size);
+    if (c < ARENA_CLASSES) {
+        block = arena->free_blocks[c];
+        if (block != NULL) {
+            arena->free_blocks[c] = block->next;
+        } else {
+            block = carve(arena, c);
+        }
+        block->size_class = c;
+    } else {
+        block = allocate_large(arena, size);
+        block->size_class = ARENA_CLASSES;
+        block->prev = NULL;
+        block->next = arena->large;
+        if (arena->large != NULL) {
+            arena->large->prev = block;
+        }
+        arena->large = block;
+    }
+    block->arena = arena;
+    account(arena, block_capacity(block));
+    return block + 1;
+}
+
+Arena* create_arena(size_t limit) {
+    Arena* arena = calloc(1, sizeof(Arena));
+    arena->limit = limit;
+    return arena;
+}
+
+void free_arena(Arena* arena) {
+    if (arena == NULL) {
+        return;
+    }
+    while (arena->chunks != NULL) {
+        ArenaChunk* next = arena->chunks->next;
+        free(arena->chunks);
+        arena->chunks = next;
+    }
+    while (arena->large != NULL) {
+        ArenaBlock* next = arena->large->next;
+        free(arena->large);
+        arena->large = next;
+    }
+    while (arena->cached != NULL) {
+        ArenaBlock* next = arena->cached->next;
+        free(arena->cached);
+        arena->cached = next;
+    }
+    free(arena);
+}
+
+Arena* use_arena(Arena* arena) {
+    Arena* previous = current_arena;
+    current_arena = arena;
+    return previous;
+}
+
+void* arena_malloc(size_t size) {
+    return allocate(current_arena, size);
+}
+
+void* arena_calloc(size_t count, size_t size) {
+    void* pointer = allocate(current_arena, count * size);
+    memset(pointer, 0, count * size);
+    return pointer;
+}
+
+void* arena_realloc(void* pointer, size_t size) {
+    if (pointer == NULL) {
+        return arena_malloc(size);
+    }
+    ArenaBlock* block = (ArenaBlock*)pointer - 1;
+    if (block->arena == NULL) {
+        block = realloc(block, sizeof(ArenaBlock) + size);
+        block->size = size;
+        return block + 1;
+    }
+    size_t capacity = block_capacity(block);
+    if (size <= capacity && (block->size_class < ARENA_CLASSES || capacity / 2 <= size)) {
+        return pointer;
+    }
+    void* moved = allocate(block->arena, size);
+    memcpy(moved, pointer, size < capacity ? size : capacity);
+    arena_free(pointer);
+    return moved;
+}
+
+void arena_free(void* pointer) {
+    if (pointer == NULL) {
+        return;
+    }
+    ArenaBlock* block = (ArenaBlock*)pointer - 1;
+    Arena* arena = block->arena;
+    if (arena == NULL) {
+        free(block);
+        return;
+    }
+    arena->in_use -= block_capacity(block);
+    if (block->size_class < ARENA_CLASSES) {
+        block->next = arena->free_blocks[block->size_class];
+        arena->free_blocks[block->size_class] = block;
+        return;
+    }
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        arena->large = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+    if (arena->num_cached < ARENA_CACHED_LARGE) {
+        block->next = arena->cached;
+        arena->cached = block;
+        arena->num_cached++;
+    } else {
+        arena->reserved -= block->size;
+        free(block);
+    }
+}
+
+Arena* arena_of(const void* pointer) {
+    return ((const ArenaBlock*)pointer - 1)->arena;
+}
+
+bool arena_over_limit(const Arena* arena) {
+    return arena->limit > 0 && arena->in_use > arena->limit;
+}
@@ -0,0 +1,207 @@
+/**
+ * catalog_map.c
+ * The string map behind the database catalog and the client handles.
+ **/
+#include <stdlib.h>
+#include <string.h>
+
+#include "catalog_map.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define CONTROL_EMPTY 0x80
+#define INIT_CAPACITY CATALOG_GROUP
+#define KEY_CHUNK_SIZE 4096
+
+/**
+ * hash_key mixes the key 8 bytes at a time, with the finalizer of
+ * MurmurHash3 so that the low and the high bits both depend on every byte
+ **/
+static uint64_t hash_key(const char* key, size_t length) {
+    const uint64_t m = UINT64_C(0xc6a4a7935bd1e995);
+    uint64_t h = UINT64_C(0x9e3779b97f4a7c15) ^ (length * m);
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, key + i, 8);
+        word *= m;
+        word ^= word >> 47;
+        word *= m;
+        h = (h ^ word) * m;
+    }
+    if (i < length) {
+        uint64_t word = 0;
+        memcpy(&word, key + i, length - i);
+        h = (h ^ word) * m;
+    }
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint8_t control_byte(uint64_t hash) {
+    return hash & 0x7f;
+}
+
+static inline size_t first_group(const CatalogMap* map, uint64_t hash) {
+    return (hash >> 7) & (map->capacity / CATALOG_GROUP - 1);
+}
+
+/**
+ * group_match returns a mask with bit i set if control[i] equals byte,
+ * for the CATALOG_GROUP bytes of a group
+ **/
+static inline unsigned int group_match(const uint8_t* control, uint8_t byte) {
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i*)control);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < CATALOG_GROUP; i++) {
+        mask |= (unsigned int)(control[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+static CatalogSlot* find_slot(const CatalogMap* map, const char* key, size_t length, uint64_t hash) {
+    uint8_t byte = control_byte(hash);
+    size_t group_mask = map->capacity / CATALOG_GROUP - 1;
+    size_t group = first_group(map, hash);
+    for (size_t step = 1; step <= group_mask + 1; step++) {
+        const uint8_t* control = map->control + group * CATALOG_GROUP;
+        unsigned int matches = group_match(control, byte);
+        while (matches != 0) {
+            CatalogSlot* slot = &map->slots[group * CATALOG_GROUP + __builtin_ctz(matches)];
+            if (slot->hash == hash && slot->length == length && memcmp(slot->key, key, length) == 0) {
+                return slot;
+            }
+            matches &= matches - 1;
+        }
+        // the key would have been placed in the first group with room
+        if (group_match(control, CONTROL_EMPTY) != 0) {
+            return NULL;
+        }
+        group = (group + step) & group_mask;
+    }
+    return NULL;
+}
+
+/**
+ * place a slot of a key known not to be in the map in the first empty
+ * slot of its probe sequence
+ **/
+static void place_slot(CatalogMap* map, const CatalogSlot* slot) {
+    size_t group_mask = map->capacity / CATALOG_GROUP - 1;
+    size_t group = first_group(map, slot->hash);
+    for (size_t step = 1;; step++) {
+        unsigned int empty = group_match(map->control + group * CATALOG_GROUP, CONTROL_EMPTY);
+        if (empty != 0) {
+            size_t i = group * CATALOG_GROUP + __builtin_ctz(empty);
+            map->control[i] = control_byte(slot->hash);
+            map->slots[i] = *slot;
+            return;
+        }
+        group = (group + step) & group_mask;
+    }
+}
+
+static void init_slots(CatalogMap* map, size_t capacity) {
+    map->capacity = capacity;
+    map->control = malloc(capacity);
+    memset(map->control, CONTROL_EMPTY, capacity);
+    map->slots = malloc(sizeof(CatalogSlot) * capacity);
+}
+
+static void grow(CatalogMap* map) {
+    uint8_t* control = map->control;
+    CatalogSlot* slots = map->slots;
+    size_t capacity = map->capacity;
+    init_slots(map, capacity * 2);
+    for (size_t i = 0; i < capacity; i++) {
+        if (control[i] != CONTROL_EMPTY) {
+            place_slot(map, &slots[i]);
+        }
+    }
+    free(control);
+    free(slots);
+}
+
+/**
+ * copy a key into the key arena
+ **/
+static const char* store_key(CatalogMap* map, const char* key, size_t length) {
+    KeyChunk* chunk = map->chunks;
+    if (chunk == NULL || chunk->used + length + 1 > chunk->size) {
+        size_t size = length + 1 > KEY_CHUNK_SIZE ? length + 1 : KEY_CHUNK_SIZE;
+        chunk = malloc(sizeof(KeyChunk) + size);
+        chunk->next = map->chunks;
+        chunk->used = 0;
+        chunk->size = size;
+        map->chunks = chunk;
+    }
+    char* copy = chunk->keys + chunk->used;
+    memcpy(copy, key, length + 1);
+    chunk->used += length + 1;
+    return copy;
+}
+
+CatalogMap* create_catalog_map(void) {
+    CatalogMap* map = malloc(sizeof(CatalogMap));
+    map->count = 0;
+    map->chunks = NULL;
+    init_slots(map, INIT_CAPACITY);
+    return map;
+}
+
+void free_catalog_map(CatalogMap* map) {
+    if (map == NULL) {
+        return;
+    }
+    while (map->chunks != NULL) {
+        KeyChunk* next = map->chunks->next;
+        free(map->chunks);
+        map->chunks = next;
+    }
+    free(map->control);
+    free(map->slots);
+    free(map);
+}
+
+void* catalog_get(const CatalogMap* map, const char* key) {
+    return catalog_find(map, key, strlen(key));
+}
+
+void* catalog_find(const CatalogMap* map, const char* key, size_t length) {
+    CatalogSlot* slot = find_slot(map, key, length, hash_key(key, length));
+    return slot == NULL ? NULL : slot->value;
+}
+
+void catalog_put(CatalogMap* map, const char* key, void* value) {
+    size_t length = strlen(key);
+    uint64_t hash = hash_key(key, length);
+    CatalogSlot* slot = find_slot(map, key, length, hash);
+    if (slot != NULL) {
+        slot->value = value;
+        return;
+    }
+    if ((map->count + 1) * 8 > map->capacity * 7) {
+        grow(map);
+    }
+    CatalogSlot added = { hash, store_key(map, key, length), length, value };
+    place_slot(map, &added);
+    map->count++;
+}
+
+void catalog_foreach(const CatalogMap* map, void (*visit)(const char* key, void* value, void* arg), void* arg) {
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->control[i] != CONTROL_EMPTY) {
+            visit(map->slots[i].key, map->slots[i].value, arg);
+        }
+    }
+}
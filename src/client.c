@@ -15,6 +15,8 @@ machine please look into this as a a source of error. */
  * For more information on unix sockets, refer to:
  * http://beej.us/guide/bgipc/output/html/multipage/unixsock.html
  **/
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -25,7 +27,9 @@ machine please look into this as a a source of error. */
 #include <sys/un.h>
 
 #include "common.h"
+#include "db_element.h"
 #include "message.h"
+#include "result_stream.h"
 #include "utils_func.h"
 
 #define DEFAULT_STDIN_BUFFER_SIZE 1024
@@ -61,15 +65,249 @@ int connect_client() {
     return client_socket;
 }
 
-int main(void)
+/**
+ * receive_frame()
+ *
+ * Receives the next frame of a streamed result into frame_buffer.
+ * Returns the length of its payload, 0 at the end of the result and -1
+ * on failure.
+ **/
+int receive_frame(int client_socket, char* frame_buffer) {
+    frame_header header;
+    if (recv_all(client_socket, &header, sizeof(frame_header)) != 0 ||
+        header.length < 0 || header.length > MAX_FRAME_SIZE ||
+        recv_all(client_socket, frame_buffer, header.length) != 0) {
+        return -1;
+    }
+    return header.length;
+}
+
+/**
+ * receive_stream()
+ *
+ * Prints the frames of a streamed text result as they arrive, until the
+ * zero-length frame that ends it. Returns 0 on success, -1 on failure.
+ **/
+int receive_stream(int client_socket, char* frame_buffer) {
+    int length;
+    while ((length = receive_frame(client_socket, frame_buffer)) > 0) {
+        fwrite(frame_buffer, 1, length, stdout);
+    }
+    fflush(stdout);
+    return length;
+}
+
+/**
+ * print_rows()
+ *
+ * Prints a block of binary rows (column after column) the way the server
+ * prints them as text.
+ **/
+void print_rows(const char* block, int rows, int* types, int num_columns) {
+    const char* column = block;
+    for (int i = 0; i < rows; i++) {
+        column = block;
+        for (int j = 0; j < num_columns; j++) {
+            size_t width = data_type_size(types[j]);
+            const char* value = column + i * width;
+            switch (types[j]) {
+                case LONG:
+                    printf("%ld", *(const long*)value);
+                    break;
+                case FLOAT:
+                    printf("%.2f", *(const double*)value);
+                    break;
+                default:
+                    printf("%d", *(const int*)value);
+                    break;
+            }
+            putchar(j + 1 < num_columns ? ',' : '\n');
+            column += rows * width;
+        }
+    }
+}
+
+/**
+ * receive_binary()
+ *
+ * Receives a binary result. It is printed as text, or when binary_file is
+ * set, appended to it as: the number of columns and their DataTypes (ints),
+ * then for every block its number of rows (int) and its values column after
+ * column, and a block of 0 rows at the end.
+ * Returns 0 on success, -1 on failure.
+ **/
+int receive_binary(int client_socket, char* frame_buffer, FILE* binary_file) {
+    // the first frame holds the type of every column
+    int length = receive_frame(client_socket, frame_buffer);
+    if (length <= 0) {
+        return -1;
+    }
+    int num_columns = length / sizeof(int);
+    int* types = malloc(length);
+    memcpy(types, frame_buffer, length);
+    size_t row_width = 0;
+    for (int j = 0; j < num_columns; j++) {
+        row_width += data_type_size(types[j]);
+    }
+    if (binary_file != NULL) {
+        fwrite(&num_columns, sizeof(int), 1, binary_file);
+        fwrite(types, sizeof(int), num_columns, binary_file);
+    }
+    while ((length = receive_frame(client_socket, frame_buffer)) > 0) {
+        int rows = length / row_width;
+        if (binary_file != NULL) {
+            fwrite(&rows, sizeof(int), 1, binary_file);
+            fwrite(frame_buffer, 1, length, binary_file);
+        } else {
+            print_rows(frame_buffer, rows, types, num_columns);
+        }
+    }
+    if (binary_file != NULL && length == 0) {
+        fwrite(&length, sizeof(int), 1, binary_file);
+    }
+    fflush(binary_file != NULL ? binary_file : stdout);
+    free(types);
+    return length;
+}
+
+/**
+ * receive_response()
+ *
+ * Receives the response to the query of the given sequence and prints it.
+ * Returns 0 on success, -1 if the connection closed or failed.
+ **/
+int receive_response(int client_socket, int sequence, char* frame_buffer, FILE* binary_file) {
+    message recv_message;
+    if (recv_all(client_socket, &(recv_message), sizeof(message)) != 0) {
+        return -1;
+    }
+    if (recv_message.sequence != sequence) {
+        log_err("Response %d received for query %d.\n", recv_message.sequence, sequence);
+        return -1;
+    }
+    if (recv_message.status == OK_STREAM_RESPONSE) {
+        int received = recv_message.flags & MESSAGE_BINARY_RESULTS ?
+            receive_binary(client_socket, frame_buffer, binary_file) :
+            receive_stream(client_socket, frame_buffer);
+        if (received != 0) {
+            log_err("Failed to receive result.");
+            return -1;
+        }
+    } else if ((recv_message.status == OK_WAIT_FOR_RESPONSE || recv_message.status == OK_DONE) &&
+               (int) recv_message.length > 0) {
+        // Receive the payload and print it out
+        int num_bytes = (int) recv_message.length;
+        char* payload = malloc(num_bytes + 1);
+        if (recv_all(client_socket, payload, num_bytes) != 0) {
+            log_err("Failed to receive message.");
+            free(payload);
+            return -1;
+        }
+        payload[num_bytes] = '\0';
+        printf("%s\n", payload);
+        free(payload);
+    } else if ((int) recv_message.length > 0) {
+        // the payload of an error is not printed
+        char* payload = malloc(recv_message.length);
+        int received = recv_all(client_socket, payload, recv_message.length);
+        free(payload);
+        if (received != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * ResponseReader
+ * The thread receiving the responses of pipelined queries, in the order
+ * of their sequence. received counts the responses received.
+ **/
+typedef struct ResponseReader {
+    int client_socket;
+    char* frame_buffer;
+    FILE* binary_file;
+    int received;
+} ResponseReader;
+
+/**
+ * read_responses()
+ *
+ * Receives and prints responses until the server closes the connection,
+ * which it does once it has answered every query sent before the client
+ * shut down its side.
+ **/
+void* read_responses(void* arg) {
+    ResponseReader* reader = arg;
+    while (receive_response(reader->client_socket, reader->received, reader->frame_buffer,
+                            reader->binary_file) == 0) {
+        reader->received++;
+    }
+    fflush(stdout);
+    return NULL;
+}
+
+/**
+ * read_line()
+ *
+ * Reads a whole line of stdin into a packet, after the room of its header.
+ * The packet grows for lines longer than it, e.g. multi-row inserts.
+ * Returns the length of the line, 0 at the end of input.
+ **/
+size_t read_line(char** packet, size_t* capacity) {
+    size_t length = 0;
+    while (fgets(*packet + sizeof(message) + length, *capacity - sizeof(message) - length, stdin) != NULL) {
+        length += strlen(*packet + sizeof(message) + length);
+        if ((*packet)[sizeof(message) + length - 1] == '\n') {
+            break;
+        }
+        if (sizeof(message) + length + 1 == *capacity) {
+            *capacity *= 2;
+            *packet = realloc(*packet, *capacity);
+        }
+    }
+    return length;
+}
+
+/**
+ * Usage: ./client [-b] [-o binary_file] [-s]
+ * -b asks the server for binary print results, which are still printed as
+ * text; -o writes them in binary to binary_file instead (implies -b).
+ * Queries typed at a terminal are sent one at a time, each once the one
+ * before has been answered. Queries read from a file or a pipe are
+ * pipelined: sent as fast as they are read while a second thread prints
+ * the responses, so a script runs at the speed of the server rather than
+ * one round trip per query. -s sends them one at a time as well.
+ **/
+int main(int argc, char** argv)
 {
+    int flags = 0;
+    FILE* binary_file = NULL;
+    bool interactive = isatty(fileno(stdin));
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0) {
+            flags |= MESSAGE_BINARY_RESULTS;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            flags |= MESSAGE_BINARY_RESULTS;
+            binary_file = fopen(argv[++i], "wb");
+            if (binary_file == NULL) {
+                log_err("Cannot open %s.\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-s") == 0) {
+            interactive = true;
+        } else {
+            log_err("usage: %s [-b] [-o binary_file] [-s]\n", argv[0]);
+            exit(1);
+        }
+    }
+
     int client_socket = connect_client();
     if (client_socket < 0) {
         exit(1);
     }
 
     message send_message;
-    message recv_message;
 
     // Always output an interactive marker at the start of each command if the
     // input is from stdin. Do not output if piped in from file or from other fd
@@ -78,66 +316,71 @@ int main(void)
         prefix = "db_client > ";
     }
 
-    char *output_str = NULL;
-    int len = 0;
+    char* frame_buffer = malloc(MAX_FRAME_SIZE);
+
+    // a pipelined client prints the responses from a thread of its own
+    ResponseReader reader;
+    pthread_t reader_thread;
+    reader.client_socket = client_socket;
+    reader.frame_buffer = frame_buffer;
+    reader.binary_file = binary_file;
+    reader.received = 0;
+    if (!interactive && pthread_create(&reader_thread, NULL, read_responses, &reader) != 0) {
+        log_err("Failed to start the response reader.\n");
+        exit(1);
+    }
 
     // Continuously loop and wait for input. At each iteration:
     // 1. output interactive marker
     // 2. read from stdin until eof.
-    char read_buffer[DEFAULT_STDIN_BUFFER_SIZE];
-    send_message.payload = read_buffer;
-    send_message.status = 0;
-
-    while (printf("%s", prefix), output_str = fgets(read_buffer,
-           DEFAULT_STDIN_BUFFER_SIZE, stdin), !feof(stdin)) {
-        if (output_str == NULL) {
-            log_err("fgets failed.\n");
-            break;
-        }
+    // A query is sent with its header in one packet: the header, then the
+    // query read in place after it.
+    size_t packet_capacity = sizeof(message) + DEFAULT_STDIN_BUFFER_SIZE;
+    char* packet = malloc(packet_capacity);
+    memset(&send_message, 0, sizeof(message));
+    send_message.flags = flags;
+    int sent = 0;
+    size_t line_length;
+
+    // the last line of a script may not end with a newline, so stop only
+    // once there is nothing left to read
+    while (printf("%s", prefix), line_length = read_line(&packet, &packet_capacity), line_length > 0) {
 
         // Only process input that is greater than 1 character.
         // Convert to message and send the message and the
         // payload directly to the server.
-        send_message.length = strlen(read_buffer);
+        send_message.length = line_length;
         if (send_message.length > 1) {
-            // Send the message_header, which tells server payload size
-            if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-                log_err("Failed to send message header.");
-                exit(1);
+            send_message.sequence = sent;
+            memcpy(packet, &send_message, sizeof(message));
+            if (send_all(client_socket, packet, sizeof(message) + send_message.length) != 0) {
+                // the server is gone, e.g. after a shutdown
+                log_info("Server closed connection\n");
+                break;
             }
+            sent++;
 
-            // Send the payload (query) to server
-            if (send(client_socket, send_message.payload, send_message.length, 0) == -1) {
-                log_err("Failed to send query payload.");
-                exit(1);
-            }
-
-            // Always wait for server response (even if it is just an OK message)
-            if ((len = recv(client_socket, &(recv_message), sizeof(message), 0)) > 0) {
-                if ((recv_message.status == OK_WAIT_FOR_RESPONSE || recv_message.status == OK_DONE) &&
-                    (int) recv_message.length > 0) {
-                    // Calculate number of bytes in response package
-                    int num_bytes = (int) recv_message.length;
-                    char payload[num_bytes + 1];
-
-                    // Receive the payload and print it out
-                    if ((len = recv(client_socket, payload, num_bytes, 0)) > 0) {
-                        payload[num_bytes] = '\0';
-                        printf("%s\n", payload);
-                    }
-                }
-            }
-            else {
-                if (len < 0) {
-                    log_err("Failed to receive message.");
-                }
-                else {
-		            log_info("Server closed connection\n");
-		        }
+            // Wait for the server response (even if it is just an OK message)
+            if (interactive && receive_response(client_socket, send_message.sequence, frame_buffer,
+                                                binary_file) != 0) {
+                log_info("Server closed connection\n");
                 exit(1);
             }
         }
     }
+    if (!interactive) {
+        // the server answers the queries sent so far, then closes
+        shutdown(client_socket, SHUT_WR);
+        pthread_join(reader_thread, NULL);
+        if (reader.received < sent) {
+            log_info("%d of %d queries were not answered.\n", sent - reader.received, sent);
+        }
+    }
+    free(packet);
+    free(frame_buffer);
+    if (binary_file != NULL) {
+        fclose(binary_file);
+    }
     close(client_socket);
     return 0;
 }
@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "catalog_map.h"
+#include "client_context.h"
+#include "db_pipeline.h"
+#include "utils_func.h"
+
+#define INIT_SLOTS 16
+
+size_t client_memory_limit = 0;
+
+ClientContext* create_client_context(void) {
+    ClientContext* context = calloc(1, sizeof(ClientContext));
+    context->handles = create_catalog_map();
+    context->arena = create_arena(client_memory_limit);
+    return context;
+}
+
+void free_result(Result* result) {
+    if (result == NULL) {
+        return;
+    }
+    discard_deferred(result);
+    arena_free(result->payload);
+    arena_free(result);
+}
+
+/**
+ * the results live in the arena of the client and go with it, only their
+ * deferred plans are registered outside of it
+ **/
+static void discard_handle(const char* name, void* value, void* arg) {
+    (void) name;
+    (void) arg;
+    GeneralizedColumnHandle* handle = value;
+    if (handle->generalized_column.column_type == RESULT && handle->generalized_column.column_pointer.result != NULL) {
+        discard_deferred(handle->generalized_column.column_pointer.result);
+    }
+}
+
+void free_client_context(ClientContext* context) {
+    if (context == NULL) {
+        return;
+    }
+    catalog_foreach(context->handles, discard_handle, NULL);
+    free_catalog_map(context->handles);
+    log_info("session released %zu bytes of intermediates, high-water mark %zu bytes\n",
+             context->arena->reserved, context->arena->high_water);
+    free_arena(context->arena);
+    free(context->batch);
+    free(context->print_buffer);
+    free(context);
+}
+
+bool store_result(ClientContext* context, const char* name, Result* result) {
+    GeneralizedColumnHandle* handle = catalog_get(context->handles, name);
+    if (handle != NULL) {
+        if (handle->generalized_column.column_type == RESULT) {
+            free_result(handle->generalized_column.column_pointer.result);
+        }
+    } else {
+        handle = arena_malloc(sizeof(GeneralizedColumnHandle));
+        strncpy(handle->name, name, HANDLE_MAX_SIZE - 1);
+        handle->name[HANDLE_MAX_SIZE - 1] = '\0';
+        catalog_put(context->handles, handle->name, handle);
+    }
+    handle->generalized_column.column_type = RESULT;
+    if (arena_over_limit(context->arena)) {
+        log_err("result %s discarded: the client holds %zu bytes, its limit is %zu\n",
+                handle->name, context->arena->in_use, context->arena->limit);
+        free_result(result);
+        result = NULL;
+    }
+    handle->generalized_column.column_pointer.result = result;
+    return result != NULL;
+}
+
+Result* lookup_result(ClientContext* context, const char* name, size_t length) {
+    GeneralizedColumnHandle* handle = catalog_find(context->handles, name, length);
+    if (handle == NULL || handle->generalized_column.column_type != RESULT) {
+        return NULL;
+    }
+    return handle->generalized_column.column_pointer.result;
+}
+
+void batch_query(ClientContext* context, DbOperator* query) {
+    if (context->batch_size == context->batch_slots) {
+        context->batch_slots = context->batch_slots == 0 ? INIT_SLOTS : context->batch_slots * 2;
+        context->batch = realloc(context->batch, context->batch_slots * sizeof(DbOperator*));
+    }
+    context->batch[context->batch_size++] = query;
+}
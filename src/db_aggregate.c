@@ -0,0 +1,173 @@
+/**
+ * db_aggregate.c
+ * min, max, sum and avg over results and base columns, and add and sub
+ * of results.
+ **/
+#include <float.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "db_aggregate.h"
+#include "thread_pool.h"
+
+void start_aggregate(Aggregate* aggregate, DataType type) {
+    aggregate->type = type;
+    aggregate->min = LONG_MAX;
+    aggregate->max = LONG_MIN;
+    aggregate->sum = 0;
+    aggregate->float_min = DBL_MAX;
+    aggregate->float_max = -DBL_MAX;
+    aggregate->float_sum = 0;
+    aggregate->count = 0;
+}
+
+void merge_aggregate(Aggregate* aggregate, const Aggregate* partial) {
+    aggregate->min = partial->min < aggregate->min ? partial->min : aggregate->min;
+    aggregate->max = partial->max > aggregate->max ? partial->max : aggregate->max;
+    aggregate->sum += partial->sum;
+    aggregate->float_min = partial->float_min < aggregate->float_min ? partial->float_min : aggregate->float_min;
+    aggregate->float_max = partial->float_max > aggregate->float_max ? partial->float_max : aggregate->float_max;
+    aggregate->float_sum += partial->float_sum;
+    aggregate->count += partial->count;
+}
+
+void aggregate_zone(Aggregate* aggregate, const ZoneMap* zones, size_t zone, size_t rows) {
+    aggregate->min = zones->mins[zone] < aggregate->min ? zones->mins[zone] : aggregate->min;
+    aggregate->max = zones->maxs[zone] > aggregate->max ? zones->maxs[zone] : aggregate->max;
+    aggregate->sum += zones->sums[zone];
+    aggregate->count += rows;
+}
+
+Result* aggregate_value(AggregateType type, const Aggregate* aggregate) {
+    Result* result = arena_malloc(sizeof(Result));
+    result->num_tuples = 1;
+    result->format = POSITION_ARRAY;
+    result->copy = NULL;
+    result->table = NULL;
+    result->version = 0;
+    result->deferred = NULL;
+    bool floats = aggregate->type == FLOAT;
+    if (type == AGGREGATE_AVG || (type == AGGREGATE_SUM && floats)) {
+        double* value = arena_malloc(sizeof(double));
+        double sum = floats ? aggregate->float_sum : (double)aggregate->sum;
+        *value = type == AGGREGATE_SUM ? sum : aggregate->count > 0 ? sum / aggregate->count : 0;
+        result->data_type = FLOAT;
+        result->payload = value;
+        return result;
+    }
+    if (type == AGGREGATE_SUM) {
+        long* sum = arena_malloc(sizeof(long));
+        *sum = aggregate->sum;
+        result->data_type = LONG;
+        result->payload = sum;
+        return result;
+    }
+    result->num_tuples = aggregate->count > 0 ? 1 : 0;
+    result->data_type = aggregate->type;
+    result->payload = arena_malloc(data_type_size(aggregate->type));
+    bool min = type == AGGREGATE_MIN;
+    switch (aggregate->type) {
+        case INT:
+            *(int*)result->payload = (int)(min ? aggregate->min : aggregate->max);
+            break;
+        case LONG:
+            *(long*)result->payload = min ? aggregate->min : aggregate->max;
+            break;
+        default:
+            *(double*)result->payload = min ? aggregate->float_min : aggregate->float_max;
+            break;
+    }
+    return result;
+}
+
+/**
+ * ParallelMath is the state shared by the workers of an aggregate or of
+ * add and sub, every worker takes a contiguous chunk of the values. An
+ * aggregate fills partials[worker], add and sub write out.
+ **/
+typedef struct ParallelMath {
+    const void* left;
+    const void* right;
+    DataType left_type;
+    DataType right_type;
+    bool subtract;
+    void* out;
+    size_t length;
+    size_t num_workers;
+    Aggregate* partials;
+} ParallelMath;
+
+static void aggregate_chunk(void* arg, size_t worker) {
+    ParallelMath* math = arg;
+    size_t begin = math->length * worker / math->num_workers;
+    size_t end = math->length * (worker + 1) / math->num_workers;
+    aggregate_values(&math->partials[worker], math->left, begin, end);
+}
+
+static void combine_chunk(void* arg, size_t worker) {
+    ParallelMath* math = arg;
+    size_t begin = math->length * worker / math->num_workers;
+    size_t end = math->length * (worker + 1) / math->num_workers;
+    combine_values(math->left, math->left_type, math->right, math->right_type, math->subtract,
+                   math->out, begin, end);
+}
+
+Result* aggregate_result(AggregateType type, Result* values) {
+    ParallelMath math;
+    math.left = values->payload;
+    math.left_type = values->data_type;
+    math.length = values->num_tuples;
+    math.num_workers = parallel_workers(values->num_tuples, PARALLEL_MATH_THRESHOLD);
+    math.partials = malloc(sizeof(Aggregate) * math.num_workers);
+    for (size_t w = 0; w < math.num_workers; w++) {
+        start_aggregate(&math.partials[w], values->data_type);
+    }
+    run_parallel(aggregate_chunk, &math, math.num_workers);
+    Aggregate aggregate;
+    start_aggregate(&aggregate, values->data_type);
+    for (size_t w = 0; w < math.num_workers; w++) {
+        merge_aggregate(&aggregate, &math.partials[w]);
+    }
+    free(math.partials);
+    return aggregate_value(type, &aggregate);
+}
+
+Result* aggregate_column(AggregateType type, Table* table, Column* column) {
+    Aggregate aggregate;
+    start_aggregate(&aggregate, INT);
+    const ZoneMap* zones = column->zones;
+    size_t length = table->table_length;
+    size_t zone = 0;
+    // every zone qualifies, only the rows past the zone map are read
+    for (; zones != NULL && zone < zones->num_zones && zone * ZONE_SIZE < length; zone++) {
+        size_t rows = length - zone * ZONE_SIZE < ZONE_SIZE ? length - zone * ZONE_SIZE : ZONE_SIZE;
+        aggregate_zone(&aggregate, zones, zone, rows);
+    }
+    aggregate_values(&aggregate, column->data, zone * ZONE_SIZE, length);
+    return aggregate_value(type, &aggregate);
+}
+
+Result* combine_results(bool subtract, Result* left, Result* right) {
+    ParallelMath math;
+    math.left = left->payload;
+    math.right = right->payload;
+    math.left_type = left->data_type;
+    math.right_type = right->data_type;
+    math.subtract = subtract;
+    math.length = left->num_tuples;
+    math.num_workers = parallel_workers(left->num_tuples, PARALLEL_MATH_THRESHOLD);
+    DataType type = combined_type(left->data_type, right->data_type);
+    math.out = arena_malloc(data_type_size(type) * (math.length > 0 ? math.length : 1));
+    run_parallel(combine_chunk, &math, math.num_workers);
+    Result* result = arena_malloc(sizeof(Result));
+    result->num_tuples = math.length;
+    result->data_type = type;
+    result->payload = math.out;
+    result->format = POSITION_ARRAY;
+    result->copy = NULL;
+    result->table = NULL;
+    result->version = 0;
+    result->deferred = NULL;
+    return result;
+}
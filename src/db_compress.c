@@ -0,0 +1,328 @@
+/**
+ * db_compress.c
+ * Lightweight column encodings and scans over the encoded values.
+ **/
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "db_compress.h"
+#include "db_sort.h"
+#include "db_stats.h"
+#include "utils_func.h"
+
+static int bits_needed(uint32_t max_code) {
+    return max_code == 0 ? 0 : 32 - __builtin_clz(max_code);
+}
+
+static size_t num_blocks(size_t length) {
+    return (length + COMPRESS_BLOCK - 1) / COMPRESS_BLOCK;
+}
+
+static size_t packed_words(size_t length, int bit_width) {
+    return num_blocks(length) * COMPRESS_LANES * bit_width;
+}
+
+/**
+ * pack one block of codes: value 4 * s + l is slot s of lane l, at bits
+ * [s * bit_width, (s + 1) * bit_width) of the words of the lane
+ **/
+static void pack_block(const uint32_t* codes, int bit_width, uint32_t* words) {
+    for (int s = 0; s < 32; s++) {
+        int word = s * bit_width / 32;
+        int offset = s * bit_width % 32;
+        for (int l = 0; l < COMPRESS_LANES; l++) {
+            uint32_t code = codes[s * COMPRESS_LANES + l];
+            words[word * COMPRESS_LANES + l] |= code << offset;
+            if (offset + bit_width > 32) {
+                words[(word + 1) * COMPRESS_LANES + l] |= code >> (32 - offset);
+            }
+        }
+    }
+}
+
+/**
+ * unpack one block of codes into out, four lanes at a time
+ **/
+static void unpack_block(const uint32_t* words, int bit_width, int* out) {
+    if (bit_width == 0) {
+        memset(out, 0, COMPRESS_BLOCK * sizeof(int));
+        return;
+    }
+#ifdef __SSE2__
+    const __m128i* in = (const __m128i*)words;
+    const __m128i mask = _mm_set1_epi32(bit_width == 32 ? -1 : (int)((1u << bit_width) - 1));
+    __m128i current = _mm_loadu_si128(in++);
+    int shift = 0;
+    for (int s = 0; s < 32; s++) {
+        __m128i value = _mm_srl_epi32(current, _mm_cvtsi32_si128(shift));
+        shift += bit_width;
+        if (shift >= 32 && s < 31) {
+            current = _mm_loadu_si128(in++);
+            shift -= 32;
+            if (shift > 0) {
+                value = _mm_or_si128(value, _mm_sll_epi32(current, _mm_cvtsi32_si128(bit_width - shift)));
+            }
+        }
+        _mm_storeu_si128((__m128i*)(out + s * COMPRESS_LANES), _mm_and_si128(value, mask));
+    }
+#else
+    uint32_t mask = bit_width == 32 ? UINT32_MAX : (1u << bit_width) - 1;
+    for (int s = 0; s < 32; s++) {
+        int word = s * bit_width / 32;
+        int offset = s * bit_width % 32;
+        for (int l = 0; l < COMPRESS_LANES; l++) {
+            uint32_t code = words[word * COMPRESS_LANES + l] >> offset;
+            if (offset + bit_width > 32) {
+                code |= words[(word + 1) * COMPRESS_LANES + l] << (32 - offset);
+            }
+            out[s * COMPRESS_LANES + l] = code & mask;
+        }
+    }
+#endif
+}
+
+/**
+ * bit-pack the codes of length values, code_of maps a value to its code
+ **/
+static uint32_t* pack_codes(const int* data, size_t length, int bit_width,
+                            uint32_t (*code_of)(const CompressedColumn*, int), const CompressedColumn* compressed) {
+    uint32_t* packed = calloc(packed_words(length, bit_width) + 1, sizeof(uint32_t));
+    uint32_t codes[COMPRESS_BLOCK];
+    for (size_t b = 0; b < num_blocks(length); b++) {
+        size_t begin = b * COMPRESS_BLOCK;
+        for (size_t i = 0; i < COMPRESS_BLOCK; i++) {
+            codes[i] = begin + i < length ? code_of(compressed, data[begin + i]) : 0;
+        }
+        pack_block(codes, bit_width, packed + b * COMPRESS_LANES * bit_width);
+    }
+    return packed;
+}
+
+static uint32_t reference_code(const CompressedColumn* compressed, int value) {
+    return (uint32_t)value - (uint32_t)compressed->base;
+}
+
+/**
+ * index of the first dictionary value >= value (> value if upper)
+ **/
+static size_t dictionary_search(const CompressedColumn* compressed, int value, bool upper) {
+    size_t low = 0;
+    size_t high = compressed->dictionary_size;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int entry = compressed->dictionary[mid];
+        if (upper ? entry <= value : entry < value) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static uint32_t dictionary_code(const CompressedColumn* compressed, int value) {
+    return dictionary_search(compressed, value, false);
+}
+
+static void build_dictionary(CompressedColumn* compressed, const int* data, size_t length) {
+    int* sorted = malloc(length * sizeof(int));
+    memcpy(sorted, data, length * sizeof(int));
+    sort_pairs(sorted, NULL, length);
+    size_t size = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (i == 0 || sorted[i] != sorted[size - 1]) {
+            sorted[size++] = sorted[i];
+        }
+    }
+    compressed->dictionary = realloc(sorted, size * sizeof(int));
+    compressed->dictionary_size = size;
+    compressed->bit_width = bits_needed(size - 1);
+    compressed->packed = pack_codes(data, length, compressed->bit_width, dictionary_code, compressed);
+    compressed->bytes = packed_words(length, compressed->bit_width) * sizeof(uint32_t) + size * sizeof(int);
+}
+
+static void build_runs(CompressedColumn* compressed, const int* data, size_t length, size_t num_runs) {
+    compressed->run_values = malloc(num_runs * sizeof(int));
+    compressed->run_ends = malloc(num_runs * sizeof(uint32_t));
+    size_t r = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (i + 1 == length || data[i + 1] != data[i]) {
+            compressed->run_values[r] = data[i];
+            compressed->run_ends[r++] = i + 1;
+        }
+    }
+    compressed->num_runs = num_runs;
+    compressed->bytes = num_runs * (sizeof(int) + sizeof(uint32_t));
+}
+
+CompressedColumn* compress_column(const int* data, size_t length, size_t distinct) {
+    if (length < COMPRESS_MIN_LENGTH || length > UINT32_MAX) {
+        return NULL;
+    }
+    int min = data[0];
+    int max = data[0];
+    size_t num_runs = 1;
+    for (size_t i = 1; i < length; i++) {
+        min = data[i] < min ? data[i] : min;
+        max = data[i] > max ? data[i] : max;
+        num_runs += data[i] != data[i - 1];
+    }
+    int reference_width = bits_needed((uint32_t)max - (uint32_t)min);
+    size_t reference_bytes = packed_words(length, reference_width) * sizeof(uint32_t);
+    size_t dictionary_bytes = SIZE_MAX;
+    if (distinct > 0 && distinct <= DICTIONARY_MAX_SIZE) {
+        // the estimate may be a little short, count a spare bit
+        dictionary_bytes = packed_words(length, bits_needed(distinct)) * sizeof(uint32_t) + distinct * sizeof(int);
+    }
+    size_t run_bytes = num_runs * (sizeof(int) + sizeof(uint32_t));
+    size_t best = reference_bytes < dictionary_bytes ? reference_bytes : dictionary_bytes;
+    best = run_bytes < best ? run_bytes : best;
+    if (best > length * sizeof(int) * 3 / 4) {
+        return NULL;
+    }
+    CompressedColumn* compressed = calloc(1, sizeof(CompressedColumn));
+    compressed->length = length;
+    if (best == run_bytes) {
+        compressed->encoding = ENCODING_RLE;
+        build_runs(compressed, data, length, num_runs);
+    } else if (best == reference_bytes) {
+        compressed->encoding = ENCODING_FOR;
+        compressed->base = min;
+        compressed->bit_width = reference_width;
+        compressed->packed = pack_codes(data, length, reference_width, reference_code, compressed);
+        compressed->bytes = reference_bytes;
+    } else {
+        compressed->encoding = ENCODING_DICTIONARY;
+        build_dictionary(compressed, data, length);
+    }
+    return compressed;
+}
+
+void free_compressed(CompressedColumn* compressed) {
+    if (compressed == NULL) {
+        return;
+    }
+    free(compressed->packed);
+    free(compressed->dictionary);
+    free(compressed->run_values);
+    free(compressed->run_ends);
+    free(compressed);
+}
+
+/**
+ * scan the bit-packed codes of rows [begin, end) group by group against
+ * [low, high] over codes
+ **/
+static size_t packed_select(const CompressedColumn* compressed, uint32_t low, uint32_t high,
+                            size_t begin, size_t end, int* out) {
+    ScanPredicate predicate;
+    predicate.kind = SCAN_RANGE;
+    predicate.low = low;
+    predicate.high = high;
+    int codes[COMPRESS_GROUP];
+    size_t block_words = COMPRESS_LANES * compressed->bit_width;
+    size_t k = 0;
+    for (size_t group = begin; group < end; group += COMPRESS_GROUP) {
+        size_t count = end - group < COMPRESS_GROUP ? end - group : COMPRESS_GROUP;
+        const uint32_t* words = compressed->packed + group / COMPRESS_BLOCK * block_words;
+        for (size_t b = 0; b * COMPRESS_BLOCK < count; b++) {
+            unpack_block(words + b * block_words, compressed->bit_width, codes + b * COMPRESS_BLOCK);
+        }
+        // k <= group - begin, so out + k has room for count positions
+        size_t found = scan_positions(codes, NULL, 0, count, &predicate, out + k);
+        for (size_t i = k; i < k + found; i++) {
+            out[i] += group;
+        }
+        k += found;
+    }
+    return k;
+}
+
+/**
+ * every run overlapping rows [begin, end) whose value matches contributes
+ * its rows, found with the first run ending after begin
+ **/
+static size_t run_select(const CompressedColumn* compressed, const ScanPredicate* predicate,
+                         size_t begin, size_t end, int* out) {
+    unsigned int range = (unsigned int)predicate->high - (unsigned int)predicate->low;
+    size_t low = 0;
+    size_t high = compressed->num_runs;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (compressed->run_ends[mid] <= begin) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    size_t k = 0;
+    size_t row = begin;
+    for (size_t r = low; r < compressed->num_runs && row < end; r++) {
+        size_t run_end = compressed->run_ends[r] < end ? compressed->run_ends[r] : end;
+        if ((unsigned int)compressed->run_values[r] - (unsigned int)predicate->low <= range) {
+            for (; row < run_end; row++) {
+                out[k++] = row;
+            }
+        }
+        row = run_end;
+    }
+    return k;
+}
+
+size_t compressed_select(const CompressedColumn* compressed, const ScanPredicate* predicate,
+                         size_t begin, size_t end, int* out) {
+    if (predicate->kind == SCAN_NONE || begin >= end) {
+        return 0;
+    }
+    if (compressed->encoding == ENCODING_RLE) {
+        return run_select(compressed, predicate, begin, end, out);
+    }
+    if (compressed->encoding == ENCODING_DICTIONARY) {
+        size_t low = dictionary_search(compressed, predicate->low, false);
+        size_t high = dictionary_search(compressed, predicate->high, true);
+        return low < high ? packed_select(compressed, low, high - 1, begin, end, out) : 0;
+    }
+    // offsets from the reference, clamped to the codes the width can hold
+    long long max_code = compressed->bit_width == 0 ? 0 : (1LL << compressed->bit_width) - 1;
+    long long low = (long long)predicate->low - compressed->base;
+    long long high = (long long)predicate->high - compressed->base;
+    low = low < 0 ? 0 : low;
+    high = high > max_code ? max_code : high;
+    return low <= high ? packed_select(compressed, low, high, begin, end, out) : 0;
+}
+
+void compress_table(Table* table) {
+    drop_compressed(table);
+    for (size_t j = 0; j < table->col_used; j++) {
+        Column* column = &table->columns[j];
+        size_t distinct = column->stats != NULL ? column->stats->distinct : 0;
+        column->compressed = compress_column(column->data, table->table_length, distinct);
+        if (column->compressed != NULL) {
+            log_info("column %s.%s: %s encoding, %zu bytes instead of %zu\n", table->name, column->name,
+                     encoding_name(column->compressed->encoding), column->compressed->bytes,
+                     table->table_length * sizeof(int));
+        }
+    }
+}
+
+void drop_compressed(Table* table) {
+    for (size_t j = 0; j < table->col_used; j++) {
+        free_compressed(table->columns[j].compressed);
+        table->columns[j].compressed = NULL;
+    }
+}
+
+const char* encoding_name(Encoding encoding) {
+    switch (encoding) {
+        case ENCODING_DICTIONARY:
+            return "dictionary";
+        case ENCODING_RLE:
+            return "rle";
+        default:
+            return "frame of reference";
+    }
+}
@@ -0,0 +1,100 @@
+/**
+ * db_delta.c
+ * The per table buffers of inserted rows and their merge into the columns.
+ **/
+#include <stdlib.h>
+#include <string.h>
+
+#include "db_compress.h"
+#include "db_delta.h"
+#include "db_index.h"
+#include "db_stats.h"
+#include "db_storage.h"
+#include "utils_func.h"
+
+// rows in the delta buffers of every table, changed by the writer only
+static size_t pending_rows = 0;
+
+size_t append_delta(Table* table, const int* values, size_t num_rows) {
+    DeltaBuffer* delta = table->delta;
+    if (delta == NULL) {
+        delta = malloc(sizeof(DeltaBuffer));
+        delta->blocks = malloc(table->col_count * DELTA_ROWS * sizeof(int));
+        delta->num_rows = 0;
+        table->delta = delta;
+    }
+    size_t appended = DELTA_ROWS - delta->num_rows;
+    if (appended > num_rows) {
+        appended = num_rows;
+    }
+    for (size_t j = 0; j < table->col_count; j++) {
+        int* block = delta->blocks + j * DELTA_ROWS + delta->num_rows;
+        for (size_t i = 0; i < appended; i++) {
+            block[i] = values[i * table->col_count + j];
+        }
+    }
+    delta->num_rows += appended;
+    pending_rows += appended;
+    return appended;
+}
+
+bool delta_full(const Table* table) {
+    return table->delta != NULL && table->delta->num_rows == DELTA_ROWS;
+}
+
+Status merge_delta(Table* table) {
+    Status ret_status;
+    ret_status.code = OK;
+    DeltaBuffer* delta = table->delta;
+    if (delta == NULL || delta->num_rows == 0) {
+        return ret_status;
+    }
+    size_t old_length = table->table_length;
+    for (size_t j = 0; j < table->col_used; j++) {
+        Column* column = &table->columns[j];
+        if (reserve_column(column, old_length + delta->num_rows) != 0) {
+            ret_status.code = ERROR;
+            ret_status.error_message = "cannot grow column";
+            return ret_status;
+        }
+        memcpy(column->data + old_length, delta->blocks + j * DELTA_ROWS, delta->num_rows * sizeof(int));
+        column->dirty = true;
+    }
+    table->table_length += delta->num_rows;
+    pending_rows -= delta->num_rows;
+    delta->num_rows = 0;
+    update_stats(table, old_length);
+    // the encoded prefix stays valid unless clustering moves rows
+    if (table->pricls_col[0] != '\0') {
+        drop_compressed(table);
+    }
+    ret_status = update_indexes(table, old_length);
+    log_info("merged %zu inserted rows into %s\n", table->table_length - old_length, table->name);
+    return ret_status;
+}
+
+Status merge_deltas(Db* db) {
+    Status ret_status;
+    ret_status.code = OK;
+    for (size_t i = 0; i < db->tables_size; i++) {
+        Status merged = merge_delta(db->tables[i]);
+        if (merged.code != OK) {
+            ret_status = merged;
+        }
+    }
+    return ret_status;
+}
+
+bool deltas_pending(void) {
+    return pending_rows > 0;
+}
+
+void free_delta(Table* table) {
+    if (table->delta == NULL) {
+        return;
+    }
+    pending_rows -= table->delta->num_rows;
+    free(table->delta->blocks);
+    free(table->delta);
+    table->delta = NULL;
+}
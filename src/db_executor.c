@@ -0,0 +1,485 @@
+/**
+ * db_executor.c
+ * Executes parsed DbOperators against the current database and the
+ * context of the client that sent them.
+ **/
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "client_context.h"
+#include "db_aggregate.h"
+#include "db_executor.h"
+#include "db_index.h"
+#include "db_join.h"
+#include "db_loader.h"
+#include "db_manager.h"
+#include "db_pipeline.h"
+#include "db_select.h"
+#include "db_stats.h"
+#include "result_stream.h"
+#include "shared_scan.h"
+#include "utils_func.h"
+
+// longest text of a single printed value, e.g. "-9223372036854775808,"
+#define MAX_VALUE_TEXT 32
+
+atomic_bool server_shutdown = false;
+
+static pthread_rwlock_t db_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+void lock_db(bool exclusive) {
+    if (exclusive) {
+        pthread_rwlock_wrlock(&db_lock);
+    } else {
+        pthread_rwlock_rdlock(&db_lock);
+    }
+}
+
+void unlock_db(void) {
+    pthread_rwlock_unlock(&db_lock);
+}
+
+char* exec_create_db(DbOperator* query) {
+    char* db_name = query->operator_fields.create_db_operator.db_name;
+    current_db = create_db(db_name);
+    free(db_name);
+    return "";
+}
+
+char* exec_create_tbl(DbOperator* query) {
+    CreateTblOperator* op = &query->operator_fields.create_tbl_operator;
+    Status ret_status;
+    create_table(current_db, op->tbl_name, op->col_count, &ret_status);
+    free(op->tbl_name);
+    if (ret_status.code != OK) {
+        log_err("create table failed: %s\n", ret_status.error_message);
+        return ret_status.error_message;
+    }
+    return "";
+}
+
+char* exec_create_col(DbOperator* query) {
+    CreateColOperator* op = &query->operator_fields.create_col_operator;
+    Status ret_status;
+    create_column(op->table, op->col_name, &ret_status);
+    free(op->col_name);
+    if (ret_status.code != OK) {
+        log_err("create column failed: %s\n", ret_status.error_message);
+        return ret_status.error_message;
+    }
+    return "";
+}
+
+char* exec_create_idx(DbOperator* query) {
+    CreateIdxOperator* op = &query->operator_fields.create_idx_operator;
+    Status ret_status = create_index(op->table, op->column, op->type, op->clustered);
+    if (ret_status.code != OK) {
+        log_err("create index failed: %s\n", ret_status.error_message);
+        return ret_status.error_message;
+    }
+    return "";
+}
+
+char* exec_insert(DbOperator* query) {
+    InsertOperator* op = &query->operator_fields.insert_operator;
+    Status ret_status = relational_insert(op->table, op->values, op->num_rows);
+    arena_free(op->values);
+    if (ret_status.code != OK) {
+        return ret_status.error_message;
+    }
+    return "";
+}
+
+char* exec_load(DbOperator* query) {
+    char* file_name = query->operator_fields.load_operator.file_name;
+    Status ret_status = load_csv(file_name);
+    free(file_name);
+    if (ret_status.code != OK) {
+        log_err("load failed: %s\n", ret_status.error_message);
+        return ret_status.error_message;
+    }
+    return "";
+}
+
+/**
+ * exec_select picks the access path of a select on a base column from the
+ * column statistics and logs its estimated and actual cardinality. A scan
+ * is deferred until its positions are used, so that a fetch and an
+ * aggregate over them can run fused with it.
+ **/
+char* exec_select(DbOperator* query) {
+    SelectOperator* op = &query->operator_fields.select_operator;
+    Result* result;
+    if (op->positions == NULL) {
+        Column* column = op->column.column_pointer.column;
+        size_t estimate;
+        SelectPlan plan = choose_select_plan(op->table, column, &op->comparator, &estimate);
+        if (plan != PLAN_SCAN) {
+            result = index_select(op->table, column, &op->comparator);
+            log_info("select on %s.%s: %s, estimated %zu of %zu rows, actual %zu\n", op->table->name,
+                     column->name, select_plan_name(plan), estimate, op->table->table_length, result->num_tuples);
+        } else {
+            result = defer_select(op->table, column, &op->comparator, estimate);
+            log_info("select on %s.%s: deferred scan, estimated %zu of %zu rows\n", op->table->name,
+                     column->name, estimate, op->table->table_length);
+        }
+    } else {
+        materialize(op->column.column_pointer.result);
+        materialize(op->positions);
+        Status checked = check_select_inputs(op->column.column_pointer.result, op->positions);
+        if (checked.code != OK) {
+            return checked.error_message;
+        }
+        result = select_positions(op->column.column_pointer.result, op->positions, &op->comparator);
+    }
+    bool stored = store_result(query->context, op->comparator.handle, result);
+    return stored ? "" : MEMORY_LIMIT_MESSAGE;
+}
+
+char* exec_fetch(DbOperator* query) {
+    FetchOperator* op = &query->operator_fields.fetch_operator;
+    // deferred positions give deferred values, deferred values used as
+    // positions are computed first
+    if (op->positions->deferred != NULL && op->positions->deferred->fetch_column != NULL) {
+        materialize(op->positions);
+    }
+    Status checked = check_positions(op->table, op->positions);
+    if (checked.code != OK) {
+        return checked.error_message;
+    }
+    Result* result = op->positions->deferred != NULL ? defer_fetch(op->column, op->positions)
+                                                     : fetch(op->table, op->column, op->positions);
+    bool stored = store_result(query->context, op->handle, result);
+    return stored ? "" : MEMORY_LIMIT_MESSAGE;
+}
+
+/**
+ * exec_aggregate computes an aggregate over a result, over deferred values
+ * fused with their select and fetch, or over a base column from its zone
+ * map
+ **/
+char* exec_aggregate(DbOperator* query) {
+    AggregateOperator* op = &query->operator_fields.aggregate_operator;
+    Result* result;
+    // deferred values are aggregated in one fused pass, deferred positions
+    // are computed first
+    if (op->input.column_type == RESULT && op->input.column_pointer.result->deferred != NULL &&
+        op->input.column_pointer.result->deferred->fetch_column == NULL) {
+        materialize(op->input.column_pointer.result);
+    }
+    if (op->input.column_type == COLUMN) {
+        result = aggregate_column(op->type, op->table, op->input.column_pointer.column);
+    } else if (op->input.column_pointer.result->deferred != NULL) {
+        result = pipeline_aggregate(op->type, op->input.column_pointer.result);
+    } else {
+        // a range or a bitmap of positions is aggregated as an array
+        position_array(op->input.column_pointer.result);
+        result = aggregate_result(op->type, op->input.column_pointer.result);
+    }
+    bool stored = store_result(query->context, op->handle, result);
+    return stored ? "" : MEMORY_LIMIT_MESSAGE;
+}
+
+char* exec_arithmetic(DbOperator* query) {
+    ArithmeticOperator* op = &query->operator_fields.arithmetic_operator;
+    materialize(op->left);
+    materialize(op->right);
+    if (op->left->num_tuples != op->right->num_tuples) {
+        return "add and sub need results of the same length";
+    }
+    position_array(op->left);
+    position_array(op->right);
+    Result* result = combine_results(op->subtract, op->left, op->right);
+    bool stored = store_result(query->context, op->handle, result);
+    return stored ? "" : MEMORY_LIMIT_MESSAGE;
+}
+
+static size_t format_value(char* buffer, Result* result, size_t row) {
+    switch (result->data_type) {
+        case LONG:
+            return sprintf(buffer, "%ld", ((long*)result->payload)[row]);
+        case FLOAT:
+            return sprintf(buffer, "%.2f", ((double*)result->payload)[row]);
+        default:
+            return sprintf(buffer, "%d", ((int*)result->payload)[row]);
+    }
+}
+
+/**
+ * exec_join runs the join algorithm chosen by the query and stores the
+ * matching positions of both sides
+ **/
+char* exec_join(DbOperator* query) {
+    JoinOperator* op = &query->operator_fields.join_operator;
+    Result* out1 = NULL;
+    Result* out2 = NULL;
+    Status ret_status;
+    materialize(op->values1);
+    materialize(op->positions1);
+    materialize(op->values2);
+    materialize(op->positions2);
+    position_array(op->positions1);
+    position_array(op->positions2);
+    if (op->type == GRACE_HASH_JOIN) {
+        JoinStats stats;
+        ret_status = grace_hash_join(op->values1, op->positions1, op->values2, op->positions2,
+                                     op->memory_budget, &out1, &out2, &stats);
+        if (ret_status.code == OK) {
+            log_info("grace join: budget %zu bytes, %zu partitions spilled (%zu bytes), %zu level(s)\n",
+                     op->memory_budget, stats.num_partitions, stats.spilled_bytes, stats.max_depth);
+        }
+    } else if (op->type == NESTED_LOOP_JOIN) {
+        ret_status = nested_loop_join(op->values1, op->positions1, op->values2, op->positions2, &out1, &out2);
+    } else {
+        ret_status = hash_join(op->values1, op->positions1, op->values2, op->positions2, &out1, &out2);
+    }
+    if (ret_status.code == OK) {
+        out1->copy = op->positions1->copy;
+        out2->copy = op->positions2->copy;
+        out1->table = op->positions1->table;
+        out2->table = op->positions2->table;
+        out1->version = op->positions1->version;
+        out2->version = op->positions2->version;
+        // both results are stored or released, whatever the first did
+        bool stored = store_result(query->context, op->handle1, out1);
+        if (!store_result(query->context, op->handle2, out2) || !stored) {
+            ret_status.code = ERROR;
+            ret_status.error_message = MEMORY_LIMIT_MESSAGE;
+        }
+    }
+    if (ret_status.code != OK) {
+        log_err("join failed: %s\n", ret_status.error_message);
+        return ret_status.error_message;
+    }
+    return "";
+}
+
+/**
+ * the binary form of print: a frame with the type of every column, then
+ * blocks of rows copied straight from the payloads, one block per frame
+ **/
+static void print_binary(ResultStream* stream, PrintOperator* op, size_t num_rows) {
+    int* types = (int*)stream_reserve(stream, op->num_results * sizeof(int));
+    size_t row_width = 0;
+    for (size_t j = 0; j < op->num_results; j++) {
+        types[j] = op->results[j]->data_type;
+        row_width += data_type_size(op->results[j]->data_type);
+    }
+    stream_commit(stream, op->num_results * sizeof(int));
+    stream_flush(stream);
+    size_t block_rows = MAX_FRAME_SIZE / row_width;
+    for (size_t begin = 0; begin < num_rows && !stream->failed; begin += block_rows) {
+        size_t rows = num_rows - begin < block_rows ? num_rows - begin : block_rows;
+        char* out = stream_reserve(stream, rows * row_width);
+        for (size_t j = 0; j < op->num_results; j++) {
+            size_t width = data_type_size(op->results[j]->data_type);
+            memcpy(out, (char*)op->results[j]->payload + begin * width, rows * width);
+            out += rows * width;
+        }
+        stream_commit(stream, rows * row_width);
+        stream_flush(stream);
+    }
+}
+
+/**
+ * print streams the rows to the client frame by frame, so only one frame
+ * of output exists at a time whatever the size of the result
+ **/
+char* exec_print(DbOperator* query) {
+    PrintOperator* op = &query->operator_fields.print_operator;
+    ClientContext* context = query->context;
+    for (size_t j = 0; j < op->num_results; j++) {
+        materialize(op->results[j]);
+        if (op->results[j]->num_tuples != op->results[0]->num_tuples) {
+            arena_free(op->results);
+            return "print needs results of the same length";
+        }
+    }
+    size_t num_rows = op->num_results > 0 ? op->results[0]->num_tuples : 0;
+    for (size_t j = 0; j < op->num_results; j++) {
+        position_array(op->results[j]);
+    }
+    if (context->print_buffer == NULL) {
+        context->print_buffer = malloc(MAX_FRAME_SIZE);
+    }
+    ResultStream stream;
+    if (context->binary_results && op->num_results > 0) {
+        begin_stream(&stream, query->client_fd, context->print_buffer, MESSAGE_BINARY_RESULTS, context->sequence);
+        print_binary(&stream, op, num_rows);
+    } else {
+        begin_stream(&stream, query->client_fd, context->print_buffer, 0, context->sequence);
+        for (size_t i = 0; i < num_rows && !stream.failed; i++) {
+            for (size_t j = 0; j < op->num_results; j++) {
+                char* out = stream_reserve(&stream, MAX_VALUE_TEXT);
+                size_t length = format_value(out, op->results[j], i);
+                out[length++] = j + 1 < op->num_results ? ',' : '\n';
+                stream_commit(&stream, length);
+            }
+        }
+    }
+    end_stream(&stream);
+    arena_free(op->results);
+    return NULL;
+}
+
+char* exec_batch_queries(DbOperator* query) {
+    query->context->batching = true;
+    return "";
+}
+
+static bool plans_scan(SelectOperator* op) {
+    size_t estimate;
+    return choose_select_plan(op->table, op->column.column_pointer.column, &op->comparator, &estimate) == PLAN_SCAN;
+}
+
+/**
+ * exec_batch_execute runs the queued selects: selects over the same column
+ * share one scan, the others run on their own
+ **/
+char* exec_batch_execute(DbOperator* query) {
+    ClientContext* context = query->context;
+    int batch_size = context->batch_size;
+    DbOperator** batch = context->batch;
+    Comparator** comparators = malloc(sizeof(Comparator*) * (batch_size > 0 ? batch_size : 1));
+    Result** results = malloc(sizeof(Result*) * (batch_size > 0 ? batch_size : 1));
+    int* members = malloc(sizeof(int) * (batch_size > 0 ? batch_size : 1));
+    bool* done = calloc(batch_size > 0 ? batch_size : 1, sizeof(bool));
+    size_t passes = 0;
+    // the error of a select of the batch, if any
+    char* message = "";
+
+    context->batching = false;
+    for (int i = 0; i < batch_size; i++) {
+        if (done[i]) {
+            continue;
+        }
+        SelectOperator* op = &batch[i]->operator_fields.select_operator;
+        // selects an index answers better than a scan run on their own
+        if (op->positions != NULL || !plans_scan(op)) {
+            char* executed = execute_DbOperator(batch[i]);
+            if (executed != NULL && executed[0] != '\0') {
+                message = executed;
+            }
+            done[i] = true;
+            continue;
+        }
+        // gather every pending select over the same column
+        Column* column = op->column.column_pointer.column;
+        size_t num_queries = 0;
+        for (int j = i; j < batch_size; j++) {
+            SelectOperator* other = &batch[j]->operator_fields.select_operator;
+            if (!done[j] && other->positions == NULL && other->column.column_pointer.column == column &&
+                plans_scan(other)) {
+                comparators[num_queries] = &other->comparator;
+                members[num_queries++] = j;
+            }
+        }
+        // a select with no other on its column is deferred like outside a batch
+        if (num_queries == 1) {
+            char* executed = execute_DbOperator(batch[i]);
+            if (executed != NULL && executed[0] != '\0') {
+                message = executed;
+            }
+            done[i] = true;
+            continue;
+        }
+        passes += shared_scan(column, op->table->table_length, comparators, results, num_queries);
+        for (size_t q = 0; q < num_queries; q++) {
+            DbOperator* member = batch[members[q]];
+            results[q]->table = op->table;
+            results[q]->version = op->table->version;
+            if (!store_result(context, comparators[q]->handle, results[q])) {
+                message = MEMORY_LIMIT_MESSAGE;
+            }
+            arena_free(member);
+            done[members[q]] = true;
+        }
+    }
+    log_info("batch of %d queries executed in %zu passes\n", batch_size, passes);
+    context->batch_size = 0;
+    free(comparators);
+    free(results);
+    free(members);
+    free(done);
+    return message;
+}
+
+/**
+ * exec_shutdown only flags the shutdown, the server persists the database
+ * once the queries of the other clients have drained
+ **/
+char* exec_shutdown(void) {
+    atomic_store(&server_shutdown, true);
+    return "";
+}
+
+/** execute_DbOperator takes as input the DbOperator and executes the query.
+ **/
+char* execute_DbOperator(DbOperator* query) {
+    char* result;
+    if (query == NULL) {
+        return "";
+    }
+    // selects are queued while a batch is open
+    if (query->type == SELECT && query->context->batching) {
+        batch_query(query->context, query);
+        return "";
+    }
+    switch (query->type) {
+        case CREATE_DB:
+            result = exec_create_db(query);
+            break;
+        case CREATE_TBL:
+            result = exec_create_tbl(query);
+            break;
+        case CREATE_COL:
+            result = exec_create_col(query);
+            break;
+        case CREATE_IDX:
+            result = exec_create_idx(query);
+            break;
+        case INSERT:
+            result = exec_insert(query);
+            break;
+        case LOAD:
+            result = exec_load(query);
+            break;
+        case SELECT:
+            result = exec_select(query);
+            break;
+        case FETCH:
+            result = exec_fetch(query);
+            break;
+        case JOIN:
+            result = exec_join(query);
+            break;
+        case AGGREGATE:
+            result = exec_aggregate(query);
+            break;
+        case ARITHMETIC:
+            result = exec_arithmetic(query);
+            break;
+        case PRINT:
+            result = exec_print(query);
+            break;
+        case BATCH_QUERIES:
+            result = exec_batch_queries(query);
+            break;
+        case BATCH_EXECUTE:
+            result = exec_batch_execute(query);
+            break;
+        case SHUTDOWN:
+            result = exec_shutdown();
+            break;
+        default:
+            log_info("unsupported command, try again.\n");
+            result = "unsupported command, try again.\n";
+            break;
+    }
+    arena_free(query);
+    return result;
+}
@@ -0,0 +1,651 @@
+/**
+ * db_index.c
+ * Column indexes: cache-line B+-trees, sorted columns and clustering of
+ * tables.
+ **/
+#define _DEFAULT_SOURCE
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "arena.h"
+#include "db_compress.h"
+#include "db_index.h"
+#include "db_manager.h"
+#include "db_pipeline.h"
+#include "db_select.h"
+#include "db_sort.h"
+#include "db_storage.h"
+#include "db_zonemap.h"
+#include "utils_func.h"
+
+/**
+ * number of keys of a node smaller than key, i.e. the child to descend to
+ **/
+static inline size_t node_count_less(const int* node, int key) {
+#ifdef __SSE2__
+    __m128i k = _mm_set1_epi32(key);
+    const __m128i* keys = (const __m128i*)node;
+    __m128i lt0 = _mm_cmpgt_epi32(k, _mm_load_si128(keys));
+    __m128i lt1 = _mm_cmpgt_epi32(k, _mm_load_si128(keys + 1));
+    __m128i lt2 = _mm_cmpgt_epi32(k, _mm_load_si128(keys + 2));
+    __m128i lt3 = _mm_cmpgt_epi32(k, _mm_load_si128(keys + 3));
+    __m128i lt = _mm_packs_epi16(_mm_packs_epi32(lt0, lt1), _mm_packs_epi32(lt2, lt3));
+    return __builtin_popcount(_mm_movemask_epi8(lt));
+#else
+    size_t count = 0;
+    for (size_t i = 0; i < BTREE_NODE_KEYS; i++) {
+        count += node[i] < key;
+    }
+    return count;
+#endif
+}
+
+/**
+ * number of keys of a node smaller than or equal to key, key < INT_MAX
+ **/
+static inline size_t node_count_less_equal(const int* node, int key) {
+    return node_count_less(node, key + 1);
+}
+
+/**
+ * binary search of the first key >= key (> key if upper) in sorted keys
+ **/
+static size_t sorted_search(const int* keys, size_t length, int key, bool upper) {
+    size_t low = 0;
+    size_t high = length;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (upper ? keys[mid] <= key : keys[mid] < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+BTree* btree_bulk_load(const int* keys, int* positions, size_t length) {
+    BTree* tree = calloc(1, sizeof(BTree));
+    tree->keys = keys;
+    tree->positions = positions;
+    tree->length = length;
+    size_t num_children = (length + BTREE_LEAF_SIZE - 1) / BTREE_LEAF_SIZE;
+    // smallest key under every child of the level being built
+    int* mins = malloc((num_children > 0 ? num_children : 1) * sizeof(int));
+    for (size_t c = 0; c < num_children; c++) {
+        mins[c] = keys[c * BTREE_LEAF_SIZE];
+    }
+    // build bottom-up, then store the levels root first
+    int* levels[BTREE_MAX_LEVELS];
+    size_t num_levels = 0;
+    while (num_children > 1 && num_levels < BTREE_MAX_LEVELS) {
+        size_t num_nodes = (num_children + BTREE_NODE_KEYS - 1) / BTREE_NODE_KEYS;
+        int* level;
+        if (posix_memalign((void**)&level, 64, num_nodes * BTREE_NODE_KEYS * sizeof(int)) != 0) {
+            break;
+        }
+        for (size_t n = 0; n < num_nodes; n++) {
+            int* node = level + n * BTREE_NODE_KEYS;
+            for (size_t c = 1; c <= BTREE_NODE_KEYS; c++) {
+                size_t child = n * BTREE_NODE_KEYS + c;
+                node[c - 1] = c < BTREE_NODE_KEYS && child < num_children ? mins[child] : INT_MAX;
+            }
+            mins[n] = mins[n * BTREE_NODE_KEYS];
+        }
+        levels[num_levels++] = level;
+        num_children = num_nodes;
+    }
+    tree->num_levels = num_levels;
+    for (size_t l = 0; l < num_levels; l++) {
+        tree->levels[l] = levels[num_levels - 1 - l];
+    }
+    free(mins);
+    return tree;
+}
+
+BTree* sorted_run(const int* keys, int* positions, size_t length) {
+    BTree* tree = calloc(1, sizeof(BTree));
+    tree->keys = keys;
+    tree->positions = positions;
+    tree->length = length;
+    return tree;
+}
+
+/**
+ * descend to the leaf holding the bound of key and search the leaf,
+ * upper selects the first key > key instead of the first key >= key.
+ * Without inner levels the whole array is searched.
+ **/
+static size_t btree_search(const BTree* tree, int key, bool upper) {
+    if (tree->num_levels == 0) {
+        return sorted_search(tree->keys, tree->length, key, upper);
+    }
+    size_t child = 0;
+    for (size_t l = 0; l < tree->num_levels; l++) {
+        const int* node = tree->levels[l] + child * BTREE_NODE_KEYS;
+        child = child * BTREE_NODE_KEYS + (upper ? node_count_less_equal(node, key) : node_count_less(node, key));
+    }
+    size_t low = child * BTREE_LEAF_SIZE;
+    size_t high = low + BTREE_LEAF_SIZE < tree->length ? low + BTREE_LEAF_SIZE : tree->length;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (upper ? tree->keys[mid] <= key : tree->keys[mid] < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+size_t btree_lower_bound(const BTree* tree, int key) {
+    return tree->length == 0 ? 0 : btree_search(tree, key, false);
+}
+
+size_t btree_upper_bound(const BTree* tree, int key) {
+    if (tree->length == 0 || key == INT_MAX) {
+        return tree->length;
+    }
+    return btree_search(tree, key, true);
+}
+
+void free_btree(BTree* tree) {
+    if (tree == NULL) {
+        return;
+    }
+    for (size_t l = 0; l < tree->num_levels; l++) {
+        free(tree->levels[l]);
+    }
+    free(tree->owned_keys);
+    free(tree->positions);
+    free(tree);
+}
+
+static ColumnIndex* new_column_index(void) {
+    ColumnIndex* index = calloc(1, sizeof(ColumnIndex));
+    pthread_mutex_init(&index->lock, NULL);
+    return index;
+}
+
+static Column* clustered_column(Table* table) {
+    for (size_t i = 0; i < table->col_used; i++) {
+        if (table->pricls_col[0] != '\0' && strcmp(table->columns[i].name, table->pricls_col) == 0) {
+            return &table->columns[i];
+        }
+    }
+    return NULL;
+}
+
+ClusteredCopy* column_copy(Table* table, Column* column) {
+    size_t key = column - table->columns;
+    for (ClusteredCopy* copy = table->copies; copy != NULL; copy = copy->next) {
+        if (copy->key == key) {
+            return copy;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * sort num_columns columns on columns[key]: the key column is sorted with
+ * the row numbers, the resulting permutation is then applied to the
+ * other columns
+ **/
+static void cluster_columns(Column* columns, size_t num_columns, size_t key, size_t length) {
+    Column* key_column = &columns[key];
+    int* keys = malloc((length > 0 ? length : 1) * sizeof(int));
+    int* order = malloc((length > 0 ? length : 1) * sizeof(int));
+    memcpy(keys, key_column->data, length * sizeof(int));
+    for (size_t i = 0; i < length; i++) {
+        order[i] = i;
+    }
+    sort_pairs(keys, order, length);
+    memcpy(key_column->data, keys, length * sizeof(int));
+    key_column->dirty = true;
+    Permutation* permutation = create_permutation(order, length);
+    // keys is reused as the buffer of the permutation
+    for (size_t j = 0; j < num_columns; j++) {
+        if (j != key) {
+            apply_permutation(permutation, columns[j].data, keys);
+            columns[j].dirty = true;
+        }
+    }
+    free_permutation(permutation);
+    free(keys);
+    free(order);
+}
+
+/**
+ * merge the rows [old_length, length) appended to columns clustered on
+ * columns[key] into the rows before them, which are in order. The new rows
+ * are sorted on their key and placed after the rows with the same key,
+ * every column is then merged from its end so that a row moves at most
+ * once. placed, if not NULL, receives the row the i-th new row in key
+ * order moved to. Returns the first row that moved.
+ **/
+static size_t merge_appended_rows(Column* columns, size_t num_columns, size_t key, size_t old_length,
+                                  size_t length, int* placed) {
+    size_t num_new = length - old_length;
+    if (num_new == 0) {
+        return old_length;
+    }
+    int* keys = malloc(num_new * sizeof(int));
+    int* order = malloc(num_new * sizeof(int));
+    // inserts[i] is the old row the i-th new row goes before
+    size_t* inserts = malloc(num_new * sizeof(size_t));
+    int* tail = malloc(num_new * sizeof(int));
+    memcpy(keys, columns[key].data + old_length, num_new * sizeof(int));
+    for (size_t i = 0; i < num_new; i++) {
+        order[i] = i;
+    }
+    sort_pairs(keys, order, num_new);
+    for (size_t i = 0; i < num_new; i++) {
+        inserts[i] = sorted_search(columns[key].data, old_length, keys[i], true);
+        if (placed != NULL) {
+            placed[i] = inserts[i] + i;
+        }
+    }
+    for (size_t j = 0; j < num_columns; j++) {
+        int* data = columns[j].data;
+        memcpy(tail, data + old_length, num_new * sizeof(int));
+        size_t end = old_length;
+        for (size_t i = num_new; i-- > 0;) {
+            // the old rows [inserts[i], end) move down past the i new rows before them
+            memmove(data + inserts[i] + i + 1, data + inserts[i], (end - inserts[i]) * sizeof(int));
+            data[inserts[i] + i] = tail[order[i]];
+            end = inserts[i];
+        }
+        columns[j].dirty = true;
+    }
+    size_t first_row = inserts[0];
+    free(keys);
+    free(order);
+    free(inserts);
+    free(tail);
+    return first_row;
+}
+
+/**
+ * the name the column files of a copy are stored under, <table>@<key>
+ **/
+static void copy_table_name(char* name, Table* table, size_t key) {
+    snprintf(name, COPY_NAME_SIZE, "%s@%s", table->name, table->columns[key].name);
+}
+
+static void close_copy(ClusteredCopy* copy, size_t num_columns) {
+    for (size_t j = 0; j < num_columns; j++) {
+        close_column_file(&copy->columns[j]);
+    }
+    free(copy->columns);
+    free(copy);
+}
+
+static ClusteredCopy* new_copy(Table* table, size_t key) {
+    ClusteredCopy* copy = calloc(1, sizeof(ClusteredCopy));
+    copy->key = key;
+    copy->columns = calloc(table->col_count, sizeof(Column));
+    for (size_t j = 0; j < table->col_count; j++) {
+        copy->columns[j].fd = -1;
+    }
+    return copy;
+}
+
+/**
+ * bring the rows [old_length, table_length) of the table into a copy,
+ * creating the files of the columns the copy does not have yet
+ **/
+static int append_to_copy(Table* table, ClusteredCopy* copy, size_t old_length) {
+    char copy_name[COPY_NAME_SIZE];
+    copy_table_name(copy_name, table, copy->key);
+    for (size_t j = 0; j < table->col_used; j++) {
+        Column* column = &copy->columns[j];
+        size_t first = old_length;
+        if (column->fd == -1) {
+            snprintf(column->name, MAX_SIZE_NAME, "%s", table->columns[j].name);
+            if (create_column_file(column, current_db->name, copy_name) != 0) {
+                return 1;
+            }
+            first = 0;
+        }
+        if (reserve_column(column, table->table_length) != 0) {
+            return 1;
+        }
+        memcpy(column->data + first, table->columns[j].data + first,
+               (table->table_length - first) * sizeof(int));
+        column->dirty = true;
+    }
+    return 0;
+}
+
+/**
+ * the rows of a copy are in the order of its key column, put the rows
+ * appended at old_length in place. Returns the first row that moved.
+ **/
+static size_t order_copy(Table* table, ClusteredCopy* copy, size_t old_length) {
+    if (old_length == 0) {
+        cluster_columns(copy->columns, table->col_used, copy->key, table->table_length);
+        return 0;
+    }
+    return merge_appended_rows(copy->columns, table->col_used, copy->key, old_length, table->table_length, NULL);
+}
+
+/**
+ * drop the trees of a table whose rows moved, the writer holds the
+ * database exclusively so no reader uses them
+ **/
+static void drop_trees(Table* table) {
+    for (size_t i = 0; i < table->col_used; i++) {
+        ColumnIndex* index = table->columns[i].index;
+        if (index != NULL) {
+            free_btree(index->btree);
+            index->btree = NULL;
+        }
+    }
+}
+
+Status create_index(Table* table, Column* column, IndexType type, bool clustered) {
+    Status ret_status;
+    ret_status.code = OK;
+    if (column->index_type != NO_INDEX) {
+        ret_status.code = ERROR;
+        ret_status.error_message = "index already exists";
+        return ret_status;
+    }
+    size_t key = column - table->columns;
+    if (clustered && table->pricls_col[0] != '\0') {
+        // the principal copy is taken, the table gets another copy
+        ClusteredCopy* copy = new_copy(table, key);
+        if (append_to_copy(table, copy, 0) != 0) {
+            close_copy(copy, table->col_count);
+            ret_status.code = ERROR;
+            ret_status.error_message = "cannot create clustered copy";
+            return ret_status;
+        }
+        order_copy(table, copy, 0);
+        ClusteredCopy** last = &table->copies;
+        while (*last != NULL) {
+            last = &(*last)->next;
+        }
+        *last = copy;
+    } else if (clustered) {
+        snprintf(table->pricls_col, MAX_SIZE_NAME, "%s", column->name);
+        if (table->table_length > 0) {
+            materialize_table(table);
+            cluster_columns(table->columns, table->col_used, key, table->table_length);
+            table->version++;
+            drop_trees(table);
+            update_zone_maps(table, 0);
+            compress_table(table);
+        }
+    }
+    column->index_type = type;
+    column->clustered = clustered;
+    column->index = new_column_index();
+    return ret_status;
+}
+
+void open_indexes(Table* table) {
+    Column* principal = clustered_column(table);
+    ClusteredCopy** last = &table->copies;
+    for (size_t i = 0; i < table->col_used; i++) {
+        Column* column = &table->columns[i];
+        if (column->index_type == NO_INDEX) {
+            continue;
+        }
+        column->index = new_column_index();
+        if (!column->clustered || column == principal) {
+            continue;
+        }
+        ClusteredCopy* copy = new_copy(table, i);
+        char copy_name[COPY_NAME_SIZE];
+        copy_table_name(copy_name, table, i);
+        bool restored = true;
+        for (size_t j = 0; j < table->col_used && restored; j++) {
+            snprintf(copy->columns[j].name, MAX_SIZE_NAME, "%s", table->columns[j].name);
+            restored = open_column_file(&copy->columns[j], current_db->name, copy_name, table->table_length) == 0;
+        }
+        if (!restored) {
+            // the copy is derived data, build it again from the table
+            log_info("rebuilding clustered copy %s\n", copy_name);
+            close_copy(copy, table->col_count);
+            copy = new_copy(table, i);
+            if (append_to_copy(table, copy, 0) != 0) {
+                log_err("cannot rebuild clustered copy %s\n", copy_name);
+                close_copy(copy, table->col_count);
+                continue;
+            }
+            order_copy(table, copy, 0);
+        }
+        *last = copy;
+        last = &copy->next;
+    }
+}
+
+/**
+ * the tree of an index over length sorted keys, without inner levels for
+ * a sorted index
+ **/
+static BTree* build_tree(IndexType type, const int* keys, int* positions, size_t length) {
+    return type == SORTED ? sorted_run(keys, positions, length) : btree_bulk_load(keys, positions, length);
+}
+
+/**
+ * merge the rows appended at old_length into the sorted keys and positions
+ * of the tree of an unclustered column. placed holds the rows the new rows
+ * moved to if clustering the table moved rows, see merge_appended_rows.
+ **/
+static BTree* merge_tree(Table* table, Column* column, const BTree* tree, size_t old_length, const int* placed) {
+    size_t num_new = table->table_length - old_length;
+    size_t length = table->table_length;
+    int* new_keys = malloc(num_new * sizeof(int));
+    int* new_positions = malloc(num_new * sizeof(int));
+    for (size_t i = 0; i < num_new; i++) {
+        size_t row = placed != NULL ? (size_t)placed[i] : old_length + i;
+        new_keys[i] = column->data[row];
+        new_positions[i] = row;
+    }
+    sort_pairs(new_keys, new_positions, num_new);
+    int* keys = malloc(length * sizeof(int));
+    int* positions = malloc(length * sizeof(int));
+    size_t a = 0;
+    size_t b = 0;
+    for (size_t k = 0; k < length; k++) {
+        if (b == num_new || (a < old_length && tree->keys[a] <= new_keys[b])) {
+            size_t row = tree->positions[a];
+            if (placed != NULL) {
+                // an old row moved down by the new rows placed before it,
+                // the i-th went before old row placed[i] - i
+                size_t low = 0;
+                size_t high = num_new;
+                while (low < high) {
+                    size_t mid = low + (high - low) / 2;
+                    if ((size_t)placed[mid] - mid <= row) {
+                        low = mid + 1;
+                    } else {
+                        high = mid;
+                    }
+                }
+                row += low;
+            }
+            keys[k] = tree->keys[a];
+            positions[k] = row;
+            a++;
+        } else {
+            keys[k] = new_keys[b];
+            positions[k] = new_positions[b];
+            b++;
+        }
+    }
+    free(new_keys);
+    free(new_positions);
+    BTree* merged = build_tree(column->index_type, keys, positions, length);
+    merged->owned_keys = keys;
+    return merged;
+}
+
+/**
+ * bring the trees built on a table up to date with the rows appended at
+ * old_length. The leaves of a clustered column are the column, only its
+ * inner levels are built again; the sorted keys of an unclustered column
+ * are merged with the new ones. The writer holds the database exclusively
+ * so no reader uses the trees.
+ **/
+static void update_trees(Table* table, size_t old_length, const int* placed) {
+    for (size_t i = 0; i < table->col_used; i++) {
+        Column* column = &table->columns[i];
+        ColumnIndex* index = column->index;
+        if (index == NULL || index->btree == NULL) {
+            continue;
+        }
+        BTree* tree = index->btree;
+        if (column->clustered) {
+            ClusteredCopy* copy = column_copy(table, column);
+            const int* keys = copy != NULL ? copy->columns[copy->key].data : column->data;
+            index->btree = build_tree(column->index_type, keys, NULL, table->table_length);
+        } else if (tree->length == old_length) {
+            index->btree = merge_tree(table, column, tree, old_length, placed);
+        } else {
+            // rebuilt by the next query using it
+            index->btree = NULL;
+        }
+        free_btree(tree);
+    }
+}
+
+Status update_indexes(Table* table, size_t old_length) {
+    Status ret_status;
+    ret_status.code = OK;
+    if (table->table_length == old_length) {
+        return ret_status;
+    }
+    // set once rows that positions may refer to moved
+    bool moved = false;
+    // the copies take the new rows before the principal copy moves them
+    for (ClusteredCopy* copy = table->copies; copy != NULL; copy = copy->next) {
+        if (append_to_copy(table, copy, old_length) != 0) {
+            ret_status.code = ERROR;
+            ret_status.error_message = "cannot grow clustered copy";
+            continue;
+        }
+        moved |= order_copy(table, copy, old_length) < old_length;
+    }
+    Column* key_column = clustered_column(table);
+    // the first row whose values changed
+    size_t first_row = old_length;
+    int* placed = NULL;
+    if (key_column != NULL) {
+        // deferred results read the rows where they were
+        materialize_table(table);
+        placed = malloc((table->table_length - old_length) * sizeof(int));
+        first_row = merge_appended_rows(table->columns, table->col_used, key_column - table->columns,
+                                        old_length, table->table_length, placed);
+        moved |= first_row < old_length;
+    }
+    // the positions held by clients are stale, they are rejected when used
+    if (moved) {
+        table->version++;
+    }
+    update_trees(table, old_length, placed);
+    free(placed);
+    update_zone_maps(table, first_row);
+    return ret_status;
+}
+
+int sync_indexes(Table* table) {
+    int failed = 0;
+    for (ClusteredCopy* copy = table->copies; copy != NULL; copy = copy->next) {
+        for (size_t j = 0; j < table->col_used; j++) {
+            failed |= sync_column(&copy->columns[j], table->table_length);
+        }
+    }
+    return failed;
+}
+
+void close_indexes(Table* table) {
+    for (size_t i = 0; i < table->col_used; i++) {
+        ColumnIndex* index = table->columns[i].index;
+        if (index != NULL) {
+            free_btree(index->btree);
+            pthread_mutex_destroy(&index->lock);
+            free(index);
+            table->columns[i].index = NULL;
+        }
+    }
+    while (table->copies != NULL) {
+        ClusteredCopy* copy = table->copies;
+        table->copies = copy->next;
+        close_copy(copy, table->col_count);
+    }
+}
+
+/**
+ * the tree of an indexed column, bulk-loaded on first use. The keys of a
+ * clustered column are already sorted, the others are sorted with their
+ * positions. A sorted index is a tree without inner levels.
+ **/
+static BTree* column_btree(Table* table, Column* column) {
+    ColumnIndex* index = column->index;
+    pthread_mutex_lock(&index->lock);
+    if (index->btree == NULL) {
+        size_t length = table->table_length;
+        if (column->clustered) {
+            ClusteredCopy* copy = column_copy(table, column);
+            const int* keys = copy != NULL ? copy->columns[copy->key].data : column->data;
+            index->btree = build_tree(column->index_type, keys, NULL, length);
+        } else {
+            int* keys = malloc((length > 0 ? length : 1) * sizeof(int));
+            int* positions = malloc((length > 0 ? length : 1) * sizeof(int));
+            memcpy(keys, column->data, length * sizeof(int));
+            for (size_t i = 0; i < length; i++) {
+                positions[i] = i;
+            }
+            sort_pairs(keys, positions, length);
+            index->btree = build_tree(column->index_type, keys, positions, length);
+            index->btree->owned_keys = keys;
+        }
+    }
+    BTree* tree = index->btree;
+    pthread_mutex_unlock(&index->lock);
+    return tree;
+}
+
+Result* index_select(Table* table, Column* column, Comparator* comparator) {
+    Result* result = arena_malloc(sizeof(Result));
+    result->data_type = INT;
+    result->num_tuples = 0;
+    result->payload = NULL;
+    result->format = POSITION_ARRAY;
+    result->copy = NULL;
+    result->table = table;
+    result->version = table->version;
+    result->deferred = NULL;
+    int low;
+    int high;
+    if (!comparator_bounds(comparator, &low, &high)) {
+        return result;
+    }
+    BTree* tree = column_btree(table, column);
+    size_t begin = btree_lower_bound(tree, low);
+    size_t end = btree_upper_bound(tree, high);
+    size_t count = end > begin ? end - begin : 0;
+    result->num_tuples = count;
+    if (tree->positions == NULL) {
+        // the rows of a range of a clustered column are contiguous, in the
+        // copy sorted on the column unless it is the principal one
+        result->format = POSITION_RANGE;
+        result->first = begin;
+        result->copy = column_copy(table, column);
+        return result;
+    }
+    // the positions of a range are in key order, report them in row order
+    int* out = arena_malloc((count > 0 ? count : 1) * sizeof(int));
+    memcpy(out, tree->positions + begin, count * sizeof(int));
+    sort_pairs(out, NULL, count);
+    result->payload = out;
+    return result;
+}
@@ -0,0 +1,802 @@
+/**
+ * db_join.c
+ * Join operators over (values, positions) pairs of results.
+ **/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "db_join.h"
+#include "scan_kernels.h"
+#include "thread_pool.h"
+#include "utils_func.h"
+
+/**
+ * JoinTuple is a key with the index of its row in the join input
+ **/
+typedef struct JoinTuple {
+    int key;
+    int index;
+} JoinTuple;
+
+/**
+ * JoinMatch is a matching pair of input indexes
+ **/
+typedef struct JoinMatch {
+    int left;
+    int right;
+} JoinMatch;
+
+static inline uint32_t join_hash(int key) {
+    return (uint32_t)key * 0x9E3779B1u;
+}
+
+/**
+ * the partition of a key is given by the top bits of its hash, shift and
+ * mask select the bits of one partitioning pass
+ **/
+static inline size_t radix_of(int key, int shift, size_t mask) {
+    return mask == 0 ? 0 : (join_hash(key) >> shift) & mask;
+}
+
+/**
+ * the bucket of a key in the hash table of a partition, all keys of a
+ * partition share their top hash bits so the bucket uses another hash
+ **/
+static inline size_t bucket_of(int key, int bucket_bits) {
+    return bucket_bits == 0 ? 0 : ((uint32_t)key * 0x85EBCA6Bu) >> (32 - bucket_bits);
+}
+
+/**
+ * number of radix bits so that a partition of the build side and its hash
+ * table fit in half of L2
+ **/
+static int join_radix_bits(size_t build_length) {
+    size_t target = l2_cache_size() / 2;
+    size_t bytes = build_length * JOIN_BUILD_TUPLE_SIZE;
+    int bits = 0;
+    while (bits < 2 * JOIN_MAX_RADIX_BITS && (bytes >> bits) > target) {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * RadixPass is the first partitioning pass over a join input. Every worker
+ * counts, then scatters, its own contiguous chunk of the input, so tuples
+ * stay in input order inside a partition.
+ * histograms: fanout counters per worker, turned into write offsets
+ **/
+typedef struct RadixPass {
+    const int* values;
+    size_t length;
+    JoinTuple* out;
+    int shift;
+    size_t fanout;
+    size_t num_workers;
+    size_t* histograms;
+} RadixPass;
+
+static void count_chunk(void* arg, size_t worker) {
+    RadixPass* pass = arg;
+    size_t* histogram = pass->histograms + worker * pass->fanout;
+    size_t begin = pass->length * worker / pass->num_workers;
+    size_t end = pass->length * (worker + 1) / pass->num_workers;
+    memset(histogram, 0, pass->fanout * sizeof(size_t));
+    for (size_t i = begin; i < end; i++) {
+        histogram[radix_of(pass->values[i], pass->shift, pass->fanout - 1)]++;
+    }
+}
+
+static void scatter_chunk(void* arg, size_t worker) {
+    RadixPass* pass = arg;
+    size_t* offsets = pass->histograms + worker * pass->fanout;
+    size_t begin = pass->length * worker / pass->num_workers;
+    size_t end = pass->length * (worker + 1) / pass->num_workers;
+    for (size_t i = begin; i < end; i++) {
+        JoinTuple* tuple = &pass->out[offsets[radix_of(pass->values[i], pass->shift, pass->fanout - 1)]++];
+        tuple->key = pass->values[i];
+        tuple->index = i;
+    }
+}
+
+/**
+ * partition values on bits of their hash into out, begin receives the
+ * first tuple of every partition and the length at begin[1 << bits]
+ **/
+static void partition_values(const int* values, size_t length, int bits, JoinTuple* out,
+                             size_t* begin, size_t num_workers) {
+    RadixPass pass;
+    pass.values = values;
+    pass.length = length;
+    pass.out = out;
+    pass.shift = 32 - bits;
+    pass.fanout = (size_t)1 << bits;
+    pass.num_workers = num_workers;
+    pass.histograms = malloc(num_workers * pass.fanout * sizeof(size_t));
+    run_parallel(count_chunk, &pass, num_workers);
+    size_t offset = 0;
+    for (size_t p = 0; p < pass.fanout; p++) {
+        begin[p] = offset;
+        for (size_t w = 0; w < num_workers; w++) {
+            size_t count = pass.histograms[w * pass.fanout + p];
+            pass.histograms[w * pass.fanout + p] = offset;
+            offset += count;
+        }
+    }
+    begin[pass.fanout] = length;
+    run_parallel(scatter_chunk, &pass, num_workers);
+    free(pass.histograms);
+}
+
+/**
+ * RefinePass is the second partitioning pass: workers claim partitions of
+ * the first pass and split each on the next bits of the hash
+ **/
+typedef struct RefinePass {
+    const JoinTuple* in;
+    const size_t* in_begin;
+    size_t num_partitions;
+    size_t next_partition;
+    JoinTuple* out;
+    size_t* out_begin;
+    int shift;
+    size_t fanout;
+} RefinePass;
+
+static void refine_partitions(void* arg, size_t worker) {
+    RefinePass* pass = arg;
+    (void)worker;
+    size_t* offsets = malloc(pass->fanout * sizeof(size_t));
+    size_t p;
+    while ((p = claim_morsel(&pass->next_partition)) < pass->num_partitions) {
+        size_t begin = pass->in_begin[p];
+        size_t end = pass->in_begin[p + 1];
+        memset(offsets, 0, pass->fanout * sizeof(size_t));
+        for (size_t i = begin; i < end; i++) {
+            offsets[radix_of(pass->in[i].key, pass->shift, pass->fanout - 1)]++;
+        }
+        size_t offset = begin;
+        for (size_t q = 0; q < pass->fanout; q++) {
+            size_t count = offsets[q];
+            offsets[q] = offset;
+            pass->out_begin[p * pass->fanout + q] = offset;
+            offset += count;
+        }
+        for (size_t i = begin; i < end; i++) {
+            pass->out[offsets[radix_of(pass->in[i].key, pass->shift, pass->fanout - 1)]++] = pass->in[i];
+        }
+    }
+    free(offsets);
+}
+
+/**
+ * radix-partition a join input on bits1 + bits2 bits of the hash, in one
+ * pass if bits2 is 0 and two otherwise. begin holds 2^(bits1 + bits2) + 1
+ * partition boundaries.
+ **/
+static JoinTuple* partition_input(const int* values, size_t length, int bits1, int bits2, size_t* begin) {
+    size_t num_workers = parallel_workers(length, PARALLEL_JOIN_THRESHOLD);
+    JoinTuple* tuples = malloc((length > 0 ? length : 1) * sizeof(JoinTuple));
+    if (bits2 == 0) {
+        partition_values(values, length, bits1, tuples, begin, num_workers);
+        return tuples;
+    }
+    size_t fanout1 = (size_t)1 << bits1;
+    size_t* first_begin = malloc((fanout1 + 1) * sizeof(size_t));
+    partition_values(values, length, bits1, tuples, first_begin, num_workers);
+
+    RefinePass pass;
+    pass.in = tuples;
+    pass.in_begin = first_begin;
+    pass.num_partitions = fanout1;
+    pass.next_partition = 0;
+    pass.out = malloc((length > 0 ? length : 1) * sizeof(JoinTuple));
+    pass.out_begin = begin;
+    pass.shift = 32 - bits1 - bits2;
+    pass.fanout = (size_t)1 << bits2;
+    run_parallel(refine_partitions, &pass, num_workers);
+    begin[fanout1 << bits2] = length;
+    free(first_begin);
+    free(tuples);
+    return pass.out;
+}
+
+/**
+ * PartitionedJoin is the state of the build and probe phase. Workers claim
+ * partitions, build a hash table over the right partition and probe it
+ * with the left one, appending the matches to a private buffer.
+ * match_count: number of matches of every left tuple
+ **/
+typedef struct PartitionedJoin {
+    const JoinTuple* left;
+    const size_t* left_begin;
+    const JoinTuple* right;
+    const size_t* right_begin;
+    size_t num_partitions;
+    size_t next_partition;
+    size_t max_build;
+    size_t* match_count;
+    JoinMatch** matches;
+    size_t* num_matches;
+    const int* positions1;
+    const int* positions2;
+    int* out1;
+    int* out2;
+} PartitionedJoin;
+
+static void join_partitions(void* arg, size_t worker) {
+    PartitionedJoin* join = arg;
+    size_t max_buckets = 1;
+    while (max_buckets < join->max_build) {
+        max_buckets <<= 1;
+    }
+    uint32_t* heads = malloc(max_buckets * sizeof(uint32_t));
+    uint32_t* next = malloc((join->max_build > 0 ? join->max_build : 1) * sizeof(uint32_t));
+    JoinMatch* matches = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t p;
+    while ((p = claim_morsel(&join->next_partition)) < join->num_partitions) {
+        const JoinTuple* build = join->right + join->right_begin[p];
+        size_t build_length = join->right_begin[p + 1] - join->right_begin[p];
+        const JoinTuple* probe = join->left + join->left_begin[p];
+        size_t probe_length = join->left_begin[p + 1] - join->left_begin[p];
+        if (build_length == 0 || probe_length == 0) {
+            continue;
+        }
+        int bucket_bits = 0;
+        while (((size_t)1 << bucket_bits) < build_length) {
+            bucket_bits++;
+        }
+        memset(heads, 0, ((size_t)1 << bucket_bits) * sizeof(uint32_t));
+        // insert backwards so that every chain lists its tuples in input order,
+        // chain links are indexes + 1 and 0 ends a chain
+        for (size_t i = build_length; i-- > 0;) {
+            size_t bucket = bucket_of(build[i].key, bucket_bits);
+            next[i] = heads[bucket];
+            heads[bucket] = i + 1;
+        }
+        for (size_t i = 0; i < probe_length; i++) {
+            int key = probe[i].key;
+            size_t found = 0;
+            for (uint32_t j = heads[bucket_of(key, bucket_bits)]; j != 0; j = next[j - 1]) {
+                if (build[j - 1].key != key) {
+                    continue;
+                }
+                if (count == capacity) {
+                    capacity = capacity == 0 ? 1024 : capacity * 2;
+                    matches = realloc(matches, capacity * sizeof(JoinMatch));
+                }
+                matches[count].left = probe[i].index;
+                matches[count].right = build[j - 1].index;
+                count++;
+                found++;
+            }
+            join->match_count[probe[i].index] = found;
+        }
+    }
+    join->matches[worker] = matches;
+    join->num_matches[worker] = count;
+    free(heads);
+    free(next);
+}
+
+/**
+ * every worker writes its matches to the output slots of their left tuples,
+ * a left tuple is only ever matched by one worker
+ **/
+static void scatter_matches(void* arg, size_t worker) {
+    PartitionedJoin* join = arg;
+    const JoinMatch* matches = join->matches[worker];
+    for (size_t k = 0; k < join->num_matches[worker]; k++) {
+        size_t slot = join->match_count[matches[k].left]++;
+        join->out1[slot] = join->positions1[matches[k].left];
+        join->out2[slot] = join->positions2[matches[k].right];
+    }
+}
+
+static Result* create_positions(int* payload, size_t length) {
+    Result* result = arena_malloc(sizeof(Result));
+    result->data_type = INT;
+    result->num_tuples = length;
+    result->payload = payload;
+    result->format = POSITION_ARRAY;
+    result->copy = NULL;
+    result->table = NULL;
+    result->version = 0;
+    result->deferred = NULL;
+    return result;
+}
+
+static Status check_join_inputs(Result* values1, Result* positions1, Result* values2, Result* positions2) {
+    Status ret_status;
+    ret_status.code = OK;
+    if (values1->data_type != INT || values2->data_type != INT ||
+        values1->num_tuples != positions1->num_tuples || values2->num_tuples != positions2->num_tuples) {
+        ret_status.code = ERROR;
+        ret_status.error_message = "join inputs must be int values with their positions";
+    }
+    return ret_status;
+}
+
+Status hash_join(Result* values1, Result* positions1, Result* values2, Result* positions2,
+                 Result** out1, Result** out2) {
+    Status ret_status = check_join_inputs(values1, positions1, values2, positions2);
+    if (ret_status.code != OK) {
+        return ret_status;
+    }
+    size_t length1 = values1->num_tuples;
+    size_t length2 = values2->num_tuples;
+
+    int bits = join_radix_bits(length2);
+    int bits1 = bits <= JOIN_MAX_RADIX_BITS ? bits : (bits + 1) / 2;
+    int bits2 = bits - bits1;
+    size_t num_partitions = (size_t)1 << bits;
+
+    PartitionedJoin join;
+    size_t* left_begin = malloc((num_partitions + 1) * sizeof(size_t));
+    size_t* right_begin = malloc((num_partitions + 1) * sizeof(size_t));
+    JoinTuple* left = partition_input(values1->payload, length1, bits1, bits2, left_begin);
+    JoinTuple* right = partition_input(values2->payload, length2, bits1, bits2, right_begin);
+    join.left = left;
+    join.left_begin = left_begin;
+    join.right = right;
+    join.right_begin = right_begin;
+    join.num_partitions = num_partitions;
+    join.next_partition = 0;
+    join.max_build = 0;
+    for (size_t p = 0; p < num_partitions; p++) {
+        size_t build_length = right_begin[p + 1] - right_begin[p];
+        join.max_build = build_length > join.max_build ? build_length : join.max_build;
+    }
+    size_t num_workers = parallel_workers(length1 + length2, PARALLEL_JOIN_THRESHOLD);
+    join.match_count = calloc(length1 > 0 ? length1 : 1, sizeof(size_t));
+    join.matches = calloc(num_workers, sizeof(JoinMatch*));
+    join.num_matches = calloc(num_workers, sizeof(size_t));
+    run_parallel(join_partitions, &join, num_workers);
+
+    // the matches of every left tuple go after those of the previous ones
+    size_t total = 0;
+    for (size_t i = 0; i < length1; i++) {
+        size_t count = join.match_count[i];
+        join.match_count[i] = total;
+        total += count;
+    }
+    join.positions1 = positions1->payload;
+    join.positions2 = positions2->payload;
+    join.out1 = arena_malloc((total > 0 ? total : 1) * sizeof(int));
+    join.out2 = arena_malloc((total > 0 ? total : 1) * sizeof(int));
+    run_parallel(scatter_matches, &join, num_workers);
+    *out1 = create_positions(join.out1, total);
+    *out2 = create_positions(join.out2, total);
+
+    log_info("hash join: %zu x %zu tuples, %zu partitions in %d pass(es), %zu matches\n",
+             length1, length2, num_partitions, bits2 > 0 ? 2 : 1, total);
+    for (size_t w = 0; w < num_workers; w++) {
+        free(join.matches[w]);
+    }
+    free(join.matches);
+    free(join.num_matches);
+    free(join.match_count);
+    free(left);
+    free(right);
+    free(left_begin);
+    free(right_begin);
+    return ret_status;
+}
+
+/**
+ * NestedLoopJoin is the state of a block nested-loop join. Workers claim
+ * outer tiles and append their matches, ordered, to a private buffer; the
+ * block_* arrays remember where the matches of every tile went so that
+ * the buffers can be copied out in outer order.
+ **/
+typedef struct NestedLoopJoin {
+    const int* values1;
+    size_t length1;
+    const int* values2;
+    size_t length2;
+    size_t num_blocks;
+    size_t next_block;
+    size_t* block_worker;
+    size_t* block_offset;
+    size_t* block_count;
+    size_t* block_dest;
+    JoinMatch** buffers;
+    size_t* buffer_count;
+    size_t* buffer_capacity;
+    const int* positions1;
+    const int* positions2;
+    int* out1;
+    int* out2;
+} NestedLoopJoin;
+
+static void reserve_matches(JoinMatch** matches, size_t* capacity, size_t needed) {
+    if (needed <= *capacity) {
+        return;
+    }
+    size_t new_capacity = *capacity == 0 ? 1024 : *capacity;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    *matches = realloc(*matches, new_capacity * sizeof(JoinMatch));
+    *capacity = new_capacity;
+}
+
+static void nested_loop_blocks(void* arg, size_t worker) {
+    NestedLoopJoin* join = arg;
+    int* hits = malloc(NESTED_LOOP_INNER_TILE * sizeof(int));
+    JoinMatch* scratch = NULL;
+    size_t scratch_capacity = 0;
+    size_t counts[NESTED_LOOP_OUTER_TILE + 1];
+    size_t b;
+    while ((b = claim_morsel(&join->next_block)) < join->num_blocks) {
+        size_t begin = b * NESTED_LOOP_OUTER_TILE;
+        size_t end = begin + NESTED_LOOP_OUTER_TILE < join->length1 ? begin + NESTED_LOOP_OUTER_TILE : join->length1;
+        size_t num_scratch = 0;
+        for (size_t tile = 0; tile < join->length2; tile += NESTED_LOOP_INNER_TILE) {
+            size_t tile_end = tile + NESTED_LOOP_INNER_TILE < join->length2 ? tile + NESTED_LOOP_INNER_TILE : join->length2;
+            for (size_t i = begin; i < end; i++) {
+                ScanPredicate equal = { SCAN_RANGE, join->values1[i], join->values1[i] };
+                size_t found = scan_positions(join->values2, NULL, tile, tile_end, &equal, hits);
+                reserve_matches(&scratch, &scratch_capacity, num_scratch + found);
+                for (size_t k = 0; k < found; k++) {
+                    scratch[num_scratch].left = i;
+                    scratch[num_scratch].right = hits[k];
+                    num_scratch++;
+                }
+            }
+        }
+        // the matches come tile by tile, group them by outer row (a stable
+        // counting sort keeps the inner order within a row)
+        memset(counts, 0, sizeof(counts));
+        for (size_t k = 0; k < num_scratch; k++) {
+            counts[scratch[k].left - begin + 1]++;
+        }
+        for (size_t i = 1; i <= end - begin; i++) {
+            counts[i] += counts[i - 1];
+        }
+        reserve_matches(&join->buffers[worker], &join->buffer_capacity[worker],
+                        join->buffer_count[worker] + num_scratch);
+        JoinMatch* out = join->buffers[worker] + join->buffer_count[worker];
+        for (size_t k = 0; k < num_scratch; k++) {
+            out[counts[scratch[k].left - begin]++] = scratch[k];
+        }
+        join->block_worker[b] = worker;
+        join->block_offset[b] = join->buffer_count[worker];
+        join->block_count[b] = num_scratch;
+        join->buffer_count[worker] += num_scratch;
+    }
+    free(scratch);
+    free(hits);
+}
+
+static void copy_blocks(void* arg, size_t worker) {
+    NestedLoopJoin* join = arg;
+    (void)worker;
+    size_t b;
+    while ((b = claim_morsel(&join->next_block)) < join->num_blocks) {
+        const JoinMatch* matches = join->buffers[join->block_worker[b]] + join->block_offset[b];
+        size_t dest = join->block_dest[b];
+        for (size_t k = 0; k < join->block_count[b]; k++) {
+            join->out1[dest + k] = join->positions1[matches[k].left];
+            join->out2[dest + k] = join->positions2[matches[k].right];
+        }
+    }
+}
+
+Status nested_loop_join(Result* values1, Result* positions1, Result* values2, Result* positions2,
+                        Result** out1, Result** out2) {
+    Status ret_status = check_join_inputs(values1, positions1, values2, positions2);
+    if (ret_status.code != OK) {
+        return ret_status;
+    }
+    NestedLoopJoin join;
+    join.values1 = values1->payload;
+    join.length1 = values1->num_tuples;
+    join.values2 = values2->payload;
+    join.length2 = values2->num_tuples;
+    join.num_blocks = (join.length1 + NESTED_LOOP_OUTER_TILE - 1) / NESTED_LOOP_OUTER_TILE;
+    join.next_block = 0;
+    size_t num_workers = 1;
+    if (join.num_blocks > 1 && (double)join.length1 * join.length2 >= PARALLEL_NESTED_LOOP_THRESHOLD) {
+        num_workers = parallel_workers(join.num_blocks, 0);
+    }
+    size_t num_blocks = join.num_blocks > 0 ? join.num_blocks : 1;
+    join.block_worker = malloc(num_blocks * sizeof(size_t));
+    join.block_offset = malloc(num_blocks * sizeof(size_t));
+    join.block_count = malloc(num_blocks * sizeof(size_t));
+    join.block_dest = malloc(num_blocks * sizeof(size_t));
+    join.buffers = calloc(num_workers, sizeof(JoinMatch*));
+    join.buffer_count = calloc(num_workers, sizeof(size_t));
+    join.buffer_capacity = calloc(num_workers, sizeof(size_t));
+    run_parallel(nested_loop_blocks, &join, num_workers);
+
+    size_t total = 0;
+    for (size_t b = 0; b < join.num_blocks; b++) {
+        join.block_dest[b] = total;
+        total += join.block_count[b];
+    }
+    join.positions1 = positions1->payload;
+    join.positions2 = positions2->payload;
+    join.out1 = arena_malloc((total > 0 ? total : 1) * sizeof(int));
+    join.out2 = arena_malloc((total > 0 ? total : 1) * sizeof(int));
+    join.next_block = 0;
+    run_parallel(copy_blocks, &join, num_workers);
+    *out1 = create_positions(join.out1, total);
+    *out2 = create_positions(join.out2, total);
+
+    log_info("nested-loop join: %zu x %zu tuples, %zu outer tiles, %zu matches\n",
+             join.length1, join.length2, join.num_blocks, total);
+    for (size_t w = 0; w < num_workers; w++) {
+        free(join.buffers[w]);
+    }
+    free(join.buffers);
+    free(join.buffer_count);
+    free(join.buffer_capacity);
+    free(join.block_worker);
+    free(join.block_offset);
+    free(join.block_count);
+    free(join.block_dest);
+    return ret_status;
+}
+
+/**
+ * seeded hash of the grace join, every level of partitioning uses its own
+ * seed so that a partition is split again by the next level
+ **/
+static inline uint32_t grace_hash(int key, uint32_t seed) {
+    uint32_t h = (uint32_t)key ^ seed;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ * TupleReader reads the tuples of a grace join input, either the values of
+ * the input result (file is NULL) or a partition spilled to a temp file
+ **/
+typedef struct TupleReader {
+    const int* values;
+    size_t length;
+    size_t next;
+    FILE* file;
+} TupleReader;
+
+static void rewind_reader(TupleReader* reader) {
+    reader->next = 0;
+    if (reader->file != NULL) {
+        rewind(reader->file);
+    }
+}
+
+static size_t read_tuples(TupleReader* reader, JoinTuple* buffer, size_t capacity) {
+    size_t count = reader->length - reader->next < capacity ? reader->length - reader->next : capacity;
+    if (reader->file != NULL) {
+        count = fread(buffer, sizeof(JoinTuple), count, reader->file);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            buffer[i].key = reader->values[reader->next + i];
+            buffer[i].index = reader->next + i;
+        }
+    }
+    reader->next += count;
+    return count;
+}
+
+/**
+ * GraceJoin is the state of a grace hash join, matches collects the
+ * matching pairs of all partitions
+ **/
+typedef struct GraceJoin {
+    size_t memory_budget;
+    JoinTuple* chunk;
+    JoinMatch* matches;
+    size_t num_matches;
+    size_t capacity;
+    JoinStats* stats;
+} GraceJoin;
+
+/**
+ * join a pair of partitions whose build side fits in the budget
+ **/
+static void grace_join_in_memory(GraceJoin* join, TupleReader* left, TupleReader* right) {
+    JoinTuple* build = malloc((right->length > 0 ? right->length : 1) * sizeof(JoinTuple));
+    size_t build_length = read_tuples(right, build, right->length);
+    int bucket_bits = 0;
+    while (((size_t)1 << bucket_bits) < build_length) {
+        bucket_bits++;
+    }
+    uint32_t* heads = calloc((size_t)1 << bucket_bits, sizeof(uint32_t));
+    uint32_t* next = malloc((build_length > 0 ? build_length : 1) * sizeof(uint32_t));
+    for (size_t i = build_length; i-- > 0;) {
+        size_t bucket = bucket_of(build[i].key, bucket_bits);
+        next[i] = heads[bucket];
+        heads[bucket] = i + 1;
+    }
+    size_t count;
+    while (build_length > 0 && (count = read_tuples(left, join->chunk, GRACE_CHUNK_SIZE)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            int key = join->chunk[i].key;
+            for (uint32_t j = heads[bucket_of(key, bucket_bits)]; j != 0; j = next[j - 1]) {
+                if (build[j - 1].key != key) {
+                    continue;
+                }
+                if (join->num_matches == join->capacity) {
+                    join->capacity = join->capacity == 0 ? 1024 : join->capacity * 2;
+                    join->matches = realloc(join->matches, join->capacity * sizeof(JoinMatch));
+                }
+                join->matches[join->num_matches].left = join->chunk[i].index;
+                join->matches[join->num_matches].right = build[j - 1].index;
+                join->num_matches++;
+            }
+        }
+    }
+    free(heads);
+    free(next);
+    free(build);
+}
+
+static int write_tuples(TupleReader* partition, const JoinTuple* tuples, size_t count) {
+    return fwrite(tuples, sizeof(JoinTuple), count, partition->file) == count ? 0 : -1;
+}
+
+/**
+ * spill the tuples of reader into fanout temp files on the seeded hash.
+ * The temp files are unbuffered and the write buffers are freed before
+ * returning, so the partitions a level keeps open while the next level
+ * recurses hold no memory
+ **/
+static int spill_partitions(GraceJoin* join, TupleReader* reader, uint32_t seed,
+                            TupleReader* partitions, size_t fanout, size_t buffer_size) {
+    size_t capacity = buffer_size / sizeof(JoinTuple);
+    JoinTuple* buffers = malloc(fanout * capacity * sizeof(JoinTuple));
+    size_t* fill = calloc(fanout, sizeof(size_t));
+    int ret = buffers != NULL && fill != NULL ? 0 : -1;
+    for (size_t p = 0; p < fanout && ret == 0; p++) {
+        partitions[p].values = NULL;
+        partitions[p].length = 0;
+        partitions[p].next = 0;
+        partitions[p].file = tmpfile();
+        if (partitions[p].file == NULL) {
+            ret = -1;
+        } else {
+            setvbuf(partitions[p].file, NULL, _IONBF, 0);
+        }
+    }
+    size_t count;
+    while (ret == 0 && (count = read_tuples(reader, join->chunk, GRACE_CHUNK_SIZE)) > 0) {
+        for (size_t i = 0; i < count && ret == 0; i++) {
+            size_t p = grace_hash(join->chunk[i].key, seed) % fanout;
+            buffers[p * capacity + fill[p]++] = join->chunk[i];
+            partitions[p].length++;
+            if (fill[p] == capacity) {
+                ret = write_tuples(&partitions[p], &buffers[p * capacity], capacity);
+                fill[p] = 0;
+            }
+        }
+    }
+    for (size_t p = 0; p < fanout && ret == 0; p++) {
+        ret = write_tuples(&partitions[p], &buffers[p * capacity], fill[p]);
+        join->stats->spilled_bytes += partitions[p].length * sizeof(JoinTuple);
+    }
+    free(buffers);
+    free(fill);
+    return ret;
+}
+
+static void close_partitions(TupleReader* partitions, size_t fanout) {
+    for (size_t p = 0; p < fanout; p++) {
+        if (partitions[p].file != NULL) {
+            fclose(partitions[p].file);
+        }
+    }
+}
+
+/**
+ * join left and right, partitioning them to temp files first if the hash
+ * table of right does not fit in the budget
+ **/
+static int grace_join_pair(GraceJoin* join, TupleReader* left, TupleReader* right, size_t depth) {
+    // an empty side has no match, the other side is not read at all
+    if (left->length == 0 || right->length == 0) {
+        return 0;
+    }
+    size_t build_bytes = right->length * JOIN_BUILD_TUPLE_SIZE;
+    if (build_bytes <= join->memory_budget || depth == GRACE_MAX_DEPTH) {
+        rewind_reader(left);
+        rewind_reader(right);
+        grace_join_in_memory(join, left, right);
+        return 0;
+    }
+    size_t fanout = 2 * ((build_bytes + join->memory_budget - 1) / join->memory_budget);
+    fanout = fanout > GRACE_MAX_FANOUT ? GRACE_MAX_FANOUT : fanout;
+    // the sides are spilled one after the other, each partition of the
+    // side being spilled holds a write buffer
+    size_t buffer_size = join->memory_budget / fanout;
+    buffer_size = buffer_size < GRACE_MIN_BUFFER_SIZE ? GRACE_MIN_BUFFER_SIZE :
+                  buffer_size > GRACE_MAX_BUFFER_SIZE ? GRACE_MAX_BUFFER_SIZE : buffer_size;
+    join->stats->num_partitions += fanout;
+    if (depth + 1 > join->stats->max_depth) {
+        join->stats->max_depth = depth + 1;
+    }
+
+    TupleReader* left_partitions = calloc(fanout, sizeof(TupleReader));
+    TupleReader* right_partitions = calloc(fanout, sizeof(TupleReader));
+    uint32_t seed = 0x9E3779B9u * (depth + 1);
+    rewind_reader(left);
+    rewind_reader(right);
+    int ret = 0;
+    if (spill_partitions(join, left, seed, left_partitions, fanout, buffer_size) != 0 ||
+        spill_partitions(join, right, seed, right_partitions, fanout, buffer_size) != 0) {
+        ret = -1;
+    }
+    for (size_t p = 0; p < fanout && ret == 0; p++) {
+        // a partition the hash did not split at all is made of duplicates
+        size_t next_depth = right_partitions[p].length == right->length ? GRACE_MAX_DEPTH : depth + 1;
+        ret = grace_join_pair(join, &left_partitions[p], &right_partitions[p], next_depth);
+    }
+    close_partitions(left_partitions, fanout);
+    close_partitions(right_partitions, fanout);
+    free(left_partitions);
+    free(right_partitions);
+    return ret;
+}
+
+static int compare_matches(const void* a, const void* b) {
+    const JoinMatch* x = a;
+    const JoinMatch* y = b;
+    if (x->left != y->left) {
+        return x->left < y->left ? -1 : 1;
+    }
+    return (x->right > y->right) - (x->right < y->right);
+}
+
+Status grace_hash_join(Result* values1, Result* positions1, Result* values2, Result* positions2,
+                       size_t memory_budget, Result** out1, Result** out2, JoinStats* stats) {
+    Status ret_status = check_join_inputs(values1, positions1, values2, positions2);
+    if (ret_status.code != OK) {
+        return ret_status;
+    }
+    memset(stats, 0, sizeof(JoinStats));
+    GraceJoin join;
+    join.memory_budget = memory_budget;
+    join.chunk = malloc(GRACE_CHUNK_SIZE * sizeof(JoinTuple));
+    join.matches = NULL;
+    join.num_matches = 0;
+    join.capacity = 0;
+    join.stats = stats;
+    TupleReader left = { values1->payload, values1->num_tuples, 0, NULL };
+    TupleReader right = { values2->payload, values2->num_tuples, 0, NULL };
+    if (grace_join_pair(&join, &left, &right, 0) != 0) {
+        free(join.chunk);
+        free(join.matches);
+        ret_status.code = ERROR;
+        ret_status.error_message = "cannot spill join partitions";
+        return ret_status;
+    }
+    free(join.chunk);
+
+    // partitions come out in hash order, restore the order of hash_join
+    if (join.num_matches > 1) {
+        qsort(join.matches, join.num_matches, sizeof(JoinMatch), compare_matches);
+    }
+    const int* pos1 = positions1->payload;
+    const int* pos2 = positions2->payload;
+    int* payload1 = arena_malloc((join.num_matches > 0 ? join.num_matches : 1) * sizeof(int));
+    int* payload2 = arena_malloc((join.num_matches > 0 ? join.num_matches : 1) * sizeof(int));
+    for (size_t k = 0; k < join.num_matches; k++) {
+        payload1[k] = pos1[join.matches[k].left];
+        payload2[k] = pos2[join.matches[k].right];
+    }
+    *out1 = create_positions(payload1, join.num_matches);
+    *out2 = create_positions(payload2, join.num_matches);
+    free(join.matches);
+    return ret_status;
+}
@@ -0,0 +1,341 @@
+/**
+ * db_loader.c
+ * Multi-threaded bulk loading of csv data files. Parsing happens in place on
+ * the mmap-ed file and values are written directly into the pre-sized column
+ * mappings, without going through relational_insert.
+ **/
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "db_compress.h"
+#include "db_index.h"
+#include "db_stats.h"
+#include "db_loader.h"
+#include "db_manager.h"
+#include "db_storage.h"
+#include "thread_pool.h"
+#include "utils_func.h"
+
+#define NAME_LEN 256
+// longest error message of a load, naming the line at fault
+#define LOAD_ERROR_SIZE 96
+
+/**
+ * LoadChunk describes the newline-aligned slice [begin, end) of the file
+ * parsed by one thread, and where its rows go in the columns. first_line
+ * numbers its first line in the file, error_line is the first line it
+ * could not parse, or 0.
+ **/
+typedef struct LoadChunk {
+    const char* begin;
+    const char* end;
+    size_t num_rows;
+    size_t num_lines;
+    size_t first_row;
+    size_t first_line;
+    size_t error_line;
+    int** columns;
+    size_t num_columns;
+} LoadChunk;
+
+static bool blank_line(const char* line, const char* line_end) {
+    return line == line_end || (line + 1 == line_end && *line == '\r');
+}
+
+/**
+ * count the lines and the non-blank lines of a chunk
+ **/
+static void count_rows(LoadChunk* chunk) {
+    const char* p = chunk->begin;
+    size_t rows = 0;
+    size_t lines = 0;
+    while (p < chunk->end) {
+        const char* nl = memchr(p, '\n', chunk->end - p);
+        const char* line_end = nl == NULL ? chunk->end : nl;
+        if (!blank_line(p, line_end)) {
+            rows++;
+        }
+        lines++;
+        p = line_end + 1;
+    }
+    chunk->num_rows = rows;
+    chunk->num_lines = lines;
+}
+
+/**
+ * parse one line into row of the columns. Returns false unless the line
+ * holds exactly one int per column, separated by commas.
+ **/
+static bool parse_line(const char* p, const char* line_end, int** columns, size_t num_columns, size_t row) {
+    if (line_end > p && line_end[-1] == '\r') {
+        line_end--;
+    }
+    for (size_t j = 0; j < num_columns; j++) {
+        bool negative = p < line_end && *p == '-';
+        if (negative) {
+            p++;
+        }
+        const char* digits = p;
+        uint64_t magnitude = 0;
+        while (p < line_end && (unsigned)(*p - '0') < 10) {
+            magnitude = magnitude * 10 + (*p - '0');
+            if (magnitude > (uint64_t)INT_MAX + 1) {
+                return false;
+            }
+            p++;
+        }
+        if (p == digits || (!negative && magnitude > INT_MAX)) {
+            return false;
+        }
+        columns[j][row] = negative ? (int)-(int64_t)magnitude : (int)magnitude;
+        // every field but the last ends at a separator
+        if (j + 1 < num_columns) {
+            if (p == line_end || *p != ',') {
+                return false;
+            }
+            p++;
+        }
+    }
+    return p == line_end;
+}
+
+/**
+ * parse the rows of a chunk into the columns, the file is never copied.
+ * The chunk stops at the first line it cannot parse.
+ **/
+static void parse_rows(LoadChunk* chunk) {
+    const char* p = chunk->begin;
+    const char* end = chunk->end;
+    size_t row = chunk->first_row;
+    size_t line = chunk->first_line;
+    chunk->error_line = 0;
+    while (p < end) {
+        const char* nl = memchr(p, '\n', end - p);
+        const char* line_end = nl == NULL ? end : nl;
+        if (!blank_line(p, line_end)) {
+            if (!parse_line(p, line_end, chunk->columns, chunk->num_columns, row)) {
+                chunk->error_line = line;
+                return;
+            }
+            row++;
+        }
+        line++;
+        p = line_end + 1;
+    }
+}
+
+/**
+ * ChunkRun runs one routine over the chunks, worker i takes chunk i
+ **/
+typedef struct ChunkRun {
+    void (*routine)(LoadChunk* chunk);
+    LoadChunk* chunks;
+    size_t num_chunks;
+} ChunkRun;
+
+static void run_chunk(void* arg, size_t worker) {
+    ChunkRun* run = arg;
+    if (worker < run->num_chunks) {
+        run->routine(&run->chunks[worker]);
+    }
+}
+
+static void run_chunks(void (*routine)(LoadChunk*), LoadChunk* chunks, size_t num_chunks) {
+    ChunkRun run = { routine, chunks, num_chunks };
+    run_parallel(run_chunk, &run, num_chunks);
+}
+
+/**
+ * resolve the header line into the columns of a single table, columns
+ * holds one entry per field of the header
+ **/
+static Table* parse_header(const char* header, size_t header_len, Column** columns, size_t* num_columns) {
+    char name[NAME_LEN];
+    Table* table = NULL;
+    size_t count = 0;
+    const char* p = header;
+    const char* end = header + header_len;
+    while (p < end) {
+        const char* comma = memchr(p, ',', end - p);
+        const char* name_end = comma == NULL ? end : comma;
+        size_t len = name_end - p;
+        if (len > 0 && p[len - 1] == '\r') {
+            len--;
+        }
+        if (len >= NAME_LEN) {
+            return NULL;
+        }
+        memcpy(name, p, len);
+        name[len] = '\0';
+        Column* column = lookup_column(name);
+        Table* column_table = lookup_column_table(name);
+        if (column == NULL || (table != NULL && column_table != table)) {
+            log_err("L%d: unknown column %s in load header.\n", __LINE__, name);
+            return NULL;
+        }
+        table = column_table;
+        if (count == table->col_used) {
+            return NULL;
+        }
+        for (size_t k = 0; k < count; k++) {
+            if (columns[k] == column) {
+                log_err("L%d: column %s appears twice in load header.\n", __LINE__, name);
+                return NULL;
+            }
+        }
+        columns[count++] = column;
+        p = name_end + 1;
+    }
+    *num_columns = count;
+    return table;
+}
+
+static double elapsed_seconds(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+Status load_csv(const char* file_name) {
+    Status ret_status;
+    ret_status.code = OK;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int fd = open(file_name, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        ret_status.code = ERROR;
+        ret_status.error_message = "cannot open data file";
+        return ret_status;
+    }
+    size_t file_size = st.st_size;
+    const char* file = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        ret_status.code = ERROR;
+        ret_status.error_message = "cannot map data file";
+        return ret_status;
+    }
+    madvise((void*)file, file_size, MADV_SEQUENTIAL);
+    const char* file_end = file + file_size;
+
+    const char* header_end = memchr(file, '\n', file_size);
+    if (header_end == NULL) {
+        header_end = file_end;
+    }
+    size_t num_fields = 1;
+    for (const char* p = file; p < header_end; p++) {
+        num_fields += *p == ',';
+    }
+    Column** columns = malloc(num_fields * sizeof(Column*));
+    size_t num_columns = 0;
+    Table* table = parse_header(file, header_end - file, columns, &num_columns);
+    if (table == NULL || num_columns != table->col_used) {
+        free(columns);
+        munmap((void*)file, file_size);
+        ret_status.code = ERROR;
+        ret_status.error_message = "load header does not match the table";
+        return ret_status;
+    }
+
+    // split the body into newline-aligned chunks, one per thread of the pool
+    const char* body = header_end < file_end ? header_end + 1 : file_end;
+    size_t body_size = file_end - body;
+    size_t num_chunks = parallel_workers(body_size, 0);
+    if (num_chunks > body_size / LOAD_MIN_CHUNK_SIZE) {
+        num_chunks = body_size / LOAD_MIN_CHUNK_SIZE;
+    }
+    if (num_chunks == 0) {
+        num_chunks = 1;
+    }
+    LoadChunk* chunks = malloc(num_chunks * sizeof(LoadChunk));
+    int** column_data = malloc(num_columns * sizeof(int*));
+    const char* chunk_begin = body;
+    for (size_t i = 0; i < num_chunks; i++) {
+        const char* chunk_end = i + 1 == num_chunks ? file_end : body + body_size / num_chunks * (i + 1);
+        if (chunk_end < chunk_begin) {
+            chunk_end = chunk_begin;
+        }
+        if (chunk_end < file_end) {
+            const char* nl = memchr(chunk_end, '\n', file_end - chunk_end);
+            chunk_end = nl == NULL ? file_end : nl + 1;
+        }
+        chunks[i].begin = chunk_begin;
+        chunks[i].end = chunk_end;
+        chunks[i].columns = column_data;
+        chunks[i].num_columns = num_columns;
+        chunk_begin = chunk_end;
+    }
+    run_chunks(count_rows, chunks, num_chunks);
+
+    // size the columns once, then every chunk writes to its own row range;
+    // the header is line 1
+    size_t num_rows = 0;
+    size_t num_lines = 1;
+    for (size_t i = 0; i < num_chunks; i++) {
+        chunks[i].first_row = table->table_length + num_rows;
+        chunks[i].first_line = num_lines + 1;
+        num_rows += chunks[i].num_rows;
+        num_lines += chunks[i].num_lines;
+    }
+    for (size_t j = 0; j < num_columns; j++) {
+        if (reserve_column(columns[j], table->table_length + num_rows) != 0) {
+            free(columns);
+            free(column_data);
+            free(chunks);
+            munmap((void*)file, file_size);
+            ret_status.code = ERROR;
+            ret_status.error_message = "cannot grow column";
+            return ret_status;
+        }
+        column_data[j] = columns[j]->data;
+        columns[j]->dirty = true;
+    }
+    run_chunks(parse_rows, chunks, num_chunks);
+    size_t error_line = 0;
+    for (size_t i = 0; i < num_chunks && error_line == 0; i++) {
+        error_line = chunks[i].error_line;
+    }
+    free(columns);
+    free(column_data);
+    free(chunks);
+    munmap((void*)file, file_size);
+    // the rows parsed past the end of the table are dropped with the load
+    if (error_line != 0) {
+        char* message = arena_malloc(LOAD_ERROR_SIZE);
+        snprintf(message, LOAD_ERROR_SIZE, "line %zu of the data file is not one int per column", error_line);
+        ret_status.code = ERROR;
+        ret_status.error_message = message;
+        return ret_status;
+    }
+    table->table_length += num_rows;
+    update_stats(table, table->table_length - num_rows);
+    ret_status = update_indexes(table, table->table_length - num_rows);
+    if (ret_status.code != OK) {
+        return ret_status;
+    }
+    compress_table(table);
+
+    double seconds = elapsed_seconds(&start);
+    if (seconds <= 0) {
+        seconds = 1e-9;
+    }
+    log_info("load %s: %zu rows, %zu bytes in %.3f s (%.0f rows/s, %.2f MB/s, %zu threads)\n",
+             file_name, num_rows, file_size, seconds, num_rows / seconds,
+             file_size / seconds / (1 << 20), num_chunks);
+    return ret_status;
+}
@@ -3,7 +3,15 @@
 #include <stdio.h>
 #include <memory.h>
 
+#include "catalog_map.h"
 #include "db_element.h"
+#include "db_compress.h"
+#include "db_delta.h"
+#include "db_index.h"
+#include "db_stats.h"
+#include "db_manager.h"
+#include "db_storage.h"
+#include "db_zonemap.h"
 #include "message.h"
 #include "utils_func.h"
 
@@ -13,19 +21,53 @@
 // In this class, there will always be only one active database at a time
 Db* current_db;
 
+// maps "db", "db.tbl" and "db.tbl.col" to the catalog objects
+static CatalogMap* catalog = NULL;
+
+static void put_object(char* name, void* object) {
+    if (catalog == NULL) {
+        catalog = create_catalog_map();
+    }
+    catalog_put(catalog, name, object);
+}
+
+static void* get_object(char* name) {
+    if (catalog == NULL) {
+        return NULL;
+    }
+    return catalog_get(catalog, name);
+}
+
+static Db* get_db(char* db_name) {
+    return get_object(db_name);
+}
+
+/**
+ * register a table and its columns in the catalog
+ **/
+static void put_table(Db* db, Table* table) {
+    char name[DIRLEN];
+    snprintf(name, DIRLEN, "%s.%s", db->name, table->name);
+    put_object(name, table);
+    for (size_t i = 0; i < table->col_used; i++) {
+        snprintf(name, DIRLEN, "%s.%s.%s", db->name, table->name, table->columns[i].name);
+        put_object(name, &table->columns[i]);
+    }
+}
+
 Db* create_db(char* db_name) {
     Db* db = get_db(db_name);
     if(db != NULL) {
         log_info("database %s exists, open database %s\n", db_name, db_name);
-        return current_db;
+        return db;
     }
     db = malloc(sizeof(Db));
-    db->db_name = malloc((strlen(db_name)+1)* sizeof(char));
-    strcpy(db->db_name,db_name);
-    db->db_capacity = 0;
-    db->db_size = 0;
+    memset(db, 0, sizeof(Db));
+    strncpy(db->name, db_name, MAX_SIZE_NAME - 1);
+    db->tables_capacity = 0;
+    db->tables_size = 0;
     db->tables = NULL;
-    put_db(db_name,db);
+    put_object(db->name, db);
     log_info("create db %s successfully.\n",db_name);
     return db;
 }
@@ -36,20 +78,207 @@ Db* create_db(char* db_name) {
  * to the caller that there was an error in table creation
  */
 Table* create_table(Db* db, const char* name, size_t num_columns, Status *ret_status) {
-	ret_status->code=OK;
-	return NULL;
+    if (db == NULL || num_columns == 0) {
+        ret_status->code = ERROR;
+        ret_status->error_message = "invalid table definition";
+        return NULL;
+    }
+    for (size_t i = 0; i < db->tables_size; i++) {
+        if (strcmp(db->tables[i]->name, name) == 0) {
+            ret_status->code = ERROR;
+            ret_status->error_message = "table already exists";
+            return NULL;
+        }
+    }
+    if (db->tables_size == db->tables_capacity) {
+        size_t new_capacity = db->tables_capacity == 0 ? 1 : db->tables_capacity * RESIZE;
+        // only the array of pointers moves, every table keeps its address
+        // for the results and queued queries that refer to it
+        Table** tables = realloc(db->tables, new_capacity * sizeof(Table*));
+        if (tables == NULL) {
+            ret_status->code = ERROR;
+            ret_status->error_message = "out of memory";
+            return NULL;
+        }
+        db->tables = tables;
+        db->tables_capacity = new_capacity;
+    }
+    Table* table = calloc(1, sizeof(Table));
+    db->tables[db->tables_size++] = table;
+    strncpy(table->name, name, MAX_SIZE_NAME - 1);
+    table->col_count = num_columns;
+    table->columns = calloc(num_columns, sizeof(Column));
+    for (size_t i = 0; i < num_columns; i++) {
+        table->columns[i].fd = -1;
+    }
+    put_table(db, table);
+    ret_status->code = OK;
+    return table;
 }
 
-/*
- * Similarly, this method is meant to create a database.
- * As an implementation choice, one can use the same method
- * for creating a new database and for loading a database
- * from disk, or one can divide the two into two different
- * methods.
- */
-Status add_db(const char* db_name, bool new) {
-	struct Status ret_status;
+Column* create_column(Table* table, const char* name, Status *ret_status) {
+    if (table->col_used == table->col_count) {
+        ret_status->code = ERROR;
+        ret_status->error_message = "table is full";
+        return NULL;
+    }
+    for (size_t i = 0; i < table->col_used; i++) {
+        if (strcmp(table->columns[i].name, name) == 0) {
+            ret_status->code = ERROR;
+            ret_status->error_message = "column already exists";
+            return NULL;
+        }
+    }
+    Column* column = &table->columns[table->col_used];
+    strncpy(column->name, name, MAX_SIZE_NAME - 1);
+    if (create_column_file(column, current_db->name, table->name) != 0 ||
+        reserve_column(column, table->table_length) != 0) {
+        ret_status->code = ERROR;
+        ret_status->error_message = "cannot create column file";
+        return NULL;
+    }
+    table->col_used++;
+    put_table(current_db, table);
+    ret_status->code = OK;
+    return column;
+}
+
+Table* lookup_table(char* name) {
+    return get_object(name);
+}
 
-	ret_status.code = OK;
-	return ret_status;
+Column* lookup_column(char* name) {
+    return get_object(name);
+}
+
+Table* lookup_column_table(char* name) {
+    Table* table;
+    return resolve_column(name, strlen(name), &table) != NULL ? table : NULL;
+}
+
+Table* resolve_table(const char* name, size_t length) {
+    if (catalog == NULL) {
+        return NULL;
+    }
+    return catalog_find(catalog, name, length);
+}
+
+Column* resolve_column(const char* name, size_t length, Table** table) {
+    *table = NULL;
+    if (catalog == NULL) {
+        return NULL;
+    }
+    Column* column = catalog_find(catalog, name, length);
+    if (column == NULL) {
+        return NULL;
+    }
+    // the table is named by the column name up to its last dot
+    size_t table_length = length;
+    while (table_length > 0 && name[table_length - 1] != '.') {
+        table_length--;
+    }
+    if (table_length < 2) {
+        return NULL;
+    }
+    *table = catalog_find(catalog, name, table_length - 1);
+    return *table != NULL ? column : NULL;
+}
+
+Status relational_insert(Table* table, const int* values, size_t num_rows) {
+    Status ret_status;
+    ret_status.code = OK;
+    while (num_rows > 0) {
+        size_t appended = append_delta(table, values, num_rows);
+        values += appended * table->col_count;
+        num_rows -= appended;
+        if (delta_full(table)) {
+            ret_status = merge_delta(table);
+            if (ret_status.code != OK) {
+                return ret_status;
+            }
+        }
+    }
+    return ret_status;
+}
+
+Status load_db(void) {
+    Status ret_status;
+    ret_status.code = OK;
+    Db* db;
+    if (read_catalog(&db) != 0) {
+        ret_status.code = ERROR;
+        ret_status.error_message = "cannot restore the database";
+        log_err("database on disk cannot be restored.\n");
+        return ret_status;
+    }
+    if (db == NULL) {
+        return ret_status;
+    }
+    put_object(db->name, db);
+    // the clustered copies are opened under the name of the database
+    current_db = db;
+    for (size_t i = 0; i < db->tables_size; i++) {
+        Table* table = db->tables[i];
+        put_table(db, table);
+        open_indexes(table);
+        update_stats(table, table->table_length);
+        update_zone_maps(table, 0);
+        compress_table(table);
+    }
+    log_info("database %s restored from disk.\n", db->name);
+    return ret_status;
+}
+
+Status sync_db(Db* db) {
+    Status ret_status;
+    ret_status.code = OK;
+    if (merge_deltas(db).code != OK) {
+        ret_status.code = ERROR;
+    }
+    for (size_t i = 0; i < db->tables_size; i++) {
+        Table* table = db->tables[i];
+        for (size_t j = 0; j < table->col_used; j++) {
+            if (sync_column(&table->columns[j], table->table_length) != 0) {
+                ret_status.code = ERROR;
+            }
+        }
+        if (sync_indexes(table) != 0) {
+            ret_status.code = ERROR;
+        }
+    }
+    if (write_catalog(db) != 0) {
+        ret_status.code = ERROR;
+    }
+    if (ret_status.code != OK) {
+        ret_status.error_message = "sync database failed";
+    }
+    return ret_status;
+}
+
+Status shutdown_db(void) {
+    Status ret_status;
+    ret_status.code = OK;
+    if (current_db == NULL) {
+        return ret_status;
+    }
+    ret_status = sync_db(current_db);
+    for (size_t i = 0; i < current_db->tables_size; i++) {
+        Table* table = current_db->tables[i];
+        free_delta(table);
+        close_indexes(table);
+        free_stats(table);
+        free_zone_maps(table);
+        drop_compressed(table);
+        for (size_t j = 0; j < table->col_used; j++) {
+            close_column_file(&table->columns[j]);
+        }
+        free(table->columns);
+        free(table);
+    }
+    free(current_db->tables);
+    free(current_db);
+    current_db = NULL;
+    free_catalog_map(catalog);
+    catalog = NULL;
+    return ret_status;
 }
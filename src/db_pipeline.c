@@ -0,0 +1,237 @@
+/**
+ * db_pipeline.c
+ * Deferred select and fetch results, and the fused select, fetch and
+ * aggregate loop over them.
+ **/
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "db_aggregate.h"
+#include "db_pipeline.h"
+#include "db_select.h"
+#include "db_zonemap.h"
+#include "thread_pool.h"
+#include "utils_func.h"
+
+// the deferred results of every client
+static DeferredResult* registry = NULL;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void unregister(DeferredResult* deferred) {
+    pthread_mutex_lock(&registry_lock);
+    if (deferred->prev != NULL) {
+        deferred->prev->next = deferred->next;
+    } else {
+        registry = deferred->next;
+    }
+    if (deferred->next != NULL) {
+        deferred->next->prev = deferred->prev;
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static Result* new_deferred(DeferredResult* deferred) {
+    Result* result = arena_malloc(sizeof(Result));
+    result->data_type = INT;
+    result->num_tuples = 0;
+    result->payload = NULL;
+    result->format = POSITION_ARRAY;
+    result->copy = NULL;
+    result->table = deferred->fetch_column == NULL ? deferred->table : NULL;
+    result->version = deferred->table->version;
+    result->deferred = deferred;
+    deferred->result = result;
+    pthread_mutex_lock(&registry_lock);
+    deferred->prev = NULL;
+    deferred->next = registry;
+    if (registry != NULL) {
+        registry->prev = deferred;
+    }
+    registry = deferred;
+    pthread_mutex_unlock(&registry_lock);
+    return result;
+}
+
+Result* defer_select(Table* table, Column* column, Comparator* comparator, size_t estimate) {
+    DeferredResult* deferred = malloc(sizeof(DeferredResult));
+    deferred->table = table;
+    deferred->select_column = column;
+    make_scan_predicate(comparator, &deferred->predicate);
+    // rows appended later are not part of the result
+    deferred->length = table->table_length;
+    deferred->estimate = estimate;
+    deferred->fetch_column = NULL;
+    return new_deferred(deferred);
+}
+
+Result* defer_fetch(Column* column, Result* positions) {
+    DeferredResult* deferred = malloc(sizeof(DeferredResult));
+    *deferred = *positions->deferred;
+    deferred->fetch_column = column;
+    return new_deferred(deferred);
+}
+
+/**
+ * compute a deferred result that is no longer registered
+ **/
+static void compute_deferred(DeferredResult* deferred) {
+    Result* result = deferred->result;
+    // the result belongs to its client, whichever client materializes it
+    Arena* previous = use_arena(arena_of(result));
+    size_t zones_skipped;
+    Result* positions = scan_column(deferred->select_column, deferred->length, &deferred->predicate,
+                                    deferred->estimate, &zones_skipped);
+    Result* computed = positions;
+    PositionFormat format = positions->format;
+    if (deferred->fetch_column != NULL) {
+        computed = fetch(deferred->table, deferred->fetch_column, positions);
+        arena_free(positions->payload);
+        arena_free(positions);
+    }
+    log_info("materialized %s on %s.%s: %zu rows, %zu zones skipped, positions as %s\n",
+             deferred->fetch_column != NULL ? "fetch" : "select", deferred->table->name,
+             deferred->select_column->name, computed->num_tuples, zones_skipped, position_format_name(format));
+    // the positions are taken before the rows of the table move
+    Table* table = result->table;
+    size_t version = result->version;
+    *result = *computed;
+    result->table = table;
+    result->version = version;
+    arena_free(computed);
+    free(deferred);
+    use_arena(previous);
+}
+
+void materialize(Result* result) {
+    DeferredResult* deferred = result->deferred;
+    if (deferred == NULL) {
+        return;
+    }
+    unregister(deferred);
+    compute_deferred(deferred);
+}
+
+void materialize_table(Table* table) {
+    DeferredResult* pending = NULL;
+    pthread_mutex_lock(&registry_lock);
+    DeferredResult* deferred = registry;
+    while (deferred != NULL) {
+        DeferredResult* next = deferred->next;
+        if (deferred->table == table) {
+            if (deferred->prev != NULL) {
+                deferred->prev->next = next;
+            } else {
+                registry = next;
+            }
+            if (next != NULL) {
+                next->prev = deferred->prev;
+            }
+            deferred->next = pending;
+            pending = deferred;
+        }
+        deferred = next;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    while (pending != NULL) {
+        DeferredResult* next = pending->next;
+        compute_deferred(pending);
+        pending = next;
+    }
+}
+
+void discard_deferred(Result* result) {
+    DeferredResult* deferred = result->deferred;
+    if (deferred == NULL) {
+        return;
+    }
+    unregister(deferred);
+    free(deferred);
+    result->deferred = NULL;
+}
+
+/**
+ * FusedPass is the state shared by the workers of a fused select, fetch
+ * and aggregate. Workers claim morsels of rows and aggregate them zone by
+ * zone into partials[worker].
+ **/
+typedef struct FusedPass {
+    const DeferredResult* deferred;
+    size_t table_length;
+    size_t num_morsels;
+    size_t next_morsel;
+    Aggregate* partials;
+    size_t zones_skipped;
+    size_t zones_from_map;
+} FusedPass;
+
+static void fused_morsels(void* arg, size_t worker) {
+    FusedPass* pass = arg;
+    const DeferredResult* deferred = pass->deferred;
+    const ZoneMap* select_zones = deferred->select_column->zones;
+    const ZoneMap* fetch_zones = deferred->fetch_column->zones;
+    Aggregate* aggregate = &pass->partials[worker];
+    int* positions = malloc(sizeof(int) * ZONE_SIZE);
+    size_t zones_skipped = 0;
+    size_t zones_from_map = 0;
+    size_t m;
+    while ((m = claim_morsel(&pass->next_morsel)) < pass->num_morsels) {
+        size_t begin = m * SELECT_MORSEL_SIZE;
+        size_t end = begin + SELECT_MORSEL_SIZE < deferred->length ? begin + SELECT_MORSEL_SIZE : deferred->length;
+        for (size_t zone_begin = begin; zone_begin < end; zone_begin += ZONE_SIZE) {
+            size_t zone = zone_begin / ZONE_SIZE;
+            size_t zone_end = zone_begin + ZONE_SIZE < end ? zone_begin + ZONE_SIZE : end;
+            if (select_zones != NULL && zone < select_zones->num_zones) {
+                ZoneMatch match = zone_match(select_zones, zone, &deferred->predicate);
+                if (match == ZONE_NONE) {
+                    zones_skipped++;
+                    continue;
+                }
+                // the synopsis also covers the rows appended to the zone
+                // since the select, if any
+                size_t table_zone_end = zone_begin + ZONE_SIZE < pass->table_length
+                    ? zone_begin + ZONE_SIZE : pass->table_length;
+                if (match == ZONE_ALL && zone_end == table_zone_end &&
+                    fetch_zones != NULL && zone < fetch_zones->num_zones) {
+                    aggregate_zone(aggregate, fetch_zones, zone, zone_end - zone_begin);
+                    zones_from_map++;
+                    continue;
+                }
+            }
+            size_t k = select_rows(deferred->select_column, &deferred->predicate, zone_begin, zone_end,
+                                   positions, &zones_skipped);
+            aggregate_gather(aggregate, deferred->fetch_column->data, positions, k);
+        }
+    }
+    free(positions);
+    __sync_fetch_and_add(&pass->zones_skipped, zones_skipped);
+    __sync_fetch_and_add(&pass->zones_from_map, zones_from_map);
+}
+
+Result* pipeline_aggregate(AggregateType type, Result* values) {
+    const DeferredResult* deferred = values->deferred;
+    size_t num_workers = parallel_workers(deferred->length, PARALLEL_SELECT_THRESHOLD);
+    FusedPass pass;
+    pass.deferred = deferred;
+    pass.table_length = deferred->table->table_length;
+    pass.num_morsels = deferred->predicate.kind != SCAN_NONE
+        ? (deferred->length + SELECT_MORSEL_SIZE - 1) / SELECT_MORSEL_SIZE : 0;
+    pass.next_morsel = 0;
+    pass.partials = malloc(sizeof(Aggregate) * num_workers);
+    pass.zones_skipped = 0;
+    pass.zones_from_map = 0;
+    for (size_t w = 0; w < num_workers; w++) {
+        start_aggregate(&pass.partials[w], INT);
+    }
+    run_parallel(fused_morsels, &pass, num_workers);
+    Aggregate aggregate;
+    start_aggregate(&aggregate, INT);
+    for (size_t w = 0; w < num_workers; w++) {
+        merge_aggregate(&aggregate, &pass.partials[w]);
+    }
+    free(pass.partials);
+    log_info("fused aggregate of %s.%s selected on %s: %zu rows, %zu zones skipped, %zu zones from the zone map\n",
+             deferred->table->name, deferred->fetch_column->name, deferred->select_column->name,
+             aggregate.count, pass.zones_skipped, pass.zones_from_map);
+    return aggregate_value(type, &aggregate);
+}
@@ -0,0 +1,623 @@
+/**
+ * db_select.c
+ * Scan based select and fetch operators. Positions are reported as an INT
+ * result in ascending order, as a range, a bitmap or an array.
+ **/
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "db_compress.h"
+#include "db_select.h"
+#include "db_stats.h"
+#include "db_zonemap.h"
+#include "scan_kernels.h"
+#include "thread_pool.h"
+
+bool comparator_bounds(Comparator* comparator, int* low, int* high) {
+    long lower = LONG_MIN;
+    long upper = LONG_MAX;
+    switch (comparator->type1) {
+        case GREATER_THAN_OR_EQUAL:
+            lower = comparator->p_low;
+            break;
+        case GREATER_THAN:
+            lower = comparator->p_low + 1;
+            break;
+        case EQUAL:
+            lower = upper = comparator->p_low;
+            break;
+        default:
+            break;
+    }
+    switch (comparator->type2) {
+        case LESS_THAN:
+            upper = upper < comparator->p_high - 1 ? upper : comparator->p_high - 1;
+            break;
+        case LESS_THAN_OR_EQUAL:
+            upper = upper < comparator->p_high ? upper : comparator->p_high;
+            break;
+        default:
+            break;
+    }
+    if (lower < INT_MIN) {
+        lower = INT_MIN;
+    }
+    if (upper > INT_MAX) {
+        upper = INT_MAX;
+    }
+    if (lower > upper) {
+        return false;
+    }
+    *low = (int)lower;
+    *high = (int)upper;
+    return true;
+}
+
+size_t select_rows(const Column* column, const ScanPredicate* predicate, size_t begin, size_t end,
+                          int* out, size_t* zones_skipped) {
+    const ZoneMap* zones = column->zones;
+    const CompressedColumn* compressed = column->compressed;
+    size_t k = 0;
+    size_t zone_end;
+    for (size_t zone_begin = begin; zone_begin < end; zone_begin = zone_end) {
+        size_t zone = zone_begin / ZONE_SIZE;
+        zone_end = zone_begin + ZONE_SIZE < end ? zone_begin + ZONE_SIZE : end;
+        ZoneMatch match = zones != NULL && zone < zones->num_zones ? zone_match(zones, zone, predicate) : ZONE_SOME;
+        if (match == ZONE_NONE) {
+            (*zones_skipped)++;
+            continue;
+        }
+        if (match == ZONE_ALL) {
+            for (size_t i = zone_begin; i < zone_end; i++) {
+                out[k++] = i;
+            }
+            continue;
+        }
+        // rows appended since the column was encoded are scanned as they are
+        size_t split = zone_begin;
+        if (compressed != NULL && compressed->length > zone_begin) {
+            split = compressed->length < zone_end ? compressed->length : zone_end;
+            k += compressed_select(compressed, predicate, zone_begin, split, out + k);
+        }
+        k += scan_positions(column->data, NULL, split, zone_end, predicate, out + k);
+    }
+    return k;
+}
+
+/**
+ * ParallelSelect is the state shared by the workers of a parallel select.
+ * Workers claim morsels and append their positions to a private buffer;
+ * the morsel_* arrays remember where each morsel's output went so that the
+ * buffers can be merged back in row order. A select on a base column reads
+ * column, otherwise values.
+ **/
+typedef struct ParallelSelect {
+    const Column* column;
+    size_t zones_skipped;
+    const int* values;
+    const int* positions;
+    size_t length;
+    ScanPredicate predicate;
+    size_t num_morsels;
+    size_t next_morsel;
+    size_t* morsel_worker;
+    size_t* morsel_offset;
+    size_t* morsel_count;
+    size_t* morsel_dest;
+    int** buffers;
+    size_t* buffer_count;
+    size_t* buffer_capacity;
+    int* out;
+} ParallelSelect;
+
+static void select_morsels(void* arg, size_t worker) {
+    ParallelSelect* ps = arg;
+    size_t m;
+    while ((m = claim_morsel(&ps->next_morsel)) < ps->num_morsels) {
+        size_t begin = m * SELECT_MORSEL_SIZE;
+        size_t end = begin + SELECT_MORSEL_SIZE < ps->length ? begin + SELECT_MORSEL_SIZE : ps->length;
+        if (ps->buffer_count[worker] + SELECT_MORSEL_SIZE > ps->buffer_capacity[worker]) {
+            ps->buffer_capacity[worker] = ps->buffer_capacity[worker] * 2 + SELECT_MORSEL_SIZE;
+            ps->buffers[worker] = realloc(ps->buffers[worker], sizeof(int) * ps->buffer_capacity[worker]);
+        }
+        int* out = ps->buffers[worker] + ps->buffer_count[worker];
+        size_t k;
+        if (ps->column != NULL) {
+            size_t skipped = 0;
+            k = select_rows(ps->column, &ps->predicate, begin, end, out, &skipped);
+            __sync_fetch_and_add(&ps->zones_skipped, skipped);
+        } else {
+            k = scan_positions(ps->values, ps->positions, begin, end, &ps->predicate, out);
+        }
+        ps->morsel_worker[m] = worker;
+        ps->morsel_offset[m] = ps->buffer_count[worker];
+        ps->morsel_count[m] = k;
+        ps->buffer_count[worker] += k;
+    }
+}
+
+static void merge_morsels(void* arg, size_t worker) {
+    ParallelSelect* ps = arg;
+    for (size_t m = 0; m < ps->num_morsels; m++) {
+        if (ps->morsel_worker[m] == worker) {
+            memcpy(ps->out + ps->morsel_dest[m], ps->buffers[worker] + ps->morsel_offset[m],
+                   sizeof(int) * ps->morsel_count[m]);
+        }
+    }
+}
+
+static int* parallel_select(const Column* column, const int* values, const int* positions,
+                            size_t length, ScanPredicate* predicate, size_t* num_tuples, size_t* zones_skipped) {
+    size_t num_workers = parallel_pool->num_threads;
+    ParallelSelect ps;
+    ps.column = column;
+    ps.zones_skipped = 0;
+    ps.values = values;
+    ps.positions = positions;
+    ps.length = length;
+    ps.predicate = *predicate;
+    ps.num_morsels = (length + SELECT_MORSEL_SIZE - 1) / SELECT_MORSEL_SIZE;
+    ps.next_morsel = 0;
+    ps.morsel_worker = malloc(sizeof(size_t) * ps.num_morsels);
+    ps.morsel_offset = malloc(sizeof(size_t) * ps.num_morsels);
+    ps.morsel_count = malloc(sizeof(size_t) * ps.num_morsels);
+    ps.morsel_dest = malloc(sizeof(size_t) * ps.num_morsels);
+    ps.buffers = calloc(num_workers, sizeof(int*));
+    ps.buffer_count = calloc(num_workers, sizeof(size_t));
+    ps.buffer_capacity = calloc(num_workers, sizeof(size_t));
+
+    thread_pool_run(parallel_pool, select_morsels, &ps);
+
+    size_t total = 0;
+    for (size_t m = 0; m < ps.num_morsels; m++) {
+        ps.morsel_dest[m] = total;
+        total += ps.morsel_count[m];
+    }
+    ps.out = arena_malloc(sizeof(int) * (total > 0 ? total : 1));
+    thread_pool_run(parallel_pool, merge_morsels, &ps);
+
+    for (size_t w = 0; w < num_workers; w++) {
+        free(ps.buffers[w]);
+    }
+    free(ps.buffers);
+    free(ps.buffer_count);
+    free(ps.buffer_capacity);
+    free(ps.morsel_worker);
+    free(ps.morsel_offset);
+    free(ps.morsel_count);
+    free(ps.morsel_dest);
+    *num_tuples = total;
+    if (zones_skipped != NULL) {
+        *zones_skipped = ps.zones_skipped;
+    }
+    return ps.out;
+}
+
+Result* select_values(const int* values, const int* positions, size_t length, Comparator* comparator) {
+    Result* result = arena_malloc(sizeof(Result));
+    ScanPredicate predicate;
+    make_scan_predicate(comparator, &predicate);
+    result->data_type = INT;
+    result->num_tuples = 0;
+    result->format = POSITION_ARRAY;
+    result->copy = NULL;
+    result->table = NULL;
+    result->version = 0;
+    result->deferred = NULL;
+    if (predicate.kind == SCAN_NONE) {
+        result->payload = NULL;
+        return result;
+    }
+    // short scans are not worth waking up the pool
+    if (parallel_pool != NULL && parallel_pool->num_threads > 1 && length >= PARALLEL_SELECT_THRESHOLD) {
+        result->payload = parallel_select(NULL, values, positions, length, &predicate, &result->num_tuples, NULL);
+        return result;
+    }
+    int* out = arena_malloc(sizeof(int) * (length > 0 ? length : 1));
+    size_t k = scan_positions(values, positions, 0, length, &predicate, out);
+    result->num_tuples = k;
+    result->payload = arena_realloc(out, sizeof(int) * (k > 0 ? k : 1));
+    return result;
+}
+
+/**
+ * bitmap_positions writes the positions first + i of the set bits i of a
+ * bitmap of span bits to out, in order
+ **/
+static size_t bitmap_positions(const uint64_t* bitmap, size_t span, size_t first, int* out) {
+    size_t k = 0;
+    for (size_t w = 0; w < (span + 63) / 64; w++) {
+        uint64_t word = bitmap[w];
+        while (word != 0) {
+            out[k++] = first + w * 64 + __builtin_ctzll(word);
+            word &= word - 1;
+        }
+    }
+    return k;
+}
+
+/**
+ * select_bitmap_rows is select_rows writing a bitmap: bit (i - begin) of
+ * bitmap is set for every qualifying row i in [begin, end)
+ **/
+static size_t select_bitmap_rows(const Column* column, const ScanPredicate* predicate, size_t begin, size_t end,
+                                 uint64_t* bitmap, size_t* zones_skipped) {
+    const ZoneMap* zones = column->zones;
+    const CompressedColumn* compressed = column->compressed;
+    int* encoded = NULL;
+    size_t k = 0;
+    size_t zone_end;
+    for (size_t zone_begin = begin; zone_begin < end; zone_begin = zone_end) {
+        size_t zone = zone_begin / ZONE_SIZE;
+        zone_end = zone_begin + ZONE_SIZE < end ? zone_begin + ZONE_SIZE : end;
+        uint64_t* words = bitmap + (zone_begin - begin) / 64;
+        ZoneMatch match = zones != NULL && zone < zones->num_zones ? zone_match(zones, zone, predicate) : ZONE_SOME;
+        if (match == ZONE_NONE) {
+            memset(words, 0, sizeof(uint64_t) * ((zone_end - zone_begin + 63) / 64));
+            (*zones_skipped)++;
+            continue;
+        }
+        if (match == ZONE_ALL) {
+            ScanPredicate all = { SCAN_ALL, 0, 0 };
+            k += scan_bitmap(column->data, zone_begin, zone_end, &all, words);
+            continue;
+        }
+        if (compressed == NULL || compressed->length <= zone_begin) {
+            k += scan_bitmap(column->data, zone_begin, zone_end, predicate, words);
+            continue;
+        }
+        // the encoded rows report positions, as do the rows appended since
+        // the column was encoded, which are scanned as they are
+        size_t split = compressed->length < zone_end ? compressed->length : zone_end;
+        if (encoded == NULL) {
+            encoded = malloc(sizeof(int) * ZONE_SIZE);
+        }
+        memset(words, 0, sizeof(uint64_t) * ((zone_end - zone_begin + 63) / 64));
+        size_t n = compressed_select(compressed, predicate, zone_begin, split, encoded);
+        n += scan_positions(column->data, NULL, split, zone_end, predicate, encoded + n);
+        for (size_t i = 0; i < n; i++) {
+            size_t bit = encoded[i] - zone_begin;
+            words[bit / 64] |= UINT64_C(1) << (bit % 64);
+        }
+        k += n;
+    }
+    free(encoded);
+    return k;
+}
+
+/**
+ * ParallelBitmap is the state shared by the workers of a parallel select
+ * into a bitmap. Morsels cover whole words, so the workers write disjoint
+ * parts of the bitmap and nothing is merged.
+ **/
+typedef struct ParallelBitmap {
+    const Column* column;
+    ScanPredicate predicate;
+    size_t length;
+    size_t num_morsels;
+    size_t next_morsel;
+    uint64_t* bitmap;
+    size_t count;
+    size_t zones_skipped;
+} ParallelBitmap;
+
+static void bitmap_morsels(void* arg, size_t worker) {
+    (void)worker;
+    ParallelBitmap* pb = arg;
+    size_t count = 0;
+    size_t zones_skipped = 0;
+    size_t m;
+    while ((m = claim_morsel(&pb->next_morsel)) < pb->num_morsels) {
+        size_t begin = m * SELECT_MORSEL_SIZE;
+        size_t end = begin + SELECT_MORSEL_SIZE < pb->length ? begin + SELECT_MORSEL_SIZE : pb->length;
+        count += select_bitmap_rows(pb->column, &pb->predicate, begin, end, pb->bitmap + begin / 64, &zones_skipped);
+    }
+    __sync_fetch_and_add(&pb->count, count);
+    __sync_fetch_and_add(&pb->zones_skipped, zones_skipped);
+}
+
+/**
+ * compact_positions turns the positions of a select into a range if they
+ * are consecutive, and a bitmap into an array if it turned out sparse
+ **/
+static void compact_positions(Result* result) {
+    if (result->num_tuples == 0) {
+        arena_free(result->payload);
+        result->payload = NULL;
+        result->format = POSITION_ARRAY;
+        return;
+    }
+    size_t low;
+    size_t high;
+    if (result->format == POSITION_ARRAY) {
+        const int* positions = result->payload;
+        low = positions[0];
+        high = positions[result->num_tuples - 1];
+    } else {
+        const uint64_t* bitmap = result->payload;
+        size_t w = 0;
+        while (bitmap[w] == 0) {
+            w++;
+        }
+        low = result->first + w * 64 + __builtin_ctzll(bitmap[w]);
+        w = (result->span + 63) / 64 - 1;
+        while (bitmap[w] == 0) {
+            w--;
+        }
+        high = result->first + w * 64 + 63 - __builtin_clzll(bitmap[w]);
+    }
+    if (high - low + 1 == result->num_tuples) {
+        arena_free(result->payload);
+        result->payload = NULL;
+        result->format = POSITION_RANGE;
+        result->first = low;
+        return;
+    }
+    if (result->format == POSITION_BITMAP && result->num_tuples * BITMAP_DENSITY < result->span) {
+        int* out = arena_malloc(sizeof(int) * result->num_tuples);
+        bitmap_positions(result->payload, result->span, result->first, out);
+        arena_free(result->payload);
+        result->payload = out;
+        result->format = POSITION_ARRAY;
+    }
+}
+
+Result* scan_column(const Column* column, size_t length, const ScanPredicate* predicate, size_t estimate,
+                    size_t* zones_skipped) {
+    Result* result = arena_malloc(sizeof(Result));
+    result->data_type = INT;
+    result->num_tuples = 0;
+    result->format = POSITION_ARRAY;
+    result->copy = NULL;
+    result->table = NULL;
+    result->version = 0;
+    result->deferred = NULL;
+    *zones_skipped = 0;
+    if (predicate->kind == SCAN_NONE || length == 0) {
+        result->payload = NULL;
+        return result;
+    }
+    ScanPredicate scan = *predicate;
+    bool parallel = parallel_pool != NULL && parallel_pool->num_threads > 1 && length >= PARALLEL_SELECT_THRESHOLD;
+    if (estimate * BITMAP_DENSITY >= length) {
+        // a bit per row takes less than an int per qualifying row
+        uint64_t* bitmap = arena_malloc(sizeof(uint64_t) * ((length + 63) / 64));
+        result->format = POSITION_BITMAP;
+        result->first = 0;
+        result->span = length;
+        result->payload = bitmap;
+        if (parallel) {
+            ParallelBitmap pb = { column, scan, length, (length + SELECT_MORSEL_SIZE - 1) / SELECT_MORSEL_SIZE,
+                                  0, bitmap, 0, 0 };
+            thread_pool_run(parallel_pool, bitmap_morsels, &pb);
+            result->num_tuples = pb.count;
+            *zones_skipped = pb.zones_skipped;
+        } else {
+            result->num_tuples = select_bitmap_rows(column, &scan, 0, length, bitmap, zones_skipped);
+        }
+    } else if (parallel) {
+        result->payload = parallel_select(column, NULL, NULL, length, &scan, &result->num_tuples, zones_skipped);
+    } else {
+        int* out = arena_malloc(sizeof(int) * length);
+        result->num_tuples = select_rows(column, &scan, 0, length, out, zones_skipped);
+        result->payload = arena_realloc(out, sizeof(int) * (result->num_tuples > 0 ? result->num_tuples : 1));
+    }
+    compact_positions(result);
+    return result;
+}
+
+Result* select_column(Table* table, Column* column, Comparator* comparator, size_t* zones_skipped) {
+    ScanPredicate predicate;
+    make_scan_predicate(comparator, &predicate);
+    size_t estimate = estimate_select(table, column, comparator);
+    Result* result = scan_column(column, table->table_length, &predicate, estimate, zones_skipped);
+    result->table = table;
+    result->version = table->version;
+    return result;
+}
+
+Status check_positions(Table* table, Result* positions) {
+    Status ret_status;
+    ret_status.code = OK;
+    if (positions->table == NULL) {
+        ret_status.code = ERROR;
+        ret_status.error_message = "fetch needs the positions of a select";
+    } else if (positions->table != table) {
+        ret_status.code = ERROR;
+        ret_status.error_message = "positions belong to another table";
+    } else if (positions->version != table->version) {
+        ret_status.code = ERROR;
+        ret_status.error_message = "positions are stale, the rows of the table moved since";
+    }
+    return ret_status;
+}
+
+Status check_select_inputs(Result* values, Result* positions) {
+    Status ret_status;
+    ret_status.code = OK;
+    if (positions->table == NULL || values->num_tuples != positions->num_tuples) {
+        ret_status.code = ERROR;
+        ret_status.error_message = "select inputs must be values with their positions";
+    } else if (positions->version != positions->table->version) {
+        ret_status.code = ERROR;
+        ret_status.error_message = "positions are stale, the rows of the table moved since";
+    }
+    return ret_status;
+}
+
+/**
+ * does a long or float value fall within the bounds of a comparator,
+ * compared in the type of the value
+ **/
+static bool wide_value_qualifies(const Result* values, size_t i, const Comparator* comparator) {
+    bool is_long = values->data_type == LONG;
+    long long_value = is_long ? ((const long*)values->payload)[i] : 0;
+    double float_value = is_long ? 0 : ((const double*)values->payload)[i];
+    switch (comparator->type1) {
+        case GREATER_THAN_OR_EQUAL:
+            if (is_long ? long_value < comparator->p_low : float_value < comparator->p_low) {
+                return false;
+            }
+            break;
+        case GREATER_THAN:
+            if (is_long ? long_value <= comparator->p_low : float_value <= comparator->p_low) {
+                return false;
+            }
+            break;
+        case EQUAL:
+            if (is_long ? long_value != comparator->p_low : float_value != comparator->p_low) {
+                return false;
+            }
+            break;
+        default:
+            break;
+    }
+    switch (comparator->type2) {
+        case LESS_THAN:
+            return is_long ? long_value < comparator->p_high : float_value < comparator->p_high;
+        case LESS_THAN_OR_EQUAL:
+            return is_long ? long_value <= comparator->p_high : float_value <= comparator->p_high;
+        default:
+            return true;
+    }
+}
+
+/**
+ * select over the long values of add and sub or float values, which the
+ * int kernels cannot read
+ **/
+static Result* select_wide_values(const Result* values, const int* positions, Comparator* comparator) {
+    Result* result = arena_malloc(sizeof(Result));
+    result->data_type = INT;
+    result->format = POSITION_ARRAY;
+    result->copy = NULL;
+    result->table = NULL;
+    result->version = 0;
+    result->deferred = NULL;
+    int* out = arena_malloc(sizeof(int) * (values->num_tuples > 0 ? values->num_tuples : 1));
+    size_t k = 0;
+    for (size_t i = 0; i < values->num_tuples; i++) {
+        if (wide_value_qualifies(values, i, comparator)) {
+            out[k++] = positions != NULL ? positions[i] : (int)i;
+        }
+    }
+    result->num_tuples = k;
+    result->payload = arena_realloc(out, sizeof(int) * (k > 0 ? k : 1));
+    return result;
+}
+
+Result* select_positions(Result* values, Result* positions, Comparator* comparator) {
+    // values[i] is the value of the i-th position
+    const int* array = positions->format == POSITION_ARRAY ? positions->payload : NULL;
+    Result* result = values->data_type == INT
+        ? select_values(values->payload, array, values->num_tuples, comparator)
+        : select_wide_values(values, array, comparator);
+    result->copy = positions->copy;
+    result->table = positions->table;
+    result->version = positions->version;
+    if (positions->format == POSITION_ARRAY) {
+        return result;
+    }
+    if (positions->format == POSITION_RANGE) {
+        int* out = result->payload;
+        for (size_t i = 0; i < result->num_tuples; i++) {
+            out[i] += positions->first;
+        }
+        compact_positions(result);
+        return result;
+    }
+    // keep the bits of the qualifying positions
+    const uint64_t* bitmap = positions->payload;
+    size_t num_words = (positions->span + 63) / 64;
+    uint64_t* out = arena_calloc(num_words, sizeof(uint64_t));
+    const int* qualifying = result->payload;
+    size_t j = 0;
+    size_t rank = 0;
+    for (size_t w = 0; w < num_words && j < result->num_tuples; w++) {
+        uint64_t word = bitmap[w];
+        while (word != 0 && j < result->num_tuples) {
+            if ((size_t)qualifying[j] == rank) {
+                out[w] |= word & -word;
+                j++;
+            }
+            rank++;
+            word &= word - 1;
+        }
+    }
+    arena_free(result->payload);
+    result->payload = out;
+    result->format = POSITION_BITMAP;
+    result->first = positions->first;
+    result->span = positions->span;
+    compact_positions(result);
+    return result;
+}
+
+Result* fetch(Table* table, Column* column, Result* positions) {
+    Result* result = arena_malloc(sizeof(Result));
+    int* out = arena_malloc(sizeof(int) * (positions->num_tuples > 0 ? positions->num_tuples : 1));
+    // positions from a clustered copy read the copy of the column
+    const int* data = column->data;
+    if (positions->copy != NULL) {
+        data = positions->copy->columns[column - table->columns].data;
+    }
+    if (positions->format == POSITION_RANGE) {
+        memcpy(out, data + positions->first, positions->num_tuples * sizeof(int));
+    } else if (positions->format == POSITION_BITMAP) {
+        const uint64_t* bitmap = positions->payload;
+        const int* base = data + positions->first;
+        size_t k = 0;
+        for (size_t w = 0; w < (positions->span + 63) / 64; w++) {
+            uint64_t word = bitmap[w];
+            while (word != 0) {
+                out[k++] = base[w * 64 + __builtin_ctzll(word)];
+                word &= word - 1;
+            }
+        }
+    } else {
+        const int* pos = positions->payload;
+        for (size_t i = 0; i < positions->num_tuples; i++) {
+            out[i] = data[pos[i]];
+        }
+    }
+    result->data_type = INT;
+    result->num_tuples = positions->num_tuples;
+    result->payload = out;
+    result->format = POSITION_ARRAY;
+    result->copy = NULL;
+    result->table = NULL;
+    result->version = 0;
+    result->deferred = NULL;
+    return result;
+}
+
+const int* position_array(Result* positions) {
+    if (positions->format == POSITION_RANGE) {
+        int* out = arena_malloc(sizeof(int) * (positions->num_tuples > 0 ? positions->num_tuples : 1));
+        for (size_t i = 0; i < positions->num_tuples; i++) {
+            out[i] = positions->first + i;
+        }
+        positions->payload = out;
+        positions->format = POSITION_ARRAY;
+    } else if (positions->format == POSITION_BITMAP) {
+        int* out = arena_malloc(sizeof(int) * (positions->num_tuples > 0 ? positions->num_tuples : 1));
+        bitmap_positions(positions->payload, positions->span, positions->first, out);
+        arena_free(positions->payload);
+        positions->payload = out;
+        positions->format = POSITION_ARRAY;
+    }
+    return positions->payload;
+}
+
+const char* position_format_name(PositionFormat format) {
+    switch (format) {
+        case POSITION_RANGE:
+            return "range";
+        case POSITION_BITMAP:
+            return "bitmap";
+        default:
+            return "array";
+    }
+}
@@ -0,0 +1,283 @@
+/**
+ * db_sort.c
+ * Radix sorting of int keys and permutations of columns, used to build
+ * indexes and cluster tables.
+ **/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "db_sort.h"
+#include "thread_pool.h"
+
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_PASSES 4
+
+// flipping the sign bit makes unsigned byte order match int order
+static inline size_t digit_of(int key, int pass) {
+    return (((uint32_t)key ^ 0x80000000u) >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1);
+}
+
+/**
+ * SortPass is one digit pass of the parallel sort. Every worker counts,
+ * then scatters, its own contiguous chunk, which keeps the sort stable.
+ * histograms: digit counters per worker, turned into write offsets
+ **/
+typedef struct SortPass {
+    const int* src_keys;
+    const int* src_values;
+    int* dst_keys;
+    int* dst_values;
+    size_t length;
+    int pass;
+    size_t num_workers;
+    size_t* histograms;
+} SortPass;
+
+static void count_digits(void* arg, size_t worker) {
+    SortPass* sort = arg;
+    size_t* histogram = sort->histograms + worker * RADIX_SIZE;
+    size_t begin = sort->length * worker / sort->num_workers;
+    size_t end = sort->length * (worker + 1) / sort->num_workers;
+    memset(histogram, 0, RADIX_SIZE * sizeof(size_t));
+    for (size_t i = begin; i < end; i++) {
+        histogram[digit_of(sort->src_keys[i], sort->pass)]++;
+    }
+}
+
+static void scatter_digits(void* arg, size_t worker) {
+    SortPass* sort = arg;
+    size_t* offsets = sort->histograms + worker * RADIX_SIZE;
+    size_t begin = sort->length * worker / sort->num_workers;
+    size_t end = sort->length * (worker + 1) / sort->num_workers;
+    for (size_t i = begin; i < end; i++) {
+        size_t slot = offsets[digit_of(sort->src_keys[i], sort->pass)]++;
+        sort->dst_keys[slot] = sort->src_keys[i];
+        if (sort->src_values != NULL) {
+            sort->dst_values[slot] = sort->src_values[i];
+        }
+    }
+}
+
+/**
+ * the passes of the parallel sort, which alternate between the input and
+ * the buffers. Returns true if the sorted keys ended up in the buffers.
+ **/
+static bool parallel_sort_passes(int* keys, int* values, int* key_buffer, int* value_buffer,
+                                 size_t length, size_t num_workers) {
+    SortPass sort;
+    sort.src_keys = keys;
+    sort.src_values = values;
+    sort.dst_keys = key_buffer;
+    sort.dst_values = value_buffer;
+    sort.length = length;
+    sort.num_workers = num_workers;
+    sort.histograms = malloc(num_workers * RADIX_SIZE * sizeof(size_t));
+    bool swapped = false;
+    for (sort.pass = 0; sort.pass < RADIX_PASSES; sort.pass++) {
+        run_parallel(count_digits, &sort, num_workers);
+        size_t first_digit = digit_of(sort.src_keys[0], sort.pass);
+        size_t shared = 0;
+        for (size_t w = 0; w < num_workers; w++) {
+            shared += sort.histograms[w * RADIX_SIZE + first_digit];
+        }
+        // a digit shared by every key does not reorder anything
+        if (shared == length) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t d = 0; d < RADIX_SIZE; d++) {
+            for (size_t w = 0; w < num_workers; w++) {
+                size_t count = sort.histograms[w * RADIX_SIZE + d];
+                sort.histograms[w * RADIX_SIZE + d] = offset;
+                offset += count;
+            }
+        }
+        run_parallel(scatter_digits, &sort, num_workers);
+        const int* src_keys = sort.src_keys;
+        const int* src_values = sort.src_values;
+        sort.src_keys = sort.dst_keys;
+        sort.src_values = sort.dst_values;
+        sort.dst_keys = (int*)src_keys;
+        sort.dst_values = (int*)src_values;
+        swapped = !swapped;
+    }
+    free(sort.histograms);
+    return swapped;
+}
+
+/**
+ * the passes of the sequential sort, all digits are counted in one read
+ **/
+static bool sort_passes(int* keys, int* values, int* key_buffer, int* value_buffer, size_t length) {
+    size_t histograms[RADIX_PASSES][RADIX_SIZE];
+    memset(histograms, 0, sizeof(histograms));
+    for (size_t i = 0; i < length; i++) {
+        for (int pass = 0; pass < RADIX_PASSES; pass++) {
+            histograms[pass][digit_of(keys[i], pass)]++;
+        }
+    }
+    int* src_keys = keys;
+    int* src_values = values;
+    int* dst_keys = key_buffer;
+    int* dst_values = value_buffer;
+    bool swapped = false;
+    for (int pass = 0; pass < RADIX_PASSES; pass++) {
+        size_t* histogram = histograms[pass];
+        // a digit shared by every key does not reorder anything
+        if (histogram[digit_of(src_keys[0], pass)] == length) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t d = 0; d < RADIX_SIZE; d++) {
+            size_t count = histogram[d];
+            histogram[d] = offset;
+            offset += count;
+        }
+        for (size_t i = 0; i < length; i++) {
+            size_t slot = histogram[digit_of(src_keys[i], pass)]++;
+            dst_keys[slot] = src_keys[i];
+            if (values != NULL) {
+                dst_values[slot] = src_values[i];
+            }
+        }
+        int* swap = src_keys;
+        src_keys = dst_keys;
+        dst_keys = swap;
+        swap = src_values;
+        src_values = dst_values;
+        dst_values = swap;
+        swapped = !swapped;
+    }
+    return swapped;
+}
+
+void sort_pairs(int* keys, int* values, size_t length) {
+    if (length < 2) {
+        return;
+    }
+    int* key_buffer = malloc(length * sizeof(int));
+    int* value_buffer = values != NULL ? malloc(length * sizeof(int)) : NULL;
+    size_t num_workers = parallel_workers(length, PARALLEL_SORT_THRESHOLD);
+    bool swapped = num_workers > 1
+        ? parallel_sort_passes(keys, values, key_buffer, value_buffer, length, num_workers)
+        : sort_passes(keys, values, key_buffer, value_buffer, length);
+    if (swapped) {
+        memcpy(keys, key_buffer, length * sizeof(int));
+        if (values != NULL) {
+            memcpy(values, value_buffer, length * sizeof(int));
+        }
+    }
+    free(key_buffer);
+    free(value_buffer);
+}
+
+/**
+ * PermutePass applies the two passes of a permutation: workers group
+ * their chunk of src by destination window into dst, then claim windows
+ * and scatter them back.
+ **/
+typedef struct PermutePass {
+    const Permutation* permutation;
+    const int* src;
+    int* dst;
+    size_t next_window;
+} PermutePass;
+
+static void group_chunk(void* arg, size_t worker) {
+    PermutePass* pass = arg;
+    const Permutation* permutation = pass->permutation;
+    size_t begin = permutation->length * worker / permutation->num_workers;
+    size_t end = permutation->length * (worker + 1) / permutation->num_workers;
+    size_t* cursors = malloc(permutation->num_windows * sizeof(size_t));
+    memcpy(cursors, permutation->offsets + worker * permutation->num_windows,
+           permutation->num_windows * sizeof(size_t));
+    for (size_t i = begin; i < end; i++) {
+        pass->dst[cursors[permutation->ranks[i] >> permutation->window_bits]++] = pass->src[i];
+    }
+    free(cursors);
+}
+
+static void scatter_windows(void* arg, size_t worker) {
+    (void)worker;
+    PermutePass* pass = arg;
+    const Permutation* permutation = pass->permutation;
+    size_t w;
+    while ((w = claim_morsel(&pass->next_window)) < permutation->num_windows) {
+        size_t begin = permutation->offsets[w];
+        size_t end = w + 1 < permutation->num_windows ? permutation->offsets[w + 1] : permutation->length;
+        for (size_t k = begin; k < end; k++) {
+            pass->dst[permutation->grouped_ranks[k]] = pass->src[k];
+        }
+    }
+}
+
+static void count_windows(void* arg, size_t worker) {
+    Permutation* permutation = arg;
+    size_t* histogram = permutation->offsets + worker * permutation->num_windows;
+    size_t begin = permutation->length * worker / permutation->num_workers;
+    size_t end = permutation->length * (worker + 1) / permutation->num_workers;
+    memset(histogram, 0, permutation->num_windows * sizeof(size_t));
+    for (size_t i = begin; i < end; i++) {
+        histogram[permutation->ranks[i] >> permutation->window_bits]++;
+    }
+}
+
+Permutation* create_permutation(const int* order, size_t length) {
+    Permutation* permutation = calloc(1, sizeof(Permutation));
+    permutation->length = length;
+    permutation->num_workers = parallel_workers(length, PARALLEL_SORT_THRESHOLD);
+    // a window of destination rows fills half of L2
+    size_t window_rows = l2_cache_size() / 2 / sizeof(int);
+    int window_bits = 0;
+    while (((size_t)2 << window_bits) <= window_rows) {
+        window_bits++;
+    }
+    while ((length >> window_bits) >= PERMUTATION_MAX_FANOUT) {
+        window_bits++;
+    }
+    permutation->window_bits = window_bits;
+    permutation->num_windows = length > 0 ? ((length - 1) >> window_bits) + 1 : 1;
+    size_t size = (length > 0 ? length : 1) * sizeof(int);
+    permutation->ranks = malloc(size);
+    permutation->grouped_ranks = malloc(size);
+    for (size_t i = 0; i < length; i++) {
+        permutation->ranks[order[i]] = i;
+    }
+    permutation->offsets = malloc(permutation->num_workers * permutation->num_windows * sizeof(size_t));
+    run_parallel(count_windows, permutation, permutation->num_workers);
+    size_t offset = 0;
+    for (size_t w = 0; w < permutation->num_windows; w++) {
+        for (size_t k = 0; k < permutation->num_workers; k++) {
+            size_t count = permutation->offsets[k * permutation->num_windows + w];
+            permutation->offsets[k * permutation->num_windows + w] = offset;
+            offset += count;
+        }
+    }
+    PermutePass pass;
+    pass.permutation = permutation;
+    pass.src = permutation->ranks;
+    pass.dst = permutation->grouped_ranks;
+    run_parallel(group_chunk, &pass, permutation->num_workers);
+    return permutation;
+}
+
+void apply_permutation(const Permutation* permutation, int* data, int* buffer) {
+    PermutePass pass;
+    pass.permutation = permutation;
+    pass.src = data;
+    pass.dst = buffer;
+    run_parallel(group_chunk, &pass, permutation->num_workers);
+    pass.src = buffer;
+    pass.dst = data;
+    pass.next_window = 0;
+    run_parallel(scatter_windows, &pass, permutation->num_workers);
+}
+
+void free_permutation(Permutation* permutation) {
+    free(permutation->ranks);
+    free(permutation->grouped_ranks);
+    free(permutation->offsets);
+    free(permutation);
+}
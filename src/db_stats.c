@@ -0,0 +1,201 @@
+/**
+ * db_stats.c
+ * Column statistics and the choice of the access path of selects.
+ **/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "db_select.h"
+#include "db_sort.h"
+#include "db_stats.h"
+
+static inline uint32_t stats_hash(int value) {
+    uint32_t h = (uint32_t)value;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline void sketch_add(uint8_t* sketch, int value) {
+    uint32_t h = stats_hash(value);
+    uint32_t rest = h << STATS_SKETCH_BITS;
+    uint8_t rank = rest == 0 ? 32 - STATS_SKETCH_BITS + 1 : __builtin_clz(rest) + 1;
+    uint8_t* reg = &sketch[h >> (32 - STATS_SKETCH_BITS)];
+    if (rank > *reg) {
+        *reg = rank;
+    }
+}
+
+static size_t sketch_estimate(const uint8_t* sketch) {
+    double m = STATS_SKETCH_SIZE;
+    double sum = 0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < STATS_SKETCH_SIZE; i++) {
+        sum += ldexp(1.0, -sketch[i]);
+        zeros += sketch[i] == 0;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    // linear counting is more accurate for small cardinalities
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / zeros);
+    }
+    return (size_t)(estimate + 0.5);
+}
+
+/**
+ * place the bucket bounds on a sorted sample of the column, every bucket
+ * gets the same share of its values
+ **/
+static void build_stats(ColumnStats* stats, const int* data, size_t length) {
+    memset(stats, 0, sizeof(ColumnStats));
+    stats->count = length;
+    stats->built_count = length;
+    if (length == 0) {
+        return;
+    }
+    stats->min = data[0];
+    stats->max = data[0];
+    for (size_t i = 0; i < length; i++) {
+        stats->min = data[i] < stats->min ? data[i] : stats->min;
+        stats->max = data[i] > stats->max ? data[i] : stats->max;
+        sketch_add(stats->sketch, data[i]);
+    }
+    stats->distinct = sketch_estimate(stats->sketch);
+    size_t sample_size = length < STATS_SAMPLE_SIZE ? length : STATS_SAMPLE_SIZE;
+    int* sample = malloc(sample_size * sizeof(int));
+    for (size_t i = 0; i < sample_size; i++) {
+        sample[i] = data[i * length / sample_size];
+    }
+    sort_pairs(sample, NULL, sample_size);
+    for (size_t b = 0; b < STATS_BUCKETS; b++) {
+        stats->bounds[b] = sample[b * sample_size / STATS_BUCKETS];
+        stats->counts[b] = length * (b + 1) / STATS_BUCKETS - length * b / STATS_BUCKETS;
+    }
+    stats->bounds[0] = stats->min;
+    stats->bounds[STATS_BUCKETS] = stats->max;
+    free(sample);
+}
+
+/**
+ * the last bucket whose lower bound is <= value
+ **/
+static size_t bucket_of_value(const ColumnStats* stats, int value) {
+    size_t low = 0;
+    size_t high = STATS_BUCKETS;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (stats->bounds[mid] <= value) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * add one value to the statistics, the caller estimates the distinct
+ * values again once it added all of them
+ **/
+static void add_value(ColumnStats* stats, int value) {
+    if (stats->count == 0) {
+        build_stats(stats, &value, 1);
+        return;
+    }
+    stats->min = value < stats->min ? value : stats->min;
+    stats->max = value > stats->max ? value : stats->max;
+    stats->bounds[0] = stats->min;
+    stats->bounds[STATS_BUCKETS] = stats->max;
+    stats->counts[bucket_of_value(stats, value)]++;
+    stats->count++;
+    sketch_add(stats->sketch, value);
+}
+
+void update_stats(Table* table, size_t old_length) {
+    for (size_t j = 0; j < table->col_used; j++) {
+        Column* column = &table->columns[j];
+        if (column->stats == NULL) {
+            column->stats = malloc(sizeof(ColumnStats));
+            build_stats(column->stats, column->data, table->table_length);
+            continue;
+        }
+        ColumnStats* stats = column->stats;
+        size_t appended = table->table_length - old_length;
+        if (appended > 0 && stats->count + appended <= 2 * stats->built_count) {
+            for (size_t i = old_length; i < table->table_length; i++) {
+                add_value(stats, column->data[i]);
+            }
+            stats->distinct = sketch_estimate(stats->sketch);
+        } else if (appended > 0) {
+            build_stats(stats, column->data, table->table_length);
+        }
+    }
+}
+
+void free_stats(Table* table) {
+    for (size_t j = 0; j < table->col_used; j++) {
+        free(table->columns[j].stats);
+        table->columns[j].stats = NULL;
+    }
+}
+
+size_t estimate_select(Table* table, Column* column, Comparator* comparator) {
+    int low;
+    int high;
+    if (!comparator_bounds(comparator, &low, &high)) {
+        return 0;
+    }
+    ColumnStats* stats = column->stats;
+    if (stats == NULL) {
+        return table->table_length;
+    }
+    if (stats->count == 0 || high < stats->min || low > stats->max) {
+        return 0;
+    }
+    if (low == high) {
+        return stats->count / (stats->distinct > 0 ? stats->distinct : 1);
+    }
+    double estimate = 0;
+    for (size_t b = 0; b < STATS_BUCKETS; b++) {
+        double lb = stats->bounds[b];
+        double ub = stats->bounds[b + 1];
+        if (high < lb || low > ub) {
+            continue;
+        }
+        // values are assumed uniform inside a bucket
+        double from = low > lb ? low : lb;
+        double to = high < ub ? high : ub;
+        estimate += stats->counts[b] * (to - from + 1) / (ub - lb + 1);
+    }
+    return estimate < stats->count ? (size_t)(estimate + 0.5) : stats->count;
+}
+
+SelectPlan choose_select_plan(Table* table, Column* column, Comparator* comparator, size_t* estimate) {
+    *estimate = estimate_select(table, column, comparator);
+    if (column->index == NULL) {
+        return PLAN_SCAN;
+    }
+    SelectPlan index_plan = column->index_type == SORTED ? PLAN_BINARY_SEARCH : PLAN_BTREE_PROBE;
+    // a clustered column answers with a range, whatever its size
+    if (column->clustered) {
+        return index_plan;
+    }
+    double scan_cost = table->table_length * SCAN_VALUE_COST;
+    double index_cost = *estimate * INDEX_POSITION_COST;
+    return index_cost < scan_cost ? index_plan : PLAN_SCAN;
+}
+
+const char* select_plan_name(SelectPlan plan) {
+    switch (plan) {
+        case PLAN_BINARY_SEARCH:
+            return "binary search";
+        case PLAN_BTREE_PROBE:
+            return "btree probe";
+        default:
+            return "scan";
+    }
+}
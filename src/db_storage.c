@@ -0,0 +1,329 @@
+/**
+ * db_storage.c
+ * Binary, memory-mapped persistence of columns and the database catalog.
+ * Restarting the server only maps the column files, and shutting it down
+ * only writes back the pages that were modified.
+ **/
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "db_storage.h"
+#include "utils_func.h"
+
+#define PATHLEN 256
+
+/**
+ * fixed size records of the catalog file
+ **/
+typedef struct CatalogHeader {
+    unsigned int magic;
+    unsigned int version;
+    char db_name[MAX_SIZE_NAME];
+    size_t tables_size;
+} CatalogHeader;
+
+typedef struct CatalogTable {
+    char name[MAX_SIZE_NAME];
+    char pricls_col[MAX_SIZE_NAME];
+    size_t col_count;
+    size_t col_used;
+    size_t table_length;
+} CatalogTable;
+
+typedef struct CatalogColumn {
+    char name[MAX_SIZE_NAME];
+    int index_type;
+    int clustered;
+} CatalogColumn;
+
+static int ensure_db_dir(void) {
+    if (mkdir(DB_DIR, 0755) == -1 && errno != EEXIST) {
+        log_err("L%d: cannot create directory %s.\n", __LINE__, DB_DIR);
+        return 1;
+    }
+    return 0;
+}
+
+static void column_path(char* path, const char* db_name, const char* tbl_name, const char* col_name) {
+    snprintf(path, PATHLEN, "%s/%s.%s.%s.col", DB_DIR, db_name, tbl_name, col_name);
+}
+
+static size_t mapping_size(size_t capacity) {
+    return COLUMN_HEADER_SIZE + capacity * sizeof(int);
+}
+
+static ColumnFileHeader* column_header(Column* col) {
+    return (ColumnFileHeader*)((char*)col->data - COLUMN_HEADER_SIZE);
+}
+
+/**
+ * map the first capacity values of the open column file into memory,
+ * col is left unchanged if the mapping fails
+ **/
+static int map_column(Column* col, size_t capacity) {
+    void* base = mmap(NULL, mapping_size(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, col->fd, 0);
+    if (base == MAP_FAILED) {
+        log_err("L%d: mmap of column %s failed.\n", __LINE__, col->name);
+        return 1;
+    }
+    col->data = (int*)((char*)base + COLUMN_HEADER_SIZE);
+    col->capacity = capacity;
+    return 0;
+}
+
+int create_column_file(Column* col, const char* db_name, const char* tbl_name) {
+    char path[PATHLEN];
+    if (ensure_db_dir() != 0) {
+        return 1;
+    }
+    column_path(path, db_name, tbl_name, col->name);
+    col->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (col->fd == -1) {
+        log_err("L%d: cannot create column file %s.\n", __LINE__, path);
+        return 1;
+    }
+    if (ftruncate(col->fd, mapping_size(COLUMN_INIT_CAPACITY)) == -1 ||
+        map_column(col, COLUMN_INIT_CAPACITY) != 0) {
+        close(col->fd);
+        col->fd = -1;
+        return 1;
+    }
+    ColumnFileHeader* header = column_header(col);
+    header->magic = COLUMN_FILE_MAGIC;
+    header->version = STORAGE_VERSION;
+    header->length = 0;
+    header->capacity = COLUMN_INIT_CAPACITY;
+    col->dirty = true;
+    return 0;
+}
+
+int open_column_file(Column* col, const char* db_name, const char* tbl_name, size_t length) {
+    char path[PATHLEN];
+    ColumnFileHeader header;
+    column_path(path, db_name, tbl_name, col->name);
+    col->fd = open(path, O_RDWR);
+    if (col->fd == -1) {
+        log_err("L%d: cannot open column file %s.\n", __LINE__, path);
+        return 1;
+    }
+    if (pread(col->fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+        header.magic != COLUMN_FILE_MAGIC || header.version != STORAGE_VERSION ||
+        header.length < length) {
+        log_err("L%d: column file %s is corrupted.\n", __LINE__, path);
+        close(col->fd);
+        col->fd = -1;
+        return 1;
+    }
+    if (map_column(col, header.capacity) != 0) {
+        close(col->fd);
+        col->fd = -1;
+        return 1;
+    }
+    col->dirty = false;
+    return 0;
+}
+
+int reserve_column(Column* col, size_t capacity) {
+    if (capacity <= col->capacity) {
+        return 0;
+    }
+    size_t new_capacity = col->capacity * 2;
+    if (new_capacity < capacity) {
+        new_capacity = capacity;
+    }
+    // pages of a shared mapping stay in the page cache across munmap,
+    // so growing the file never copies the column
+    if (ftruncate(col->fd, mapping_size(new_capacity)) == -1) {
+        log_err("L%d: cannot grow column %s.\n", __LINE__, col->name);
+        return 1;
+    }
+    // the old mapping is released only once the new one exists, a failed
+    // mmap leaves the column as it was
+    ColumnFileHeader* old_header = column_header(col);
+    size_t old_capacity = col->capacity;
+    if (map_column(col, new_capacity) != 0) {
+        if (ftruncate(col->fd, mapping_size(old_capacity)) == -1) {
+            log_err("L%d: cannot shrink column %s back.\n", __LINE__, col->name);
+        }
+        return 1;
+    }
+    munmap(old_header, mapping_size(old_capacity));
+    column_header(col)->capacity = new_capacity;
+    col->dirty = true;
+    return 0;
+}
+
+int sync_column(Column* col, size_t length) {
+    if (col->data == NULL) {
+        return 0;
+    }
+    ColumnFileHeader* header = column_header(col);
+    if (header->length != length) {
+        header->length = length;
+        col->dirty = true;
+    }
+    if (!col->dirty) {
+        return 0;
+    }
+    // msync only writes back the pages that were touched
+    if (msync(header, mapping_size(col->capacity), MS_SYNC) == -1) {
+        log_err("L%d: msync of column %s failed.\n", __LINE__, col->name);
+        return 1;
+    }
+    col->dirty = false;
+    return 0;
+}
+
+void close_column_file(Column* col) {
+    if (col->data != NULL) {
+        munmap(column_header(col), mapping_size(col->capacity));
+        col->data = NULL;
+    }
+    if (col->fd != -1) {
+        close(col->fd);
+        col->fd = -1;
+    }
+    col->capacity = 0;
+}
+
+int write_catalog(Db* db) {
+    char tmp_path[PATHLEN];
+    if (ensure_db_dir() != 0) {
+        return 1;
+    }
+    snprintf(tmp_path, PATHLEN, "%s.tmp", CATALOG_FILE);
+    FILE* fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        log_err("L%d: cannot write catalog %s.\n", __LINE__, tmp_path);
+        return 1;
+    }
+
+    CatalogHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CATALOG_FILE_MAGIC;
+    header.version = CATALOG_VERSION;
+    snprintf(header.db_name, MAX_SIZE_NAME, "%s", db->name);
+    header.tables_size = db->tables_size;
+    fwrite(&header, sizeof(header), 1, fp);
+
+    for (size_t i = 0; i < db->tables_size; i++) {
+        Table* tbl = db->tables[i];
+        CatalogTable record;
+        memset(&record, 0, sizeof(record));
+        snprintf(record.name, MAX_SIZE_NAME, "%s", tbl->name);
+        snprintf(record.pricls_col, MAX_SIZE_NAME, "%s", tbl->pricls_col);
+        record.col_count = tbl->col_count;
+        record.col_used = tbl->col_used;
+        record.table_length = tbl->table_length;
+        fwrite(&record, sizeof(record), 1, fp);
+        for (size_t j = 0; j < tbl->col_used; j++) {
+            CatalogColumn column;
+            memset(&column, 0, sizeof(column));
+            snprintf(column.name, MAX_SIZE_NAME, "%s", tbl->columns[j].name);
+            column.index_type = tbl->columns[j].index_type;
+            column.clustered = tbl->columns[j].clustered;
+            fwrite(&column, sizeof(column), 1, fp);
+        }
+    }
+
+    if (ferror(fp) || fclose(fp) != 0) {
+        log_err("L%d: writing catalog failed.\n", __LINE__);
+        return 1;
+    }
+    // replace the old catalog atomically
+    if (rename(tmp_path, CATALOG_FILE) == -1) {
+        log_err("L%d: cannot replace catalog %s.\n", __LINE__, CATALOG_FILE);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * release a Db read_catalog could not restore entirely
+ **/
+static void free_restored_db(Db* db) {
+    for (size_t i = 0; i < db->tables_size; i++) {
+        Table* tbl = db->tables[i];
+        for (size_t j = 0; j < tbl->col_count; j++) {
+            close_column_file(&tbl->columns[j]);
+        }
+        free(tbl->columns);
+        free(tbl);
+    }
+    free(db->tables);
+    free(db);
+}
+
+int read_catalog(Db** restored) {
+    *restored = NULL;
+    FILE* fp = fopen(CATALOG_FILE, "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+    CatalogHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != CATALOG_FILE_MAGIC || header.version != CATALOG_VERSION) {
+        log_err("L%d: catalog %s is corrupted.\n", __LINE__, CATALOG_FILE);
+        fclose(fp);
+        return 1;
+    }
+
+    Db* db = calloc(1, sizeof(Db));
+    // the names read from a corrupted catalog may not be terminated
+    snprintf(db->name, MAX_SIZE_NAME, "%.*s", MAX_SIZE_NAME - 1, header.db_name);
+    db->tables_capacity = header.tables_size > 0 ? header.tables_size : 1;
+    db->tables = calloc(db->tables_capacity, sizeof(Table*));
+
+    bool failed = false;
+    for (size_t i = 0; i < header.tables_size && !failed; i++) {
+        CatalogTable record;
+        if (fread(&record, sizeof(record), 1, fp) != 1) {
+            log_err("L%d: catalog %s is truncated.\n", __LINE__, CATALOG_FILE);
+            failed = true;
+            break;
+        }
+        Table* tbl = calloc(1, sizeof(Table));
+        db->tables[db->tables_size++] = tbl;
+        snprintf(tbl->name, MAX_SIZE_NAME, "%.*s", MAX_SIZE_NAME - 1, record.name);
+        snprintf(tbl->pricls_col, MAX_SIZE_NAME, "%.*s", MAX_SIZE_NAME - 1, record.pricls_col);
+        tbl->col_count = record.col_count;
+        tbl->col_used = record.col_used;
+        tbl->table_length = record.table_length;
+        tbl->columns = calloc(tbl->col_count, sizeof(Column));
+        for (size_t j = 0; j < tbl->col_count; j++) {
+            tbl->columns[j].fd = -1;
+        }
+        for (size_t j = 0; j < tbl->col_used && !failed; j++) {
+            Column* col = &tbl->columns[j];
+            CatalogColumn column;
+            if (fread(&column, sizeof(column), 1, fp) != 1) {
+                log_err("L%d: catalog of table %s is truncated.\n", __LINE__, tbl->name);
+                failed = true;
+                break;
+            }
+            snprintf(col->name, MAX_SIZE_NAME, "%.*s", MAX_SIZE_NAME - 1, column.name);
+            col->index_type = column.index_type;
+            col->clustered = column.clustered;
+            // a table cannot be served with a column missing
+            if (open_column_file(col, db->name, tbl->name, tbl->table_length) != 0) {
+                log_err("L%d: cannot restore column %s.%s.\n", __LINE__, tbl->name, col->name);
+                failed = true;
+            }
+        }
+    }
+    fclose(fp);
+    if (failed) {
+        free_restored_db(db);
+        return 1;
+    }
+    *restored = db;
+    return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * db_zonemap.c
+ * Per zone min, max and sum of the columns, read by scans to skip or take
+ * whole zones and by aggregates.
+ **/
+#include <stdlib.h>
+
+#include "db_zonemap.h"
+
+static void compute_zone(ZoneMap* zones, size_t zone, const int* data, size_t length) {
+    size_t begin = zone * ZONE_SIZE;
+    size_t end = begin + ZONE_SIZE < length ? begin + ZONE_SIZE : length;
+    int min = data[begin];
+    int max = data[begin];
+    long sum = 0;
+    for (size_t i = begin; i < end; i++) {
+        min = data[i] < min ? data[i] : min;
+        max = data[i] > max ? data[i] : max;
+        sum += data[i];
+    }
+    zones->mins[zone] = min;
+    zones->maxs[zone] = max;
+    zones->sums[zone] = sum;
+}
+
+static void reserve_zones(ZoneMap* zones, size_t num_zones) {
+    if (num_zones <= zones->capacity) {
+        return;
+    }
+    zones->capacity = zones->capacity * 2 > num_zones ? zones->capacity * 2 : num_zones;
+    zones->mins = realloc(zones->mins, zones->capacity * sizeof(int));
+    zones->maxs = realloc(zones->maxs, zones->capacity * sizeof(int));
+    zones->sums = realloc(zones->sums, zones->capacity * sizeof(long));
+}
+
+void update_zone_maps(Table* table, size_t first_row) {
+    size_t length = table->table_length;
+    size_t num_zones = (length + ZONE_SIZE - 1) / ZONE_SIZE;
+    for (size_t j = 0; j < table->col_used; j++) {
+        Column* column = &table->columns[j];
+        size_t first_zone = first_row / ZONE_SIZE;
+        if (column->zones == NULL) {
+            column->zones = calloc(1, sizeof(ZoneMap));
+            first_zone = 0;
+        }
+        ZoneMap* zones = column->zones;
+        reserve_zones(zones, num_zones);
+        if (first_row + 1 == length && first_row % ZONE_SIZE != 0 && first_zone < zones->num_zones) {
+            int value = column->data[first_row];
+            zones->mins[first_zone] = value < zones->mins[first_zone] ? value : zones->mins[first_zone];
+            zones->maxs[first_zone] = value > zones->maxs[first_zone] ? value : zones->maxs[first_zone];
+            zones->sums[first_zone] += value;
+        } else {
+            for (size_t z = first_zone; z < num_zones; z++) {
+                compute_zone(zones, z, column->data, length);
+            }
+        }
+        zones->num_zones = num_zones;
+    }
+}
+
+void free_zone_maps(Table* table) {
+    for (size_t j = 0; j < table->col_used; j++) {
+        ZoneMap* zones = table->columns[j].zones;
+        if (zones != NULL) {
+            free(zones->mins);
+            free(zones->maxs);
+            free(zones->sums);
+            free(zones);
+            table->columns[j].zones = NULL;
+        }
+    }
+}
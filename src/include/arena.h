@@ -0,0 +1,106 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// blocks of up to 2^ARENA_MAX_CLASS bytes are carved out of the chunks
+#define ARENA_MIN_CLASS 5
+#define ARENA_MAX_CLASS 19
+#define ARENA_CLASSES (ARENA_MAX_CLASS - ARENA_MIN_CLASS + 1)
+#define ARENA_CHUNK_SIZE (1 << 21)
+// released large blocks kept for reuse
+#define ARENA_CACHED_LARGE 4
+
+/**
+ * ArenaBlock
+ * The header in front of every block handed out. arena is NULL for a
+ * block allocated while no arena was in use, which is freed on its own.
+ * size_class is the class of a small block, or ARENA_CLASSES for a large
+ * block, which is allocated on its own and linked in the large list.
+ **/
+typedef struct ArenaBlock {
+    struct Arena* arena;
+    size_t size_class;
+    size_t size;
+    struct ArenaBlock* next;
+    struct ArenaBlock* prev;
+    size_t padding;
+} ArenaBlock;
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t used;
+    size_t size;
+    size_t padding;
+} ArenaChunk;
+
+/**
+ * Arena
+ * A region allocator holding the intermediates of one client: results,
+ * their payloads, handles and queued operators.
+ * - Small blocks are bumped out of chunks of ARENA_CHUNK_SIZE bytes in
+ *   power of two classes, and a released block goes to the free list of
+ *   its class, so the results of a handle reassigned in a loop reuse the
+ *   blocks of the results they replace.
+ * - Large blocks are allocated on their own, the last few released ones
+ *   are kept for the next large allocations.
+ * - free_arena releases every chunk and block at once.
+ * in_use counts the bytes of live blocks, high_water its maximum. An arena
+ * is only used by the thread serving its client.
+ **/
+typedef struct Arena {
+    ArenaChunk* chunks;
+    ArenaBlock* free_blocks[ARENA_CLASSES];
+    ArenaBlock* large;
+    ArenaBlock* cached;
+    size_t num_cached;
+    size_t in_use;
+    size_t high_water;
+    size_t reserved;
+    size_t limit;
+} Arena;
+
+/**
+ * create_arena returns an empty arena whose client may hold up to limit
+ * bytes of intermediates, or any amount if limit is 0
+ **/
+Arena* create_arena(size_t limit);
+
+void free_arena(Arena* arena);
+
+/**
+ * use_arena makes arena the one the arena_* functions of the calling
+ * thread allocate from, and returns the one used before. With no arena,
+ * blocks are allocated with malloc.
+ **/
+Arena* use_arena(Arena* arena);
+
+void* arena_malloc(size_t size);
+
+void* arena_calloc(size_t count, size_t size);
+
+/**
+ * arena_realloc resizes a block in place if it still fits its class
+ **/
+void* arena_realloc(void* pointer, size_t size);
+
+/**
+ * arena_free releases a block to the arena it came from, whichever arena
+ * the calling thread uses
+ **/
+void arena_free(void* pointer);
+
+/**
+ * arena_of returns the arena a block came from, NULL for a block allocated
+ * with no arena in use
+ **/
+Arena* arena_of(const void* pointer);
+
+/**
+ * arena_over_limit tells whether the client of an arena holds more than
+ * its limit
+ **/
+bool arena_over_limit(const Arena* arena);
+
+#endif //ARENA_H
@@ -0,0 +1,80 @@
+#ifndef CATALOG_MAP_H
+#define CATALOG_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// slots per group of control bytes, compared with one SSE2 instruction
+#define CATALOG_GROUP 16
+
+/**
+ * CatalogSlot
+ * A key of the map with its hash and value. The key points into the key
+ * arena of the map.
+ **/
+typedef struct CatalogSlot {
+    uint64_t hash;
+    const char* key;
+    size_t length;
+    void* value;
+} CatalogSlot;
+
+/**
+ * KeyChunk
+ * A block of the key arena, keys are copied back to back into the chunks
+ * and live as long as the map
+ **/
+typedef struct KeyChunk {
+    struct KeyChunk* next;
+    size_t used;
+    size_t size;
+    char keys[];
+} KeyChunk;
+
+/**
+ * CatalogMap
+ * An open addressing map from strings to objects in the style of a Swiss
+ * table. Slots are split into groups of CATALOG_GROUP; control[i] is
+ * CONTROL_EMPTY or the low 7 bits of the hash of the key in slot i, so a
+ * probe compares 16 control bytes at once and only reads the slots whose
+ * byte matches. Groups are probed in triangular order from the group the
+ * hash picks, and the map doubles before it is 7/8 full.
+ * Keys are never removed. A lookup does not write to the map, so any
+ * number of threads may look keys up as long as no thread inserts at the
+ * same time.
+ **/
+typedef struct CatalogMap {
+    size_t capacity;
+    size_t count;
+    uint8_t* control;
+    CatalogSlot* slots;
+    KeyChunk* chunks;
+} CatalogMap;
+
+CatalogMap* create_catalog_map(void);
+
+void free_catalog_map(CatalogMap* map);
+
+/**
+ * catalog_get returns the object bound to key, or NULL
+ **/
+void* catalog_get(const CatalogMap* map, const char* key);
+
+/**
+ * catalog_find returns the object bound to the first length bytes of key,
+ * which need not be NUL terminated, or NULL
+ **/
+void* catalog_find(const CatalogMap* map, const char* key, size_t length);
+
+/**
+ * catalog_put binds key to value, replacing the object it was bound to
+ **/
+void catalog_put(CatalogMap* map, const char* key, void* value);
+
+/**
+ * catalog_foreach calls visit on every key and object of the map, in no
+ * particular order
+ **/
+void catalog_foreach(const CatalogMap* map, void (*visit)(const char* key, void* value, void* arg), void* arg);
+
+#endif //CATALOG_MAP_H
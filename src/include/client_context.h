@@ -0,0 +1,46 @@
+#ifndef CLIENT_CONTEXT_H
+#define CLIENT_CONTEXT_H
+
+#include <stdbool.h>
+
+#include "operator.h"
+
+#define MEMORY_LIMIT_MESSAGE "memory limit of the client exceeded, result discarded\n"
+
+// bytes of intermediates a client may hold, 0 for no limit
+extern size_t client_memory_limit;
+
+/**
+ * create_client_context sets up an empty session whose intermediates are
+ * allocated in an arena of its own, released at once with the session
+ **/
+ClientContext* create_client_context(void);
+
+/**
+ * free_client_context releases every result and queued query of a client
+ **/
+void free_client_context(ClientContext* context);
+
+/**
+ * store_result binds result to handle name, replacing (and freeing) the
+ * result previously held by that handle. If the client then holds more
+ * than client_memory_limit bytes, result is freed instead, the handle is
+ * left unbound and false is returned.
+ **/
+bool store_result(ClientContext* context, const char* name, Result* result);
+
+/**
+ * lookup_result returns the result bound to the handle named by the first
+ * length bytes of name, or NULL. A deferred result is returned as it is,
+ * the executor materializes it when the query runs.
+ **/
+Result* lookup_result(ClientContext* context, const char* name, size_t length);
+
+/**
+ * batch_query queues a query until batch_execute()
+ **/
+void batch_query(ClientContext* context, DbOperator* query);
+
+void free_result(Result* result);
+
+#endif //CLIENT_CONTEXT_H
@@ -0,0 +1,49 @@
+#ifndef DB_AGGREGATE_H
+#define DB_AGGREGATE_H
+
+#include <stdbool.h>
+
+#include "db_zonemap.h"
+#include "math_kernels.h"
+#include "operator.h"
+
+// results shorter than this are aggregated or combined on the calling
+// thread only
+#define PARALLEL_MATH_THRESHOLD (1 << 18)
+
+void start_aggregate(Aggregate* aggregate, DataType type);
+
+void merge_aggregate(Aggregate* aggregate, const Aggregate* partial);
+
+/**
+ * aggregate_zone adds the rows of a zone from its synopsis
+ **/
+void aggregate_zone(Aggregate* aggregate, const ZoneMap* zones, size_t zone, size_t rows);
+
+/**
+ * aggregate_value turns an aggregate into a result of one value: sum is a
+ * LONG (a FLOAT over FLOAT values), avg a FLOAT and min and max have the
+ * type of the values. min and max of no values hold no value.
+ **/
+Result* aggregate_value(AggregateType type, const Aggregate* aggregate);
+
+/**
+ * aggregate_result computes min, max, sum or avg over the values of a
+ * result, large results are split among the threads of parallel_pool
+ **/
+Result* aggregate_result(AggregateType type, Result* values);
+
+/**
+ * aggregate_column computes the aggregate over a base column of table,
+ * from the zone map of the column without reading its values
+ **/
+Result* aggregate_column(AggregateType type, Table* table, Column* column);
+
+/**
+ * combine_results returns left + right, or left - right if subtract is
+ * set, value by value. Both results must have the same length. INT values
+ * are widened, the result is a LONG unless one of them is a FLOAT.
+ **/
+Result* combine_results(bool subtract, Result* left, Result* right);
+
+#endif //DB_AGGREGATE_H
@@ -0,0 +1,88 @@
+#ifndef DB_COMPRESS_H
+#define DB_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "db_element.h"
+#include "scan_kernels.h"
+
+// values per bit-packed block: 32 values in each of 4 interleaved lanes,
+// so that one SSE2 shift unpacks a value of every lane
+#define COMPRESS_LANES 4
+#define COMPRESS_BLOCK (32 * COMPRESS_LANES)
+// values unpacked at a time by a scan, the codes stay in L1
+#define COMPRESS_GROUP (8 * COMPRESS_BLOCK)
+// shorter columns are not worth encoding
+#define COMPRESS_MIN_LENGTH 4096
+// largest dictionary of a dictionary encoded column
+#define DICTIONARY_MAX_SIZE (1 << 16)
+
+/**
+ * Encoding
+ * - ENCODING_DICTIONARY: bit-packed codes into a sorted dictionary
+ * - ENCODING_RLE: runs of equal values
+ * - ENCODING_FOR: bit-packed offsets from the smallest value
+ **/
+typedef enum Encoding {
+    ENCODING_DICTIONARY,
+    ENCODING_RLE,
+    ENCODING_FOR
+} Encoding;
+
+/**
+ * CompressedColumn
+ * The encoded form of the first length values of a column, which scans
+ * read instead of the column. Rows appended after it are scanned from the
+ * column itself.
+ * - base: the value of code 0 (frame of reference)
+ * - packed: bit_width bits per code, 4 * bit_width words per block
+ * - dictionary: the distinct values in ascending order, code i is
+ *   dictionary[i]
+ * - run_values, run_ends: run r holds run_values[r] up to row run_ends[r]
+ *   (exclusive)
+ **/
+typedef struct CompressedColumn {
+    Encoding encoding;
+    size_t length;
+    size_t bytes;
+    int base;
+    int bit_width;
+    uint32_t* packed;
+    int* dictionary;
+    size_t dictionary_size;
+    int* run_values;
+    uint32_t* run_ends;
+    size_t num_runs;
+} CompressedColumn;
+
+/**
+ * compress_column encodes length values with the smallest encoding,
+ * distinct estimates the number of distinct values. Returns NULL if no
+ * encoding saves at least a quarter of the column.
+ **/
+CompressedColumn* compress_column(const int* data, size_t length, size_t distinct);
+
+void free_compressed(CompressedColumn* compressed);
+
+/**
+ * compressed_select writes the positions of the encoded values of rows
+ * [begin, end) matching predicate to out, in row order, and returns how
+ * many matched. The predicate is translated to the codes, which are
+ * compared as they are unpacked. begin must be a multiple of
+ * COMPRESS_GROUP and out must hold end - begin values.
+ **/
+size_t compressed_select(const CompressedColumn* compressed, const ScanPredicate* predicate,
+                         size_t begin, size_t end, int* out);
+
+/**
+ * compress_table encodes every column of a table again, drop_compressed
+ * returns the table to dense scans, after its rows moved
+ **/
+void compress_table(Table* table);
+
+void drop_compressed(Table* table);
+
+const char* encoding_name(Encoding encoding);
+
+#endif //DB_COMPRESS_H
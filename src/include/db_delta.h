@@ -0,0 +1,58 @@
+#ifndef DB_DELTA_H
+#define DB_DELTA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "db_element.h"
+#include "message.h"
+
+// rows a delta buffer holds before it is merged into the columns
+#define DELTA_ROWS 4096
+
+/**
+ * DeltaBuffer
+ * The rows inserted into a table since its last merge, kept apart from
+ * its columns. The values of column j are the num_rows ints at
+ * blocks + j * DELTA_ROWS, so that an insert appends to every block and a
+ * merge grows each column and updates its statistics and indexes once for
+ * all the rows.
+ **/
+typedef struct DeltaBuffer {
+    int* blocks;
+    size_t num_rows;
+} DeltaBuffer;
+
+/**
+ * append_delta appends up to num_rows rows to the delta buffer of table,
+ * values holds col_count values per row. Returns the number of rows
+ * appended, fewer than num_rows if the buffer filled up.
+ **/
+size_t append_delta(Table* table, const int* values, size_t num_rows);
+
+/**
+ * delta_full tells whether the delta buffer of table must be merged before
+ * it takes more rows
+ **/
+bool delta_full(const Table* table);
+
+/**
+ * merge_delta appends the rows of the delta buffer of table to its columns
+ * and brings its statistics, clustering, indexes and zone maps up to date
+ **/
+Status merge_delta(Table* table);
+
+/**
+ * merge_deltas merges the delta buffers of every table of db. The rows of
+ * a delta buffer are not visible to queries, which must merge them first.
+ **/
+Status merge_deltas(Db* db);
+
+/**
+ * deltas_pending tells whether rows wait in a delta buffer
+ **/
+bool deltas_pending(void);
+
+void free_delta(Table* table);
+
+#endif //DB_DELTA_H
@@ -1,6 +1,9 @@
 #ifndef ELEMENT_H
 #define ELEMENT_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 // Limits the size of a name in our database to 64 characters
 #define MAX_SIZE_NAME 64
 
@@ -18,15 +21,60 @@ typedef enum DataType {
     FLOAT
 } DataType;
 
+/**
+ * data_type_size returns the width of one value of the type in a payload,
+ * FLOAT values are stored as double
+ **/
+static inline size_t data_type_size(DataType type) {
+    return type == INT ? sizeof(int) : type == LONG ? sizeof(long) : sizeof(double);
+}
+
+/**
+ * IndexType
+ * The kind of index declared on a column, see db_index.h
+ **/
+typedef enum IndexType {
+    NO_INDEX,
+    BTREE,
+    SORTED
+} IndexType;
+
 typedef struct Column {
     char name[MAX_SIZE_NAME];
     int* data;
-    // You will implement column indexes later.
-    void* index;
-    //struct ColumnIndex *index;
-    //bool clustered;
+    // index declared on the column (persisted in the catalog), its
+    // structure in index is built when it is first used
+    IndexType index_type;
+    bool clustered;
+    struct ColumnIndex* index;
+    // statistics of the values, see db_stats.h
+    struct ColumnStats* stats;
+    // encoded form of the values scans read, see db_compress.h
+    struct CompressedColumn* compressed;
+    // min, max and sum of every zone of rows, see db_zonemap.h
+    struct ZoneMap* zones;
+    // file descriptor of the column file, data points into its mapping
+    int fd;
+    // number of values the current mapping can hold
+    size_t capacity;
+    // set when data was modified since the last sync
+    bool dirty;
 } Column;
 
+/**
+ * ClusteredCopy
+ * A full copy of a table sorted on another clustered column than the
+ * principal one, stored in column files of its own.
+ * - key: the index in the table of the column the copy is sorted on
+ * - columns: the copy of every used column of the table, in table order
+ * - next: the next copy of the table
+ **/
+typedef struct ClusteredCopy {
+    size_t key;
+    Column* columns;
+    struct ClusteredCopy* next;
+} ClusteredCopy;
+
 /**
  * Table
  * Defines a table structure, which is composed of multiple columns.
@@ -39,37 +87,73 @@ typedef struct Column {
  * - col_count, the number of columns in the table
  * - col,umns this is the pointer to an array of columns contained in the table.
  * - table_length, the size of the columns in the table.
+ * - col_used, the number of columns created so far (at most col_count)
+ * - pricls_col, the name of the principal clustered column (empty if none)
+ * - copies, the copies of the table for the other clustered columns
+ * - delta, the inserted rows not merged into the columns yet, see db_delta.h
+ * - version, counts the times rows of the table or of its copies moved,
+ *   the positions taken before then are stale
  **/
 typedef struct Table {
     char name [MAX_SIZE_NAME];
     Column *columns;
     size_t col_count;
     size_t table_length;
+    size_t col_used;
+    char pricls_col[MAX_SIZE_NAME];
+    ClusteredCopy* copies;
+    struct DeltaBuffer* delta;
+    size_t version;
 } Table;
 
 /**
  * DB
  * Defines a database structure, which is composed of multiple tables.
  * - name: the name of the associated database.
- * - tables: the pointer to the array of tables contained in the db.
+ * - tables: the tables contained in the db, each allocated on its own so
+ *   that it never moves while the array grows.
  * - tables_size: the size of the array holding table objects
  * - tables_capacity: the amount of pointers that can be held in the currently allocated memory slot
  **/
 typedef struct Db {
     char name[MAX_SIZE_NAME];
-    Table *tables;
+    Table **tables;
     size_t tables_size;
     size_t tables_capacity;
 } Db;
 
+/**
+ * PositionFormat
+ * How a result of positions holds them: an int array in payload, the
+ * num_tuples consecutive positions starting at first, with no payload, or
+ * a bitmap of uint64_t words in payload whose bit i is set if position
+ * first + i is in the result, for i in [0, span).
+ * Positions index the rows of copy, or of the table itself if copy is NULL.
+ * table is the table the positions were taken from, NULL for a result of
+ * values, and version the version of the table they were taken at.
+ **/
+typedef enum PositionFormat {
+    POSITION_ARRAY,
+    POSITION_RANGE,
+    POSITION_BITMAP
+} PositionFormat;
+
 /**
  *  Declares the type of a result column, which includes the number of tuples in the result,
- *  the data type of the result, and a pointer to the result data
+ *  the data type of the result, and a pointer to the result data.
+ *  A result with deferred set is not computed yet, see db_pipeline.h.
  **/
 typedef struct Result {
     size_t num_tuples;
     DataType data_type;
     void *payload;
+    PositionFormat format;
+    size_t first;
+    size_t span;
+    ClusteredCopy* copy;
+    Table* table;
+    size_t version;
+    struct DeferredResult* deferred;
 } Result;
 
 #endif
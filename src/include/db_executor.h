@@ -0,0 +1,29 @@
+#ifndef DB_EXECUTOR_H
+#define DB_EXECUTOR_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "operator.h"
+
+// set once a shutdown command has been executed, by a worker of the
+// request pool while the event loop reads it
+extern atomic_bool server_shutdown;
+
+/**
+ * lock_db takes the database lock around the parsing and execution of a
+ * query: exclusively for queries that change the catalog or the data,
+ * shared for the others
+ **/
+void lock_db(bool exclusive);
+
+void unlock_db(void);
+
+/**
+ * execute_DbOperator executes the query and releases it. Returns the text
+ * to send back to the client, which is owned by the executor, or NULL if
+ * the result has already been streamed to the client (see result_stream.h).
+ **/
+char* execute_DbOperator(DbOperator* query);
+
+#endif //DB_EXECUTOR_H
@@ -0,0 +1,118 @@
+#ifndef DB_INDEX_H
+#define DB_INDEX_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "db_element.h"
+#include "message.h"
+#include "operator.h"
+
+// keys of an inner node: one 64 byte cache line, the last key is padding
+// so that a node has BTREE_NODE_KEYS children and is compared in one go
+#define BTREE_NODE_KEYS 16
+// keys of a leaf, leaves are consecutive runs of one sorted array
+#define BTREE_LEAF_SIZE 64
+// enough inner levels for 2^32 keys
+#define BTREE_MAX_LEVELS 8
+// table name of the column files of a clustered copy, <table>@<column>
+#define COPY_NAME_SIZE (2 * MAX_SIZE_NAME + 2)
+
+/**
+ * BTree
+ * A bulk-loaded main-memory B+-tree. The leaves are the sorted keys array,
+ * cut into runs of BTREE_LEAF_SIZE, so that the next leaf of a range scan
+ * is the next run. Inner nodes only hold keys: key c - 1 of a node is the
+ * smallest key under child c, unused keys are INT_MAX.
+ * keys: the leaves, the column itself for a clustered index
+ * positions: the row of every key, NULL for a clustered index
+ * levels: the inner levels, levels[0] is the root
+ **/
+typedef struct BTree {
+    const int* keys;
+    int* positions;
+    size_t length;
+    size_t num_levels;
+    int* levels[BTREE_MAX_LEVELS];
+    int* owned_keys;
+} BTree;
+
+/**
+ * ColumnIndex
+ * The runtime state of the index of a column. The tree is built by the
+ * first query using it and kept up to date as rows are appended; lock
+ * serializes the builds of concurrent readers.
+ **/
+typedef struct ColumnIndex {
+    pthread_mutex_t lock;
+    BTree* btree;
+} ColumnIndex;
+
+/**
+ * btree_bulk_load builds the inner levels over length sorted keys,
+ * positions[i] is the row of keys[i] (NULL if keys[i] is row i)
+ **/
+BTree* btree_bulk_load(const int* keys, int* positions, size_t length);
+
+/**
+ * sorted_run wraps length sorted keys without inner levels, they are
+ * searched by binary search
+ **/
+BTree* sorted_run(const int* keys, int* positions, size_t length);
+
+/**
+ * btree_lower_bound returns the index of the first key >= key,
+ * btree_upper_bound the index of the first key > key
+ **/
+size_t btree_lower_bound(const BTree* tree, int key);
+
+size_t btree_upper_bound(const BTree* tree, int key);
+
+void free_btree(BTree* tree);
+
+/**
+ * create_index declares an index on column. The first clustered index
+ * becomes the principal clustered column of the table, whose rows are
+ * then kept sorted on it. Every later clustered index gets a full copy
+ * of the table sorted on its column.
+ **/
+Status create_index(Table* table, Column* column, IndexType type, bool clustered);
+
+/**
+ * open_indexes creates the runtime state of the indexes declared on the
+ * columns of a table restored from disk and maps its clustered copies
+ **/
+void open_indexes(Table* table);
+
+/**
+ * update_indexes must be called once rows were appended to a table that
+ * had old_length rows: it appends them to the clustered copies and merges
+ * them into the order of every copy, then merges them into the trees built
+ * so far and the zone maps from the first row that moved, nothing is
+ * sorted or built again from scratch.
+ **/
+Status update_indexes(Table* table, size_t old_length);
+
+/**
+ * sync_indexes writes the clustered copies of a table back to their
+ * files. Returns 0 on success.
+ **/
+int sync_indexes(Table* table);
+
+void close_indexes(Table* table);
+
+/**
+ * column_copy returns the clustered copy of table sorted on column, NULL
+ * if there is none
+ **/
+ClusteredCopy* column_copy(Table* table, Column* column);
+
+/**
+ * index_select answers a select on an indexed column, the positions are
+ * in ascending order like the ones of a scan. A clustered column answers
+ * with a range of positions.
+ **/
+Result* index_select(Table* table, Column* column, Comparator* comparator);
+
+#endif //DB_INDEX_H
@@ -0,0 +1,78 @@
+#ifndef DB_JOIN_H
+#define DB_JOIN_H
+
+#include "message.h"
+#include "operator.h"
+
+// bits of the largest fan-out of one partitioning pass, more partitions
+// than this would thrash the TLB while scattering
+#define JOIN_MAX_RADIX_BITS 8
+// build side bytes per tuple: the tuple, its chain link and its bucket
+#define JOIN_BUILD_TUPLE_SIZE 16
+// joins of fewer tuples run on the calling thread only
+#define PARALLEL_JOIN_THRESHOLD (1 << 16)
+
+// values of an inner tile of the nested-loop join, 16KB stay in L1
+#define NESTED_LOOP_INNER_TILE 4096
+// rows of an outer tile, the unit of work a thread claims
+#define NESTED_LOOP_OUTER_TILE 256
+// nested-loop joins of fewer comparisons run on the calling thread only
+#define PARALLEL_NESTED_LOOP_THRESHOLD (1 << 22)
+
+// memory budget of join(...,grace) when none is given
+#define GRACE_DEFAULT_BUDGET (64 << 20)
+// bounds of the write buffer of a spill file, a partitioning pass keeps
+// one per partition of the side it spills, sized to fit in the budget
+#define GRACE_MIN_BUFFER_SIZE 4096
+#define GRACE_MAX_BUFFER_SIZE (64 * 1024)
+#define GRACE_MAX_FANOUT 64
+// levels of repartitioning, deeper partitions (e.g. one heavy key) are
+// joined in memory regardless of the budget
+#define GRACE_MAX_DEPTH 4
+// tuples read at a time while partitioning or probing
+#define GRACE_CHUNK_SIZE 4096
+
+/**
+ * JoinStats reports the work of a grace hash join
+ * num_partitions: partitions spilled to temp files, over all levels
+ * spilled_bytes: bytes written to temp files
+ * max_depth: levels of partitioning, 0 if the input fit in the budget
+ **/
+typedef struct JoinStats {
+    size_t num_partitions;
+    size_t spilled_bytes;
+    size_t max_depth;
+} JoinStats;
+
+/**
+ * hash_join is an equi-join of values1 and values2 (INT results, aligned
+ * with positions1 and positions2). Both inputs are radix-partitioned on
+ * the hash of the key, in one or two passes, until a partition of
+ * values2 and its hash table fit in half of L2. Partitions are then built
+ * (values2) and probed (values1) in parallel on parallel_pool.
+ * out1 and out2 receive the positions of the matching pairs, ordered by
+ * the position in values1 and then in values2.
+ **/
+Status hash_join(Result* values1, Result* positions1, Result* values2, Result* positions2,
+                 Result** out1, Result** out2);
+
+/**
+ * nested_loop_join is the block nested-loop version of hash_join, with the
+ * same inputs and output. Outer tiles are claimed by the threads of
+ * parallel_pool, and every outer row is compared with one inner tile at a
+ * time by the SIMD scan kernels, so the inner tile stays in L1.
+ **/
+Status nested_loop_join(Result* values1, Result* positions1, Result* values2, Result* positions2,
+                        Result** out1, Result** out2);
+
+/**
+ * grace_hash_join is the hash join of hash_join, for inputs whose hash
+ * table does not fit in memory_budget bytes. Both inputs are partitioned
+ * into temp files and joined partition by partition, partitions whose build
+ * side is still too large are repartitioned recursively on another hash.
+ * The output is the same as the one of hash_join.
+ **/
+Status grace_hash_join(Result* values1, Result* positions1, Result* values2, Result* positions2,
+                       size_t memory_budget, Result** out1, Result** out2, JoinStats* stats);
+
+#endif //DB_JOIN_H
@@ -0,0 +1,17 @@
+#ifndef DB_LOADER_H
+#define DB_LOADER_H
+
+#include "message.h"
+
+// files smaller than this are parsed by a single thread
+#define LOAD_MIN_CHUNK_SIZE (1 << 20)
+
+/**
+ * load_csv bulk loads a csv data file whose header names the columns
+ * (e.g. "db1.tbl1.col1,db1.tbl1.col2"). The file is mmap-ed, split into
+ * newline-aligned chunks and parsed in parallel, on the threads of the
+ * parallel pool, straight into the column mappings. The ingestion throughput is logged at the end of the load.
+ **/
+Status load_csv(const char* file_name);
+
+#endif //DB_LOADER_H
@@ -1,6 +1,68 @@
 #ifndef DB_MANAGER_H
 #define DB_MANAGER_H
 
+#include "db_element.h"
+#include "message.h"
+
+// In this class, there will always be only one active database at a time
+extern Db* current_db;
+
 Db* create_db(char* db_name);
 
-#endif //DB_MANAGER_H
\ No newline at end of file
+Table* create_table(Db* db, const char* name, size_t num_columns, Status *ret_status);
+
+Column* create_column(Table* table, const char* name, Status *ret_status);
+
+/**
+ * lookup_table finds a table by its full name, e.g. "db1.tbl1"
+ **/
+Table* lookup_table(char* name);
+
+/**
+ * lookup_column finds a column by its full name, e.g. "db1.tbl1.col1"
+ **/
+Column* lookup_column(char* name);
+
+/**
+ * lookup_column_table returns the table a column belongs to
+ **/
+Table* lookup_column_table(char* name);
+
+/**
+ * resolve_table finds a table by the first length bytes of name, which
+ * need not be NUL terminated
+ **/
+Table* resolve_table(const char* name, size_t length);
+
+/**
+ * resolve_column finds a column and its table by the first length bytes of
+ * name, e.g. "db1.tbl1.col1" inside a command, without copying the name.
+ * Returns NULL if either is not in the catalog.
+ **/
+Column* resolve_column(const char* name, size_t length, Table** table);
+
+/**
+ * relational_insert inserts num_rows rows, values holds one value per
+ * column for each row in turn. The rows go to the delta buffer of the
+ * table, which is merged into the columns whenever it fills, see db_delta.h.
+ **/
+Status relational_insert(Table* table, const int* values, size_t num_rows);
+
+/**
+ * load_db restores the database from the catalog on disk, if any. It fails
+ * if the catalog or one of its column files cannot be read.
+ **/
+Status load_db(void);
+
+/**
+ * sync_db merges the inserted rows, flushes dirty column pages and writes
+ * the catalog
+ **/
+Status sync_db(Db* db);
+
+/**
+ * shutdown_db syncs the current database and releases it
+ **/
+Status shutdown_db(void);
+
+#endif //DB_MANAGER_H
@@ -0,0 +1,72 @@
+#ifndef DB_PIPELINE_H
+#define DB_PIPELINE_H
+
+#include <stddef.h>
+
+#include "operator.h"
+#include "scan_kernels.h"
+
+/**
+ * DeferredResult
+ * The plan of a result that is not computed yet: the positions of the
+ * qualifying rows among the first length rows of table, a scan of
+ * select_column, or the values of fetch_column at those positions if
+ * fetch_column is not NULL. An aggregate over deferred values runs the
+ * select, the fetch and the aggregate in one pass over blocks of rows,
+ * other operators have the result materialized first.
+ * Deferred results are registered, so that they are materialized before
+ * the rows of their table move. estimate is the number of rows the select
+ * is expected to qualify, it picks the form of the positions. table and
+ * the columns are held across queries, they rely on tables never moving
+ * once created (see create_table).
+ **/
+typedef struct DeferredResult {
+    Table* table;
+    Column* select_column;
+    ScanPredicate predicate;
+    size_t length;
+    size_t estimate;
+    Column* fetch_column;
+    Result* result;
+    struct DeferredResult* prev;
+    struct DeferredResult* next;
+} DeferredResult;
+
+/**
+ * defer_select returns the deferred positions of a scan of a base column
+ * of table, expected to select estimate rows
+ **/
+Result* defer_select(Table* table, Column* column, Comparator* comparator, size_t estimate);
+
+/**
+ * defer_fetch returns the deferred values of a base column at deferred
+ * positions
+ **/
+Result* defer_fetch(Column* column, Result* positions);
+
+/**
+ * materialize computes a deferred result in place, other results are left
+ * as they are
+ **/
+void materialize(Result* result);
+
+/**
+ * materialize_table computes every deferred result over table, it must be
+ * called with the database held exclusively before rows of table move
+ **/
+void materialize_table(Table* table);
+
+/**
+ * discard_deferred unregisters a deferred result about to be freed
+ **/
+void discard_deferred(Result* result);
+
+/**
+ * pipeline_aggregate computes an aggregate over deferred values without
+ * materializing them or their positions. Blocks of rows are selected,
+ * gathered and aggregated while they are in cache; blocks whose rows all
+ * qualify are aggregated from the zone map of the fetched column.
+ **/
+Result* pipeline_aggregate(AggregateType type, Result* values);
+
+#endif //DB_PIPELINE_H
@@ -0,0 +1,95 @@
+#ifndef DB_SELECT_H
+#define DB_SELECT_H
+
+#include <stdbool.h>
+
+#include "message.h"
+#include "operator.h"
+#include "scan_kernels.h"
+
+// values per morsel claimed by a worker of a parallel select
+#define SELECT_MORSEL_SIZE (1 << 14)
+// selects over fewer values run on the calling thread only
+#define PARALLEL_SELECT_THRESHOLD (1 << 18)
+// a scan expected to select at least one row in this many reports a bitmap
+#define BITMAP_DENSITY 32
+
+/**
+ * comparator_bounds turns the two comparisons of a comparator into one
+ * inclusive [low, high] range over int values.
+ * Returns false if no int value can qualify.
+ **/
+bool comparator_bounds(Comparator* comparator, int* low, int* high);
+
+/**
+ * select_values scans length values and returns the positions of the
+ * qualifying ones. If positions is not NULL, positions[i] is reported
+ * for values[i] instead of i. Large inputs are scanned in parallel on
+ * parallel_pool, the positions stay in row order.
+ **/
+Result* select_values(const int* values, const int* positions, size_t length, Comparator* comparator);
+
+/**
+ * select_rows writes the positions of the qualifying rows [begin, end) of
+ * a base column to out, zone by zone: zones the zone map rules out are
+ * skipped and counted in zones_skipped, zones that qualify whole are taken
+ * without a compare, the others are scanned from the encoded form or the
+ * values. begin must be a multiple of ZONE_SIZE and out must hold
+ * end - begin values.
+ **/
+size_t select_rows(const Column* column, const ScanPredicate* predicate, size_t begin, size_t end,
+                   int* out, size_t* zones_skipped);
+
+/**
+ * scan_column selects the qualifying rows among the first length rows of
+ * a base column, in parallel if they are many. The positions are reported
+ * in the smallest form: a bitmap if estimate rows are expected to qualify
+ * and they are dense enough, otherwise an array, and a range whenever the
+ * qualifying rows turn out consecutive.
+ **/
+Result* scan_column(const Column* column, size_t length, const ScanPredicate* predicate, size_t estimate,
+                    size_t* zones_skipped);
+
+/**
+ * select_column scans a base column of table, through its encoded form
+ * if it has one. Zones of rows ruled out by the zone map of the column
+ * are not read, zones_skipped receives their number.
+ **/
+Result* select_column(Table* table, Column* column, Comparator* comparator, size_t* zones_skipped);
+
+/**
+ * check_positions tells whether positions can be read with the columns of
+ * table: they must be a result of positions taken from table since its
+ * rows last moved
+ **/
+Status check_positions(Table* table, Result* positions);
+
+/**
+ * check_select_inputs tells whether values and positions can be selected
+ * on: one value per position, positions that are not stale
+ **/
+Status check_select_inputs(Result* values, Result* positions);
+
+/**
+ * select_positions scans values fetched at positions and returns the
+ * positions of the qualifying ones, a bitmap of positions is refined into
+ * a bitmap over the same rows. Long and float values, e.g. the sums of an
+ * add, are compared in their own type.
+ **/
+Result* select_positions(Result* values, Result* positions, Comparator* comparator);
+
+/**
+ * fetch gathers the values of a column of table at the given positions,
+ * from the clustered copy the positions refer to if any
+ **/
+Result* fetch(Table* table, Column* column, Result* positions);
+
+/**
+ * position_array turns a range or a bitmap of positions into an array in
+ * place, for the operators that only read arrays, and returns the array
+ **/
+const int* position_array(Result* positions);
+
+const char* position_format_name(PositionFormat format);
+
+#endif //DB_SELECT_H
@@ -0,0 +1,53 @@
+#ifndef DB_SORT_H
+#define DB_SORT_H
+
+#include <stddef.h>
+
+// sorts of fewer keys run on the calling thread only
+#define PARALLEL_SORT_THRESHOLD (1 << 16)
+// most write streams of the first pass of a permutation
+#define PERMUTATION_MAX_FANOUT 1024
+
+/**
+ * sort_pairs sorts length int keys in ascending order with an LSD radix
+ * sort, moving values[i] along with keys[i] (values may be NULL). The
+ * sort is stable, equal keys keep the order of their values. Large
+ * inputs are sorted in parallel on parallel_pool.
+ **/
+void sort_pairs(int* keys, int* values, size_t length);
+
+/**
+ * Permutation
+ * A reordering of rows, applied to columns in two cache-friendly passes
+ * instead of one random gather. The destination rows are cut into windows
+ * that fit in L2. The first pass streams a column into a buffer grouped by
+ * destination window, the second scatters every group within its window.
+ * ranks: the destination of every source row
+ * grouped_ranks: the ranks in the order of the buffer
+ * offsets: first buffer slot of every (worker, window), workers scatter
+ * their own contiguous chunk of the source rows
+ **/
+typedef struct Permutation {
+    size_t length;
+    int window_bits;
+    size_t num_windows;
+    size_t num_workers;
+    int* ranks;
+    int* grouped_ranks;
+    size_t* offsets;
+} Permutation;
+
+/**
+ * create_permutation prepares the reordering putting row order[i] at
+ * row i, for i < length
+ **/
+Permutation* create_permutation(const int* order, size_t length);
+
+/**
+ * apply_permutation reorders data in place, buffer holds length ints
+ **/
+void apply_permutation(const Permutation* permutation, int* data, int* buffer);
+
+void free_permutation(Permutation* permutation);
+
+#endif //DB_SORT_H
@@ -0,0 +1,78 @@
+#ifndef DB_STATS_H
+#define DB_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "db_element.h"
+#include "operator.h"
+
+// buckets of the equi-depth histogram of a column
+#define STATS_BUCKETS 64
+// most values sampled to place the bucket bounds
+#define STATS_SAMPLE_SIZE (1 << 14)
+// registers of the distinct count sketch (HyperLogLog), a power of two
+#define STATS_SKETCH_BITS 10
+#define STATS_SKETCH_SIZE (1 << STATS_SKETCH_BITS)
+// relative costs of the select plans, per value scanned and per position
+// read through an unclustered index (random access and sort)
+#define SCAN_VALUE_COST 1.0
+#define INDEX_POSITION_COST 12.0
+
+/**
+ * ColumnStats
+ * Statistics of the values of a column, built by load and kept up to date
+ * by inserts.
+ * - bounds: bucket b of the histogram holds the values in
+ *   [bounds[b], bounds[b + 1]], about counts[b] of them
+ * - sketch: HyperLogLog registers estimating the distinct count
+ * - built_count: count when the bounds were placed, the histogram is
+ *   rebuilt once the column has doubled since
+ **/
+typedef struct ColumnStats {
+    int min;
+    int max;
+    size_t count;
+    size_t distinct;
+    int bounds[STATS_BUCKETS + 1];
+    size_t counts[STATS_BUCKETS];
+    uint8_t sketch[STATS_SKETCH_SIZE];
+    size_t built_count;
+} ColumnStats;
+
+/**
+ * SelectPlan
+ * The access paths of a select on a base column
+ **/
+typedef enum SelectPlan {
+    PLAN_SCAN,
+    PLAN_BINARY_SEARCH,
+    PLAN_BTREE_PROBE
+} SelectPlan;
+
+/**
+ * update_stats must be called once rows were appended to a table that had
+ * old_length rows, before they are moved by clustering. The appended rows
+ * are added to the statistics in place until the column has doubled since
+ * they were built, then they are rebuilt. Columns without statistics get
+ * them built.
+ **/
+void update_stats(Table* table, size_t old_length);
+
+void free_stats(Table* table);
+
+/**
+ * estimate_select estimates the number of values of a column matching a
+ * comparator from its statistics
+ **/
+size_t estimate_select(Table* table, Column* column, Comparator* comparator);
+
+/**
+ * choose_select_plan picks the cheapest access path of a select on a base
+ * column, estimate receives the estimated number of matching values
+ **/
+SelectPlan choose_select_plan(Table* table, Column* column, Comparator* comparator, size_t* estimate);
+
+const char* select_plan_name(SelectPlan plan);
+
+#endif //DB_STATS_H
@@ -0,0 +1,76 @@
+#ifndef DB_STORAGE_H
+#define DB_STORAGE_H
+
+#include "db_element.h"
+
+/**
+ * On-disk layout
+ * Every column lives in its own binary file "<db>.<tbl>.<col>.col" under
+ * DB_DIR. The file starts with a ColumnFileHeader padded to one page,
+ * followed by a raw int array, so the file can be mmap-ed and Column.data
+ * points straight into the mapping.
+ * The Db/Table metadata is kept in a small binary catalog (CATALOG_FILE).
+ **/
+#define DB_DIR "db"
+#define CATALOG_FILE DB_DIR "/coldb.catalog"
+
+#define COLUMN_FILE_MAGIC 0x434f4c44
+#define CATALOG_FILE_MAGIC 0x43415444
+#define STORAGE_VERSION 1
+// version 2 records the index declared on every column
+#define CATALOG_VERSION 2
+
+// the header takes a full page so that the data array is page aligned
+#define COLUMN_HEADER_SIZE 4096
+// initial number of values reserved for a new column file
+#define COLUMN_INIT_CAPACITY 1024
+
+typedef struct ColumnFileHeader {
+    unsigned int magic;
+    unsigned int version;
+    size_t length;
+    size_t capacity;
+} ColumnFileHeader;
+
+/**
+ * create_column_file creates (or truncates) the file of a column and maps it.
+ * Returns 0 on success.
+ **/
+int create_column_file(Column* col, const char* db_name, const char* tbl_name);
+
+/**
+ * open_column_file maps an existing column file, checking that it holds at
+ * least length values. Returns 0 on success.
+ **/
+int open_column_file(Column* col, const char* db_name, const char* tbl_name, size_t length);
+
+/**
+ * reserve_column makes room for at least capacity values in the mapping.
+ * Returns 0 on success.
+ **/
+int reserve_column(Column* col, size_t capacity);
+
+/**
+ * sync_column records length in the file header and flushes the dirty pages
+ * of the mapping.
+ **/
+int sync_column(Column* col, size_t length);
+
+/**
+ * close_column_file unmaps the column and closes its file
+ **/
+void close_column_file(Column* col);
+
+/**
+ * write_catalog stores the Db/Table/Column metadata of db into CATALOG_FILE
+ **/
+int write_catalog(Db* db);
+
+/**
+ * read_catalog rebuilds the Db from CATALOG_FILE and maps every column file
+ * into restored, which is NULL if there is no catalog on disk. Returns 0 on
+ * success, 1 if the catalog is corrupted or a column file cannot be mapped.
+ **/
+int read_catalog(Db** restored);
+
+#endif //DB_STORAGE_H
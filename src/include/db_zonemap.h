@@ -0,0 +1,70 @@
+#ifndef DB_ZONEMAP_H
+#define DB_ZONEMAP_H
+
+#include <stddef.h>
+
+#include "db_element.h"
+#include "scan_kernels.h"
+
+// rows per zone, a multiple of the compression group so that scans of a
+// zone can start in the encoded form
+#define ZONE_SIZE 8192
+
+/**
+ * ZoneMap
+ * A synopsis of a column per zone of ZONE_SIZE rows: zone z covers rows
+ * [z * ZONE_SIZE, (z + 1) * ZONE_SIZE) and holds values in
+ * [mins[z], maxs[z]] whose sum is sums[z]. The last zone may be partial.
+ **/
+typedef struct ZoneMap {
+    size_t num_zones;
+    size_t capacity;
+    int* mins;
+    int* maxs;
+    long* sums;
+} ZoneMap;
+
+/**
+ * ZoneMatch
+ * How a predicate relates to the values of a zone
+ * - ZONE_NONE: no value of the zone qualifies, the zone is skipped
+ * - ZONE_ALL: every value qualifies, its rows are taken without a compare
+ * - ZONE_SOME: the zone is scanned
+ **/
+typedef enum ZoneMatch {
+    ZONE_NONE,
+    ZONE_SOME,
+    ZONE_ALL
+} ZoneMatch;
+
+static inline ZoneMatch zone_match(const ZoneMap* zones, size_t zone, const ScanPredicate* predicate) {
+    int min = zones->mins[zone];
+    int max = zones->maxs[zone];
+    switch (predicate->kind) {
+        case SCAN_NONE:
+            return ZONE_NONE;
+        case SCAN_ALL:
+            return ZONE_ALL;
+        case SCAN_LOWER:
+            return max < predicate->low ? ZONE_NONE : min >= predicate->low ? ZONE_ALL : ZONE_SOME;
+        case SCAN_UPPER:
+            return min > predicate->high ? ZONE_NONE : max <= predicate->high ? ZONE_ALL : ZONE_SOME;
+        default:
+            if (max < predicate->low || min > predicate->high) {
+                return ZONE_NONE;
+            }
+            return min >= predicate->low && max <= predicate->high ? ZONE_ALL : ZONE_SOME;
+    }
+}
+
+/**
+ * update_zone_maps must be called once the rows of a table from first_row
+ * on were appended or moved. The zones from the one holding first_row on
+ * are computed again, a row appended to a partial zone is added in place.
+ * Columns without a zone map get one built.
+ **/
+void update_zone_maps(Table* table, size_t first_row);
+
+void free_zone_maps(Table* table);
+
+#endif //DB_ZONEMAP_H
@@ -0,0 +1,54 @@
+#ifndef MATH_KERNELS_H
+#define MATH_KERNELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "db_element.h"
+
+/**
+ * Aggregate
+ * Accumulates min, max, sum and count of values of type, in the long
+ * fields for INT and LONG values and in the float_ fields for FLOAT
+ * values. INT values are summed in 64 bit lanes, so that their sum does
+ * not overflow. Partial aggregates of parts of the values are merged.
+ **/
+typedef struct Aggregate {
+    DataType type;
+    long min;
+    long max;
+    long sum;
+    double float_min;
+    double float_max;
+    double float_sum;
+    size_t count;
+} Aggregate;
+
+/**
+ * combined_type is the type of the sum or difference of two values: FLOAT
+ * if either is FLOAT, otherwise LONG, which holds any sum of two INT
+ **/
+DataType combined_type(DataType left_type, DataType right_type);
+
+/**
+ * combine_values writes left[i] + right[i], or left[i] - right[i] if
+ * subtract is set, for i in [begin, end) to out, of type
+ * combined_type(left_type, right_type). The kernels convert the inputs in
+ * vector lanes, 4 per AVX2 instruction; the instruction set is picked at
+ * runtime, with a scalar fallback.
+ **/
+void combine_values(const void* left, DataType left_type, const void* right, DataType right_type,
+                    bool subtract, void* out, size_t begin, size_t end);
+
+/**
+ * aggregate_values adds values[begin, end) of type aggregate->type
+ **/
+void aggregate_values(Aggregate* aggregate, const void* values, size_t begin, size_t end);
+
+/**
+ * aggregate_gather adds the INT values data[positions[i]], gathered 8 at
+ * a time with AVX2
+ **/
+void aggregate_gather(Aggregate* aggregate, const int* data, const int* positions, size_t length);
+
+#endif //MATH_KERNELS_H
@@ -1,49 +1,79 @@
-#ifndef MESSAGE_H
-#define MESSAGE_H
-
-/**
- * Error codes used to indicate the outcome of an API call
- **/
-typedef enum StatusCode {
-    /* The operation completed successfully */
-    OK,
-    /* There was an error with the call. */
-    ERROR,
-} StatusCode;
-
-/**
- * status declares an error code and associated message
- */
-typedef struct Status {
-    StatusCode code;
-    char* error_message;
-} Status;
-
-/**
- * mesage_status defines the status of the previous request.
- **/
-typedef enum message_status {
-    OK_DONE,
-    OK_WAIT_FOR_RESPONSE,
-    UNKNOWN_COMMAND,
-    QUERY_UNSUPPORTED,
-    OBJECT_ALREADY_EXISTS,
-    OBJECT_NOT_FOUND,
-    INCORRECT_FORMAT, 
-    EXECUTION_ERROR,
-    INCORRECT_FILE_FORMAT,
-    FILE_NOT_FOUND,
-    INDEX_ALREADY_EXISTS
-} message_status;
-
-// message is a single packet of information sent between client/server.
-// message_status: defines the status of the message.
-// length: defines the length of the string message to be sent.
-// payload: defines the payload of the message.
-typedef struct message {
-    message_status status;
-    int length;
-    char* payload;
-} message;
-
-#endif
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+/**
+ * Error codes used to indicate the outcome of an API call
+ **/
+typedef enum StatusCode {
+    /* The operation completed successfully */
+    OK,
+    /* There was an error with the call. */
+    ERROR,
+} StatusCode;
+
+/**
+ * status declares an error code and associated message
+ */
+typedef struct Status {
+    StatusCode code;
+    char* error_message;
+} Status;
+
+/**
+ * mesage_status defines the status of the previous request.
+ **/
+typedef enum message_status {
+    OK_DONE,
+    OK_WAIT_FOR_RESPONSE,
+    OK_STREAM_RESPONSE,
+    UNKNOWN_COMMAND,
+    QUERY_UNSUPPORTED,
+    OBJECT_ALREADY_EXISTS,
+    OBJECT_NOT_FOUND,
+    INCORRECT_FORMAT, 
+    EXECUTION_ERROR,
+    INCORRECT_FILE_FORMAT,
+    FILE_NOT_FOUND,
+    INDEX_ALREADY_EXISTS
+} message_status;
+
+// message is a single packet of information sent between client/server.
+// message_status: defines the status of the message.
+// flags: options of the connection, see MESSAGE_BINARY_RESULTS.
+// length: defines the length of the string message to be sent.
+// sequence: numbers the queries of a client from 0, a response carries the
+// sequence of the query it answers.
+// payload: defines the payload of the message.
+typedef struct message {
+    message_status status;
+    int flags;
+    int length;
+    int sequence;
+    char* payload;
+} message;
+
+// A client may pipeline its queries: send them back to back without
+// waiting for the responses. The server reads a message header and its
+// length bytes of query after the other, serves them in order, and
+// answers each with a response (a message, or a streamed result) of the
+// same sequence, in the same order.
+
+// Set by a client on its queries to receive print results as raw column
+// values instead of text. The server sets it on a streamed response whose
+// frames are binary: the first frame holds one DataType (int) per column,
+// every following frame a block of rows laid out column after column, so
+// its row count is the frame length divided by the width of a row.
+#define MESSAGE_BINARY_RESULTS 1
+
+// largest payload of a single frame of a streamed result
+#define MAX_FRAME_SIZE (64 * 1024)
+
+// A result too large for one message is streamed: the server answers with a
+// message of status OK_STREAM_RESPONSE and length 0, followed by frames,
+// each a frame_header and length bytes of payload. A frame of length 0 ends
+// the result.
+typedef struct frame_header {
+    int length;
+} frame_header;
+
+#endif
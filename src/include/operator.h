@@ -53,15 +53,36 @@ typedef struct Comparator {
     GeneralizedColumn* gen_col;
     ComparatorType type1;
     ComparatorType type2;
-    char* handle;
+    char handle[HANDLE_MAX_SIZE];
 } Comparator;
 
 /**
- * necessary fields for insertion
+ * the algorithms of join(...,type)
+ **/
+typedef enum JoinType {
+    NESTED_LOOP_JOIN,
+    HASH_JOIN,
+    GRACE_HASH_JOIN
+} JoinType;
+
+/**
+ * the functions of min(), max(), sum() and avg()
+ **/
+typedef enum AggregateType {
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_SUM,
+    AGGREGATE_AVG
+} AggregateType;
+
+/**
+ * necessary fields for insertion, values holds num_rows rows of one value
+ * per column
  **/
 typedef struct InsertOperator {
     Table* table;
     int* values;
+    size_t num_rows;
 } InsertOperator;
 
 /**
@@ -83,9 +104,21 @@ typedef struct GeneralizedColumnHandle {
  * holds the information necessary to refer to generalized columns (results or columns)
  **/
 typedef struct ClientContext {
-    GeneralizedColumnHandle* chandle_table;
-    int chandles_in_use;
-    int chandle_slots;
+    // maps the name of every handle to its GeneralizedColumnHandle
+    struct CatalogMap* handles;
+    // holds the results, handles and queued queries of the client
+    struct Arena* arena;
+    // queries queued between batch_queries() and batch_execute()
+    bool batching;
+    struct DbOperator** batch;
+    int batch_size;
+    int batch_slots;
+    // frame buffer of MAX_FRAME_SIZE bytes, reused by every print
+    char* print_buffer;
+    // print sends raw column values, see MESSAGE_BINARY_RESULTS
+    bool binary_results;
+    // sequence of the query being served, echoed in its response
+    int sequence;
 } ClientContext;
 
 /**
@@ -95,12 +128,124 @@ typedef struct CreateDbOperator {
     char* db_name;
 } CreateDbOperator;
 
+/**
+ * necessary fields for create table command
+ **/
+typedef struct CreateTblOperator {
+    char* tbl_name;
+    char* db_name;
+    size_t col_count;
+} CreateTblOperator;
+
+/**
+ * necessary fields for create column command
+ **/
+typedef struct CreateColOperator {
+    char* col_name;
+    Table* table;
+} CreateColOperator;
+
+/**
+ * necessary fields for create index command
+ **/
+typedef struct CreateIdxOperator {
+    Table* table;
+    Column* column;
+    IndexType type;
+    bool clustered;
+} CreateIdxOperator;
+
+/**
+ * necessary fields for select
+ * comparator.gen_col points to column, the values to select from. For
+ * select(pos,val,low,high) positions holds the positions of the values,
+ * otherwise it is NULL and table is the table of the selected column.
+ **/
+typedef struct SelectOperator {
+    Comparator comparator;
+    GeneralizedColumn column;
+    Table* table;
+    Result* positions;
+} SelectOperator;
+
+/**
+ * necessary fields for fetch
+ **/
+typedef struct FetchOperator {
+    Table* table;
+    Column* column;
+    Result* positions;
+    char handle[HANDLE_MAX_SIZE];
+} FetchOperator;
+
+/**
+ * necessary fields for join: the values and positions of both inputs,
+ * handle1 and handle2 receive the positions of the matching pairs.
+ * memory_budget bounds the hash tables of a grace hash join, in bytes.
+ **/
+typedef struct JoinOperator {
+    JoinType type;
+    size_t memory_budget;
+    Result* values1;
+    Result* positions1;
+    Result* values2;
+    Result* positions2;
+    char handle1[HANDLE_MAX_SIZE];
+    char handle2[HANDLE_MAX_SIZE];
+} JoinOperator;
+
+/**
+ * necessary fields for an aggregate over a result, or over a base column
+ * of table
+ **/
+typedef struct AggregateOperator {
+    AggregateType type;
+    GeneralizedColumn input;
+    Table* table;
+    char handle[HANDLE_MAX_SIZE];
+} AggregateOperator;
+
+/**
+ * necessary fields for add and sub, left and right have the same length
+ **/
+typedef struct ArithmeticOperator {
+    bool subtract;
+    Result* left;
+    Result* right;
+    char handle[HANDLE_MAX_SIZE];
+} ArithmeticOperator;
+
+/**
+ * necessary fields for print, results holds num_results result columns
+ **/
+typedef struct PrintOperator {
+    Result** results;
+    size_t num_results;
+} PrintOperator;
+
+/**
+ * necessary fields for load command
+ **/
+typedef struct LoadOperator {
+    char* file_name;
+} LoadOperator;
+
 /**
  * Union type holding the fields of any operator
  **/
 typedef union OperatorFields {
     CreateDbOperator create_db_operator;
+    CreateTblOperator create_tbl_operator;
+    CreateColOperator create_col_operator;
+    CreateIdxOperator create_idx_operator;
     InsertOperator insert_operator;
+    LoadOperator load_operator;
+    SelectOperator select_operator;
+    FetchOperator fetch_operator;
+    PrintOperator print_operator;
+    JoinOperator join_operator;
+    AggregateOperator aggregate_operator;
+    ArithmeticOperator arithmetic_operator;
 } OperatorFields;
 
 /**
@@ -108,8 +253,21 @@ typedef union OperatorFields {
  **/
 typedef enum OperatorType {
     CREATE_DB,
+    CREATE_TBL,
+    CREATE_COL,
+    CREATE_IDX,
     INSERT,
     OPEN,
+    LOAD,
+    SELECT,
+    FETCH,
+    PRINT,
+    JOIN,
+    AGGREGATE,
+    ARITHMETIC,
+    BATCH_QUERIES,
+    BATCH_EXECUTE,
+    SHUTDOWN,
 } OperatorType;
 
 /**
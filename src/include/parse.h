@@ -1,11 +1,15 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <stdbool.h>
+
 #include "message.h"
 #include "operator.h"
 
-DbOperator* parse_create_db(char* query_command);
+bool is_update_command(const char* query_command);
+
+bool is_insert_command(const char* query_command);
 
-DbOperator* parse_command(char* query_command, message* send_message, int client, ClientContext* context);
+DbOperator* parse_command(const char* query_command, message* send_message, int client, ClientContext* context);
 
 #endif
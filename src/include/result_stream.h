@@ -0,0 +1,61 @@
+#ifndef RESULT_STREAM_H
+#define RESULT_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "message.h"
+
+/**
+ * ResultStream
+ * Streams a result to a client in frames of at most MAX_FRAME_SIZE bytes,
+ * so that the memory used does not depend on the size of the result.
+ * buffer: holds the frame being built, MAX_FRAME_SIZE bytes
+ * length: bytes of the frame built so far
+ * failed: set once a send failed, further output is dropped
+ **/
+typedef struct ResultStream {
+    int socket;
+    char* buffer;
+    size_t length;
+    bool failed;
+} ResultStream;
+
+/**
+ * begin_stream sends the OK_STREAM_RESPONSE message announcing the frames,
+ * flags tells the client how to read them (see MESSAGE_BINARY_RESULTS) and
+ * sequence is the one of the query the result answers
+ **/
+void begin_stream(ResultStream* stream, int socket, char* buffer, int flags, int sequence);
+
+/**
+ * stream_reserve returns room for at least size bytes (at most
+ * MAX_FRAME_SIZE) in the current frame, sending the frame if it is too full.
+ * The bytes written there are added with stream_commit.
+ **/
+char* stream_reserve(ResultStream* stream, size_t size);
+
+static inline void stream_commit(ResultStream* stream, size_t size) {
+    stream->length += size;
+}
+
+/**
+ * stream_flush sends the current frame, so the next bytes start a new one
+ **/
+void stream_flush(ResultStream* stream);
+
+/**
+ * end_stream sends the last frame and the end marker.
+ * Returns 0 if the whole result was sent.
+ **/
+int end_stream(ResultStream* stream);
+
+/**
+ * send_all / recv_all transfer exactly length bytes, retrying on short
+ * transfers. Return 0 on success, -1 if the connection failed or closed.
+ **/
+int send_all(int socket, const void* data, size_t length);
+
+int recv_all(int socket, void* data, size_t length);
+
+#endif //RESULT_STREAM_H
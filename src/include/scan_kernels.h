@@ -0,0 +1,54 @@
+#ifndef SCAN_KERNELS_H
+#define SCAN_KERNELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "operator.h"
+
+/**
+ * ScanKind
+ * The shape of a range predicate once both comparisons of a Comparator are
+ * folded into one inclusive [low, high] range. Each kind has its own kernel.
+ **/
+typedef enum ScanKind {
+    SCAN_NONE,  // no value qualifies
+    SCAN_ALL,   // every value qualifies
+    SCAN_LOWER, // low <= v
+    SCAN_UPPER, // v <= high
+    SCAN_RANGE  // low <= v <= high
+} ScanKind;
+
+typedef struct ScanPredicate {
+    ScanKind kind;
+    int low;
+    int high;
+} ScanPredicate;
+
+/**
+ * make_scan_predicate folds the comparisons of comparator into a predicate
+ **/
+void make_scan_predicate(Comparator* comparator, ScanPredicate* predicate);
+
+/**
+ * scan_positions writes the positions of the qualifying values in
+ * values[begin, end) to out, in row order, and returns how many qualified.
+ * If positions is not NULL, positions[i] is reported instead of i.
+ * out must hold end - begin values. The kernel evaluates 8 (AVX2) or
+ * 4 (SSE4.2) values per instruction and builds the output from the
+ * compare mask, without a branch per row; the instruction set is picked
+ * at runtime, with a scalar fallback.
+ **/
+size_t scan_positions(const int* values, const int* positions, size_t begin, size_t end,
+                      const ScanPredicate* predicate, int* out);
+
+/**
+ * scan_bitmap sets bit (i - begin) of bitmap for every qualifying value in
+ * values[begin, end). bitmap must hold (end - begin + 63) / 64 words.
+ * Returns the number of qualifying values.
+ **/
+size_t scan_bitmap(const int* values, size_t begin, size_t end,
+                   const ScanPredicate* predicate, uint64_t* bitmap);
+
+#endif //SCAN_KERNELS_H
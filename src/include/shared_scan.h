@@ -0,0 +1,22 @@
+#ifndef SHARED_SCAN_H
+#define SHARED_SCAN_H
+
+#include "operator.h"
+
+// values per block, a block (16KB) stays in L1 while every predicate runs on it
+#define SHARED_SCAN_BLOCK_SIZE 4096
+// predicates evaluated per pass, so that their output frontiers fit in L2
+#define SHARED_SCAN_GROUP_SIZE 128
+
+/**
+ * shared_scan evaluates num_queries range predicates over the first length
+ * values of a column in block-at-a-time passes, each pass serving up to
+ * SHARED_SCAN_GROUP_SIZE predicates. Blocks the zone map of the column
+ * rules out are not read by a predicate. results[i] receives the positions
+ * qualifying comparators[i].
+ * Returns the number of passes over the data.
+ **/
+size_t shared_scan(const Column* column, size_t length, Comparator** comparators,
+                   Result** results, size_t num_queries);
+
+#endif //SHARED_SCAN_H
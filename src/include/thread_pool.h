@@ -0,0 +1,108 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * ThreadPool
+ * A fork-join pool for intra-query parallelism. thread_pool_run runs one
+ * routine on every worker (the calling thread is worker 0) and returns once
+ * all of them are done. Work is usually split into morsels that workers
+ * claim with an atomic counter.
+ **/
+typedef struct ThreadPool {
+    pthread_t* threads;
+    size_t num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    // serializes thread_pool_run calls from different clients
+    pthread_mutex_t run_lock;
+    void (*routine)(void* arg, size_t worker);
+    void* arg;
+    size_t generation;
+    size_t running;
+    bool stop;
+} ThreadPool;
+
+// L2 size assumed when the system does not report it
+#define DEFAULT_L2_CACHE_SIZE (256 * 1024)
+
+// the pool parallel operators run on, created at server start
+extern ThreadPool* parallel_pool;
+
+/**
+ * default_num_threads returns the number of online cores
+ **/
+size_t default_num_threads(void);
+
+/**
+ * create_thread_pool starts num_threads - 1 helper threads
+ **/
+ThreadPool* create_thread_pool(size_t num_threads);
+
+void thread_pool_run(ThreadPool* pool, void (*routine)(void* arg, size_t worker), void* arg);
+
+/**
+ * parallel_workers returns the number of workers an operator over length
+ * items runs on, the threads of parallel_pool, or 1 below threshold
+ **/
+size_t parallel_workers(size_t length, size_t threshold);
+
+/**
+ * run_parallel runs routine on every thread of parallel_pool, or only on
+ * the calling thread as worker 0 when num_workers is 1
+ **/
+void run_parallel(void (*routine)(void* arg, size_t worker), void* arg, size_t num_workers);
+
+/**
+ * l2_cache_size returns the size in bytes of the L2 cache of a core
+ **/
+size_t l2_cache_size(void);
+
+void destroy_thread_pool(ThreadPool* pool);
+
+/**
+ * WorkerPool
+ * A pool of threads consuming a FIFO queue of independent tasks, used by
+ * the server to run the requests of many clients concurrently.
+ **/
+typedef struct Task {
+    void (*routine)(void* arg);
+    void* arg;
+    struct Task* next;
+} Task;
+
+typedef struct WorkerPool {
+    pthread_t* threads;
+    size_t num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t task_ready;
+    pthread_cond_t idle;
+    Task* head;
+    Task* tail;
+    size_t active;
+    bool stop;
+} WorkerPool;
+
+WorkerPool* create_worker_pool(size_t num_threads);
+
+void worker_pool_submit(WorkerPool* pool, void (*routine)(void* arg), void* arg);
+
+/**
+ * worker_pool_drain waits until the queue is empty and no task is running
+ **/
+void worker_pool_drain(WorkerPool* pool);
+
+void destroy_worker_pool(WorkerPool* pool);
+
+/**
+ * claim_morsel atomically takes the next morsel index of a shared counter
+ **/
+static inline size_t claim_morsel(size_t* next_morsel) {
+    return __sync_fetch_and_add(next_morsel, 1);
+}
+
+#endif //THREAD_POOL_H
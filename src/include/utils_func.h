@@ -9,11 +9,6 @@
 #include <stdarg.h>
 #include <stdio.h>
 
-/**
- * a hash function for kv store
- **/
-int hash_func(const char* s, size_t a, size_t m);
-
 /**
  * trims newline characters from a string (in place)
  **/
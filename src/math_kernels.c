@@ -0,0 +1,347 @@
+/**
+ * math_kernels.c
+ * Vector kernels of add, sub and the aggregates. Every kernel is
+ * specialised for the types of its inputs; INT values are widened to
+ * 64 bit lanes before they are added, so sums never overflow 32 bits.
+ **/
+#include <limits.h>
+
+#include "math_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+DataType combined_type(DataType left_type, DataType right_type) {
+    return left_type == FLOAT || right_type == FLOAT ? FLOAT : LONG;
+}
+
+static inline long long_at(const void* values, DataType type, size_t i) {
+    return type == INT ? ((const int*)values)[i] : ((const long*)values)[i];
+}
+
+static inline double double_at(const void* values, DataType type, size_t i) {
+    switch (type) {
+        case INT:
+            return ((const int*)values)[i];
+        case LONG:
+            return ((const long*)values)[i];
+        default:
+            return ((const double*)values)[i];
+    }
+}
+
+/**
+ * Scalar kernels, also used for the tails of the vector kernels. Integers
+ * are added as unsigned so that a LONG overflow wraps instead of being
+ * undefined.
+ **/
+static void scalar_combine(const void* left, DataType left_type, const void* right, DataType right_type,
+                           bool subtract, void* out, size_t begin, size_t end) {
+    if (combined_type(left_type, right_type) == FLOAT) {
+        double* result = out;
+        for (size_t i = begin; i < end; i++) {
+            double a = double_at(left, left_type, i);
+            double b = double_at(right, right_type, i);
+            result[i] = subtract ? a - b : a + b;
+        }
+    } else {
+        long* result = out;
+        for (size_t i = begin; i < end; i++) {
+            unsigned long a = (unsigned long)long_at(left, left_type, i);
+            unsigned long b = (unsigned long)long_at(right, right_type, i);
+            result[i] = (long)(subtract ? a - b : a + b);
+        }
+    }
+}
+
+static void scalar_aggregate(Aggregate* aggregate, const void* values, size_t begin, size_t end) {
+    if (aggregate->type == FLOAT) {
+        const double* doubles = values;
+        for (size_t i = begin; i < end; i++) {
+            aggregate->float_min = doubles[i] < aggregate->float_min ? doubles[i] : aggregate->float_min;
+            aggregate->float_max = doubles[i] > aggregate->float_max ? doubles[i] : aggregate->float_max;
+            aggregate->float_sum += doubles[i];
+        }
+    } else {
+        long min = aggregate->min;
+        long max = aggregate->max;
+        long sum = aggregate->sum;
+        for (size_t i = begin; i < end; i++) {
+            long value = long_at(values, aggregate->type, i);
+            min = value < min ? value : min;
+            max = value > max ? value : max;
+            sum += value;
+        }
+        aggregate->min = min;
+        aggregate->max = max;
+        aggregate->sum = sum;
+    }
+    aggregate->count += end - begin;
+}
+
+static void scalar_gather(Aggregate* aggregate, const int* data, const int* positions, size_t begin, size_t end) {
+    long min = aggregate->min;
+    long max = aggregate->max;
+    long sum = aggregate->sum;
+    for (size_t i = begin; i < end; i++) {
+        int value = data[positions[i]];
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+        sum += value;
+    }
+    aggregate->min = min;
+    aggregate->max = max;
+    aggregate->sum = sum;
+    aggregate->count += end - begin;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/**
+ * AVX2: 4 values per 256 bit register once widened to 64 bit lanes. INT
+ * values are sign extended, LONG values converted to double one by one as
+ * AVX2 has no instruction for it.
+ **/
+static inline __attribute__((always_inline, target("avx2")))
+__m256i avx2_load_longs(const void* values, DataType type, size_t i) {
+    if (type == INT) {
+        return _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)((const int*)values + i)));
+    }
+    return _mm256_loadu_si256((const __m256i*)((const long*)values + i));
+}
+
+static inline __attribute__((always_inline, target("avx2")))
+__m256d avx2_load_doubles(const void* values, DataType type, size_t i) {
+    if (type == INT) {
+        return _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)((const int*)values + i)));
+    }
+    if (type == FLOAT) {
+        return _mm256_loadu_pd((const double*)values + i);
+    }
+    const long* longs = (const long*)values + i;
+    return _mm256_setr_pd((double)longs[0], (double)longs[1], (double)longs[2], (double)longs[3]);
+}
+
+static inline __attribute__((always_inline, target("avx2")))
+void avx2_combine_types(const void* left, DataType left_type, const void* right, DataType right_type,
+                        bool subtract, void* out, size_t begin, size_t end) {
+    size_t i = begin;
+    if (combined_type(left_type, right_type) == FLOAT) {
+        double* result = out;
+        for (; i + 4 <= end; i += 4) {
+            __m256d a = avx2_load_doubles(left, left_type, i);
+            __m256d b = avx2_load_doubles(right, right_type, i);
+            _mm256_storeu_pd(result + i, subtract ? _mm256_sub_pd(a, b) : _mm256_add_pd(a, b));
+        }
+    } else {
+        long* result = out;
+        for (; i + 4 <= end; i += 4) {
+            __m256i a = avx2_load_longs(left, left_type, i);
+            __m256i b = avx2_load_longs(right, right_type, i);
+            _mm256_storeu_si256((__m256i*)(result + i), subtract ? _mm256_sub_epi64(a, b) : _mm256_add_epi64(a, b));
+        }
+    }
+    scalar_combine(left, left_type, right, right_type, subtract, out, i, end);
+}
+
+static inline __attribute__((always_inline, target("avx2")))
+void avx2_combine_right(const void* left, DataType left_type, const void* right, DataType right_type,
+                        bool subtract, void* out, size_t begin, size_t end) {
+    switch (right_type) {
+        case INT:
+            avx2_combine_types(left, left_type, right, INT, subtract, out, begin, end);
+            break;
+        case LONG:
+            avx2_combine_types(left, left_type, right, LONG, subtract, out, begin, end);
+            break;
+        default:
+            avx2_combine_types(left, left_type, right, FLOAT, subtract, out, begin, end);
+            break;
+    }
+}
+
+static __attribute__((target("avx2")))
+void avx2_combine(const void* left, DataType left_type, const void* right, DataType right_type,
+                  bool subtract, void* out, size_t begin, size_t end) {
+    switch (left_type) {
+        case INT:
+            avx2_combine_right(left, INT, right, right_type, subtract, out, begin, end);
+            break;
+        case LONG:
+            avx2_combine_right(left, LONG, right, right_type, subtract, out, begin, end);
+            break;
+        default:
+            avx2_combine_right(left, FLOAT, right, right_type, subtract, out, begin, end);
+            break;
+    }
+}
+
+/**
+ * fold the lanes of the INT kernels into aggregate: sum holds 4 64 bit
+ * partial sums, min and max 8 32 bit lanes
+ **/
+static inline __attribute__((always_inline, target("avx2")))
+void avx2_fold_ints(Aggregate* aggregate, __m256i sum, __m256i min, __m256i max, size_t count) {
+    long sums[4];
+    int mins[8];
+    int maxs[8];
+    _mm256_storeu_si256((__m256i*)sums, sum);
+    _mm256_storeu_si256((__m256i*)mins, min);
+    _mm256_storeu_si256((__m256i*)maxs, max);
+    for (int lane = 0; lane < 8; lane++) {
+        aggregate->min = mins[lane] < aggregate->min ? mins[lane] : aggregate->min;
+        aggregate->max = maxs[lane] > aggregate->max ? maxs[lane] : aggregate->max;
+    }
+    aggregate->sum += sums[0] + sums[1] + sums[2] + sums[3];
+    aggregate->count += count;
+}
+
+static inline __attribute__((always_inline, target("avx2")))
+__m256i avx2_widen_sum(__m256i sum, __m256i v) {
+    sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+    return _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+}
+
+static __attribute__((target("avx2")))
+void avx2_aggregate_ints(Aggregate* aggregate, const int* values, size_t begin, size_t end) {
+    __m256i sum = _mm256_setzero_si256();
+    __m256i min = _mm256_set1_epi32(INT_MAX);
+    __m256i max = _mm256_set1_epi32(INT_MIN);
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        min = _mm256_min_epi32(min, v);
+        max = _mm256_max_epi32(max, v);
+        sum = avx2_widen_sum(sum, v);
+    }
+    if (i > begin) {
+        avx2_fold_ints(aggregate, sum, min, max, i - begin);
+    }
+    scalar_aggregate(aggregate, values, i, end);
+}
+
+static __attribute__((target("avx2")))
+void avx2_aggregate_longs(Aggregate* aggregate, const long* values, size_t begin, size_t end) {
+    __m256i sum = _mm256_setzero_si256();
+    __m256i min = _mm256_set1_epi64x(LONG_MAX);
+    __m256i max = _mm256_set1_epi64x(LONG_MIN);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        sum = _mm256_add_epi64(sum, v);
+        // AVX2 has no 64 bit min and max, blend on the compare instead
+        min = _mm256_blendv_epi8(min, v, _mm256_cmpgt_epi64(min, v));
+        max = _mm256_blendv_epi8(max, v, _mm256_cmpgt_epi64(v, max));
+    }
+    if (i > begin) {
+        long sums[4];
+        long mins[4];
+        long maxs[4];
+        _mm256_storeu_si256((__m256i*)sums, sum);
+        _mm256_storeu_si256((__m256i*)mins, min);
+        _mm256_storeu_si256((__m256i*)maxs, max);
+        for (int lane = 0; lane < 4; lane++) {
+            aggregate->min = mins[lane] < aggregate->min ? mins[lane] : aggregate->min;
+            aggregate->max = maxs[lane] > aggregate->max ? maxs[lane] : aggregate->max;
+            aggregate->sum += sums[lane];
+        }
+        aggregate->count += i - begin;
+    }
+    scalar_aggregate(aggregate, values, i, end);
+}
+
+static __attribute__((target("avx2")))
+void avx2_aggregate_doubles(Aggregate* aggregate, const double* values, size_t begin, size_t end) {
+    __m256d sum = _mm256_setzero_pd();
+    __m256d min = _mm256_set1_pd(aggregate->float_min);
+    __m256d max = _mm256_set1_pd(aggregate->float_max);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m256d v = _mm256_loadu_pd(values + i);
+        sum = _mm256_add_pd(sum, v);
+        min = _mm256_min_pd(min, v);
+        max = _mm256_max_pd(max, v);
+    }
+    if (i > begin) {
+        double sums[4];
+        double mins[4];
+        double maxs[4];
+        _mm256_storeu_pd(sums, sum);
+        _mm256_storeu_pd(mins, min);
+        _mm256_storeu_pd(maxs, max);
+        for (int lane = 0; lane < 4; lane++) {
+            aggregate->float_min = mins[lane] < aggregate->float_min ? mins[lane] : aggregate->float_min;
+            aggregate->float_max = maxs[lane] > aggregate->float_max ? maxs[lane] : aggregate->float_max;
+            aggregate->float_sum += sums[lane];
+        }
+        aggregate->count += i - begin;
+    }
+    scalar_aggregate(aggregate, values, i, end);
+}
+
+static __attribute__((target("avx2")))
+void avx2_gather(Aggregate* aggregate, const int* data, const int* positions, size_t length) {
+    __m256i sum = _mm256_setzero_si256();
+    __m256i min = _mm256_set1_epi32(INT_MAX);
+    __m256i max = _mm256_set1_epi32(INT_MIN);
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        __m256i index = _mm256_loadu_si256((const __m256i*)(positions + i));
+        __m256i v = _mm256_i32gather_epi32(data, index, sizeof(int));
+        min = _mm256_min_epi32(min, v);
+        max = _mm256_max_epi32(max, v);
+        sum = avx2_widen_sum(sum, v);
+    }
+    if (i > 0) {
+        avx2_fold_ints(aggregate, sum, min, max, i);
+    }
+    scalar_gather(aggregate, data, positions, i, length);
+}
+
+#endif
+
+void combine_values(const void* left, DataType left_type, const void* right, DataType right_type,
+                    bool subtract, void* out, size_t begin, size_t end) {
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        avx2_combine(left, left_type, right, right_type, subtract, out, begin, end);
+        return;
+    }
+#endif
+    scalar_combine(left, left_type, right, right_type, subtract, out, begin, end);
+}
+
+void aggregate_values(Aggregate* aggregate, const void* values, size_t begin, size_t end) {
+    if (begin >= end) {
+        return;
+    }
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        switch (aggregate->type) {
+            case INT:
+                avx2_aggregate_ints(aggregate, values, begin, end);
+                break;
+            case LONG:
+                avx2_aggregate_longs(aggregate, values, begin, end);
+                break;
+            default:
+                avx2_aggregate_doubles(aggregate, values, begin, end);
+                break;
+        }
+        return;
+    }
+#endif
+    scalar_aggregate(aggregate, values, begin, end);
+}
+
+void aggregate_gather(Aggregate* aggregate, const int* data, const int* positions, size_t length) {
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        avx2_gather(aggregate, data, positions, length);
+        return;
+    }
+#endif
+    scalar_gather(aggregate, data, positions, 0, length);
+}
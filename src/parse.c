@@ -4,250 +4,923 @@
  * strings into database operators. This will require checking that the
  * input from the client is in the correct format and maps to a valid
  * database operator.
+ * A command is read in a single pass by a tokenizer that hands out slices
+ * of the receive buffer. The buffer is never modified: names are looked
+ * up and numbers converted straight from the slices, and handles are
+ * copied into the operator, so parsing a query allocates nothing but its
+ * operator.
  **/
 
-#define _BSD_SOURCE
 #include <string.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include "parse.h"
+#include "arena.h"
+#include "client_context.h"
+#include "db_join.h"
+#include "db_manager.h"
 #include "utils_func.h"
 
+// t1,t2=join(...) is the only command with more than one handle
+#define MAX_HANDLES 2
+
 /**
- * This method takes in a string representing the arguments to create a table.
- * It parses those arguments, checks that they are valid, and creates a table.
+ * Slice
+ * A piece of the command text, the length bytes at start. A slice is not
+ * NUL terminated.
  **/
-/*
-message_status parse_create_tbl(char* create_arguments) {
-    message_status status = OK_DONE;
-    char** create_arguments_index = &create_arguments;
-    char* table_name = next_token(create_arguments_index, &status);
-    char* db_name = next_token(create_arguments_index, &status);
-    char* col_cnt = next_token(create_arguments_index, &status);
+typedef struct Slice {
+    const char* start;
+    size_t length;
+} Slice;
 
-    // not enough arguments
-    if (status == INCORRECT_FORMAT) {
-        return status;
-    }
+/**
+ * Tokenizer
+ * The state of the pass over a command: cursor is the next character to
+ * read, open tells whether the cursor is inside the argument list, and
+ * malformed that the list ends before its closing parenthesis.
+ **/
+typedef struct Tokenizer {
+    const char* cursor;
+    bool open;
+    bool malformed;
+} Tokenizer;
 
-    // Get the table name free of quotation marks
-    table_name = trim_quote(table_name);
+/**
+ * the commands, told apart by command_keyword
+ **/
+typedef enum Keyword {
+    KEYWORD_NONE,
+    KEYWORD_CREATE,
+    KEYWORD_INSERT,
+    KEYWORD_LOAD,
+    KEYWORD_SELECT,
+    KEYWORD_FETCH,
+    KEYWORD_MIN,
+    KEYWORD_MAX,
+    KEYWORD_SUM,
+    KEYWORD_AVG,
+    KEYWORD_ADD,
+    KEYWORD_SUB,
+    KEYWORD_JOIN,
+    KEYWORD_PRINT,
+    KEYWORD_BATCH_QUERIES,
+    KEYWORD_BATCH_EXECUTE,
+    KEYWORD_SHUTDOWN
+} Keyword;
+
+static inline bool slice_equals(Slice slice, const char* text) {
+    return strlen(text) == slice.length && memcmp(slice.start, text, slice.length) == 0;
+}
 
-    // read and chop off last char, which should be a ')'
-    int last_char = strlen(col_cnt) - 1;
-    if (col_cnt[last_char] != ')') {
-        return INCORRECT_FORMAT;
+static inline const char* skip_space(const char* p) {
+    while (isspace((unsigned char)*p)) {
+        p++;
     }
-    // replace the ')' with a null terminating character. 
-    col_cnt[last_char] = '\0';
+    return p;
+}
 
-    // check that the database argument is the current active database
-    if (strcmp(current_db->name, db_name) != 0) {
-        cs165_log(stdout, "query unsupported. Bad db name");
-        return QUERY_UNSUPPORTED;
+/**
+ * next_word reads a keyword or a handle: letters, digits, '_' and '.'
+ **/
+static Slice next_word(Tokenizer* tokenizer) {
+    const char* p = skip_space(tokenizer->cursor);
+    Slice word = { p, 0 };
+    while (isalnum((unsigned char)*p) || *p == '_' || *p == '.') {
+        p++;
+    }
+    word.length = p - word.start;
+    tokenizer->cursor = skip_space(p);
+    return word;
+}
+
+/**
+ * open_arguments moves past the '(' that starts the argument list, or
+ * returns false if there is none
+ **/
+static bool open_arguments(Tokenizer* tokenizer) {
+    const char* p = skip_space(tokenizer->cursor);
+    if (*p != '(') {
+        return false;
     }
+    p = skip_space(p + 1);
+    tokenizer->open = *p != ')';
+    tokenizer->cursor = tokenizer->open ? p : p + 1;
+    return true;
+}
 
-    // turn the string column count into an integer, and check that the input is valid.
-    int column_cnt = atoi(col_cnt);
-    if (column_cnt < 1) {
-        return INCORRECT_FORMAT;
+/**
+ * next_argument reads the next argument of the list, without the blanks
+ * and the quotes around it. Commas and parenthesis inside quotes or inside
+ * nested parenthesis, like the rows of a multi-row insert, belong to the
+ * argument. Returns false once the list is exhausted.
+ **/
+static bool next_argument(Tokenizer* tokenizer, Slice* argument) {
+    if (!tokenizer->open) {
+        return false;
+    }
+    const char* start = skip_space(tokenizer->cursor);
+    const char* p = start;
+    bool quoted = false;
+    int depth = 0;
+    while (*p != '\0' && (quoted || depth > 0 || (*p != ',' && *p != ')'))) {
+        if (*p == '"') {
+            quoted = !quoted;
+        } else if (!quoted) {
+            depth += (*p == '(') - (*p == ')');
+        }
+        p++;
+    }
+    if (*p == '\0') {
+        tokenizer->open = false;
+        tokenizer->malformed = true;
+        return false;
     }
-    Status create_status;
-    create_table(current_db, table_name, column_cnt, &create_status);
-    if (create_status.code != OK) {
-        cs165_log(stdout, "adding a table failed.");
-        return EXECUTION_ERROR;
+    tokenizer->open = *p == ',';
+    tokenizer->cursor = p + 1;
+    while (p > start && isspace((unsigned char)p[-1])) {
+        p--;
     }
+    if (p - start >= 2 && start[0] == '"' && p[-1] == '"') {
+        start++;
+        p--;
+    }
+    argument->start = start;
+    argument->length = p - start;
+    return true;
+}
 
-    return status;
+/**
+ * end_of_command tells whether the argument list has been read to its end,
+ * with nothing but blanks or a comment after it
+ **/
+static bool end_of_command(const Tokenizer* tokenizer) {
+    if (tokenizer->open || tokenizer->malformed) {
+        return false;
+    }
+    const char* p = skip_space(tokenizer->cursor);
+    return *p == '\0' || strncmp(p, "--", 2) == 0;
 }
-*/
+
 /**
- * This method takes in a string representing the arguments to create a database.
- * It parses those arguments, checks that they are valid, and creates a database.
+ * read_arguments reads the count arguments that make up the rest of the
+ * command
  **/
-/*
-message_status parse_create_db(char* create_arguments) {
-    char *token;
-    token = strsep(&create_arguments, ",");
-    // not enough arguments if token is NULL
-    if (token == NULL) {
-        return INCORRECT_FORMAT;                    
-    } else {
-        // create the database with given name
-        char* db_name = token;
-        // trim quotes and check for finishing parenthesis.
-        db_name = trim_quotes(db_name);
-        int last_char = strlen(db_name) - 1;
-        if (last_char < 0 || db_name[last_char] != ')') {
-            return INCORRECT_FORMAT;
+static bool read_arguments(Tokenizer* tokenizer, Slice* arguments, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!next_argument(tokenizer, &arguments[i])) {
+            return false;
         }
-        // replace final ')' with null-termination character.
-        db_name[last_char] = '\0';
+    }
+    return end_of_command(tokenizer);
+}
 
-        token = strsep(&create_arguments, ",");
-        if (token != NULL) {
-            return INCORRECT_FORMAT;
+/**
+ * parse_integer reads a decimal integer that spans the whole slice and
+ * fits in a long int
+ **/
+static bool parse_integer(Slice slice, long int* value) {
+    const char* p = slice.start;
+    const char* end = slice.start + slice.length;
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    if (p == end) {
+        return false;
+    }
+    // the magnitude of LONG_MIN is one more than LONG_MAX
+    unsigned long int limit = (unsigned long int)LONG_MAX + negative;
+    unsigned long int magnitude = 0;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') {
+            return false;
         }
-        if (add_db(db_name, true).code == OK) {
-            return OK_DONE;
-        } else {
-            return EXECUTION_ERROR;
+        unsigned int digit = *p - '0';
+        if (magnitude > (limit - digit) / 10) {
+            return false;
         }
+        magnitude = magnitude * 10 + digit;
     }
+    *value = negative ? -(long int)(magnitude - 1) - 1 : (long int)magnitude;
+    return true;
 }
-*/
-/**
- * parse_create parses a create statement and then passes the necessary arguments off to the next function
- **/
-/*
-message_status parse_create(char* create_arguments) {
-    message_status mes_status;
-    char *tokenizer_copy, *to_free;
-    // Since strsep destroys input, we create a copy of our input. 
-    tokenizer_copy = to_free = malloc((strlen(create_arguments)+1) * sizeof(char));
-    char *token;
-    strcpy(tokenizer_copy, create_arguments);
-    // check for leading parenthesis after create. 
-    if (strncmp(tokenizer_copy, "(", 1) == 0) {
-        tokenizer_copy++;
-        // token stores first argument. Tokenizer copy now points to just past first ","
-        token = next_token(&tokenizer_copy, &mes_status);
-        if (mes_status == INCORRECT_FORMAT) {
-            return mes_status;
-        } else {
-            // pass off to next parse function. 
-            if (strcmp(token, "db") == 0) {
-                mes_status = parse_create_db(tokenizer_copy);
-            } else if (strcmp(token, "tbl") == 0) {
-                mes_status = parse_create_tbl(tokenizer_copy);
-            } else {
-                mes_status = UNKNOWN_COMMAND;
-            }
+
+/**
+ * parse_int reads a decimal integer that fits in an int, the type of the
+ * values of the columns
+ **/
+static bool parse_int(Slice slice, int* value) {
+    long int parsed;
+    if (!parse_integer(slice, &parsed) || parsed < INT_MIN || parsed > INT_MAX) {
+        return false;
+    }
+    *value = (int)parsed;
+    return true;
+}
+
+/**
+ * copy_name returns a NUL terminated copy of a name the operator keeps
+ * past the command, such as the name of a created object
+ **/
+static char* copy_name(Slice name) {
+    char* copy = malloc(name.length + 1);
+    memcpy(copy, name.start, name.length);
+    copy[name.length] = '\0';
+    return copy;
+}
+
+/**
+ * copy_handle copies a handle into the buffer of its operator, handles are
+ * checked to fit by parse_command
+ **/
+static void copy_handle(char* buffer, Slice handle) {
+    memcpy(buffer, handle.start, handle.length);
+    buffer[handle.length] = '\0';
+}
+
+/**
+ * command_keyword tells which command a word names. The first letter
+ * leaves at most three candidates, which one compare each settles.
+ **/
+static Keyword command_keyword(Slice word) {
+    if (word.length == 0) {
+        return KEYWORD_NONE;
+    }
+    switch (word.start[0]) {
+        case 'a':
+            return slice_equals(word, "add") ? KEYWORD_ADD :
+                   slice_equals(word, "avg") ? KEYWORD_AVG : KEYWORD_NONE;
+        case 'b':
+            return slice_equals(word, "batch_queries") ? KEYWORD_BATCH_QUERIES :
+                   slice_equals(word, "batch_execute") ? KEYWORD_BATCH_EXECUTE : KEYWORD_NONE;
+        case 'c':
+            return slice_equals(word, "create") ? KEYWORD_CREATE : KEYWORD_NONE;
+        case 'f':
+            return slice_equals(word, "fetch") ? KEYWORD_FETCH : KEYWORD_NONE;
+        case 'j':
+            return slice_equals(word, "join") ? KEYWORD_JOIN : KEYWORD_NONE;
+        case 'l':
+            return slice_equals(word, "load") ? KEYWORD_LOAD : KEYWORD_NONE;
+        case 'm':
+            return slice_equals(word, "min") ? KEYWORD_MIN :
+                   slice_equals(word, "max") ? KEYWORD_MAX : KEYWORD_NONE;
+        case 'p':
+            return slice_equals(word, "print") ? KEYWORD_PRINT : KEYWORD_NONE;
+        case 'r':
+            return slice_equals(word, "relational_insert") ? KEYWORD_INSERT : KEYWORD_NONE;
+        case 's':
+            return slice_equals(word, "select") ? KEYWORD_SELECT :
+                   slice_equals(word, "sum") ? KEYWORD_SUM :
+                   slice_equals(word, "sub") ? KEYWORD_SUB :
+                   slice_equals(word, "shutdown") ? KEYWORD_SHUTDOWN : KEYWORD_NONE;
+        default:
+            return KEYWORD_NONE;
+    }
+}
+
+/**
+ * the number of handles a command assigns
+ **/
+static size_t keyword_handles(Keyword keyword) {
+    switch (keyword) {
+        case KEYWORD_SELECT:
+        case KEYWORD_FETCH:
+        case KEYWORD_MIN:
+        case KEYWORD_MAX:
+        case KEYWORD_SUM:
+        case KEYWORD_AVG:
+        case KEYWORD_ADD:
+        case KEYWORD_SUB:
+            return 1;
+        case KEYWORD_JOIN:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * parse_create_db reads the name of create(db,<name>)
+ **/
+DbOperator* parse_create_db(Tokenizer* tokenizer, message* send_message) {
+    Slice db_name;
+    if (!read_arguments(tokenizer, &db_name, 1)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    dbo->type = CREATE_DB;
+    dbo->operator_fields.create_db_operator.db_name = copy_name(db_name);
+    return dbo;
+}
+
+/**
+ * This method takes in the arguments of create(tbl,<name>,<db>,<count>).
+ * It parses those arguments, checks that they are valid, and creates a table
+ * operator.
+ **/
+DbOperator* parse_create_tbl(Tokenizer* tokenizer, message* send_message) {
+    // table name, db name and column count
+    Slice arguments[3];
+    long int column_cnt;
+    if (!read_arguments(tokenizer, arguments, 3)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+
+    // check that the database argument is the current active database
+    if (current_db == NULL || !slice_equals(arguments[1], current_db->name)) {
+        coldb_log(stdout, "query unsupported. Bad db name\n");
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+
+    // check that the column count is a positive integer
+    if (!parse_integer(arguments[2], &column_cnt) || column_cnt < 1) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    dbo->type = CREATE_TBL;
+    dbo->operator_fields.create_tbl_operator.tbl_name = copy_name(arguments[0]);
+    dbo->operator_fields.create_tbl_operator.db_name = current_db->name;
+    dbo->operator_fields.create_tbl_operator.col_count = column_cnt;
+    return dbo;
+}
+
+/**
+ * This method takes in the arguments of create(col,<name>,<table>).
+ * It parses those arguments, checks that the table exists, and creates a
+ * column operator.
+ **/
+DbOperator* parse_create_col(Tokenizer* tokenizer, message* send_message) {
+    // column name and table name
+    Slice arguments[2];
+    if (!read_arguments(tokenizer, arguments, 2)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    Table* table = resolve_table(arguments[1].start, arguments[1].length);
+    if (table == NULL) {
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    dbo->type = CREATE_COL;
+    dbo->operator_fields.create_col_operator.col_name = copy_name(arguments[0]);
+    dbo->operator_fields.create_col_operator.table = table;
+    return dbo;
+}
+
+/**
+ * parse_create_idx reads the arguments of
+ * create(idx,<col>,[btree|sorted],[clustered|unclustered])
+ **/
+DbOperator* parse_create_idx(Tokenizer* tokenizer, message* send_message) {
+    // column name, index type and clustering
+    Slice arguments[3];
+    if (!read_arguments(tokenizer, arguments, 3)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+
+    IndexType type;
+    bool clustered;
+    if (slice_equals(arguments[1], "btree")) {
+        type = BTREE;
+    } else if (slice_equals(arguments[1], "sorted")) {
+        type = SORTED;
+    } else {
+        send_message->status = QUERY_UNSUPPORTED;
+        return NULL;
+    }
+    if (slice_equals(arguments[2], "clustered")) {
+        clustered = true;
+    } else if (slice_equals(arguments[2], "unclustered")) {
+        clustered = false;
+    } else {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    Table* table;
+    Column* column = resolve_column(arguments[0].start, arguments[0].length, &table);
+    if (column == NULL) {
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    dbo->type = CREATE_IDX;
+    dbo->operator_fields.create_idx_operator.table = table;
+    dbo->operator_fields.create_idx_operator.column = column;
+    dbo->operator_fields.create_idx_operator.type = type;
+    dbo->operator_fields.create_idx_operator.clustered = clustered;
+    return dbo;
+}
+
+/**
+ * parse_create reads the kind of object of create(<kind>,...) and hands
+ * the rest of the arguments to the parser of that kind
+ **/
+DbOperator* parse_create(Tokenizer* tokenizer, message* send_message) {
+    Slice kind;
+    if (!next_argument(tokenizer, &kind)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    if (slice_equals(kind, "db")) {
+        return parse_create_db(tokenizer, send_message);
+    } else if (slice_equals(kind, "tbl")) {
+        return parse_create_tbl(tokenizer, send_message);
+    } else if (slice_equals(kind, "col")) {
+        return parse_create_col(tokenizer, send_message);
+    } else if (slice_equals(kind, "idx")) {
+        return parse_create_idx(tokenizer, send_message);
+    }
+    send_message->status = UNKNOWN_COMMAND;
+    return NULL;
+}
+
+/**
+ * parse_row reads one row of a multi-row insert, e.g. (1,2,3), into the
+ * count values of the row
+ **/
+static bool parse_row(Slice row, int* values, size_t count) {
+    Tokenizer tokenizer = { row.start, false, false };
+    if (row.length == 0 || row.start[row.length - 1] != ')' || !open_arguments(&tokenizer)) {
+        return false;
+    }
+    Slice argument;
+    size_t columns_inserted = 0;
+    while (columns_inserted < count && next_argument(&tokenizer, &argument) &&
+           parse_int(argument, &values[columns_inserted])) {
+        columns_inserted++;
+    }
+    // the closing parenthesis of the row ends its list
+    return columns_inserted == count && !tokenizer.open && tokenizer.cursor == row.start + row.length;
+}
+
+/**
+ * parse_insert reads relational_insert(<table>,<value>,...), one value per
+ * column of the table, or relational_insert(<table>,(<value>,...),...)
+ * with one parenthesized row per argument. The values are converted as
+ * they are read, row after row into an array from the arena of the client.
+ **/
+DbOperator* parse_insert(Tokenizer* tokenizer, message* send_message) {
+    Slice argument;
+    if (!next_argument(tokenizer, &argument)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    // lookup the table and make sure it exists.
+    Table* insert_table = resolve_table(argument.start, argument.length);
+    if (insert_table == NULL) {
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+    size_t col_count = insert_table->col_count;
+    // count the rows on a copy of the tokenizer to size the values
+    Tokenizer counter = *tokenizer;
+    bool multi_row = next_argument(&counter, &argument) && argument.length > 0 && argument.start[0] == '(';
+    size_t num_rows = 1;
+    while (multi_row && next_argument(&counter, &argument)) {
+        num_rows++;
+    }
+    int* values = arena_malloc(sizeof(int) * col_count * num_rows);
+    size_t rows_inserted = 0;
+    if (multi_row) {
+        while (rows_inserted < num_rows && next_argument(tokenizer, &argument) &&
+               parse_row(argument, values + rows_inserted * col_count, col_count)) {
+            rows_inserted++;
         }
     } else {
-        mes_status = UNKNOWN_COMMAND;
+        size_t columns_inserted = 0;
+        while (columns_inserted < col_count && next_argument(tokenizer, &argument) &&
+               parse_int(argument, &values[columns_inserted])) {
+            columns_inserted++;
+        }
+        rows_inserted = columns_inserted == col_count ? 1 : 0;
+    }
+    // check that we received the correct number of input values
+    if (rows_inserted != num_rows || !end_of_command(tokenizer)) {
+        send_message->status = INCORRECT_FORMAT;
+        arena_free(values);
+        return NULL;
+    }
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    dbo->type = INSERT;
+    dbo->operator_fields.insert_operator.table = insert_table;
+    dbo->operator_fields.insert_operator.values = values;
+    dbo->operator_fields.insert_operator.num_rows = num_rows;
+    return dbo;
+}
+
+/**
+ * parse_load reads the file name of a load statement, e.g. ("/path/data1.csv")
+ **/
+DbOperator* parse_load(Tokenizer* tokenizer, message* send_message) {
+    Slice file_name;
+    if (!read_arguments(tokenizer, &file_name, 1) || file_name.length == 0) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
     }
-    free(to_free);
-    return mes_status;
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    dbo->type = LOAD;
+    dbo->operator_fields.load_operator.file_name = copy_name(file_name);
+    return dbo;
 }
-*/
 
 /**
- * parse_insert reads in the arguments for a create statement and 
- * then passes these arguments to a database function to insert a row.
+ * parse_bound reads one bound of a select, "null" means unbounded
  **/
-/*
-DbOperator* parse_insert(char* query_command, message* send_message) {
-    unsigned int columns_inserted = 0;
-    char* token = NULL;
-    // check for leading '('
-    if (strncmp(query_command, "(", 1) == 0) {
-        query_command++;
-        char** command_index = &query_command;
-        // parse table input
-        char* table_name = next_token(command_index, &send_message->status);
-        if (send_message->status == INCORRECT_FORMAT) {
+bool parse_bound(Slice token, ComparatorType type, ComparatorType* comparison, long int* value) {
+    if (slice_equals(token, "null")) {
+        *comparison = NO_COMPARISON;
+        *value = 0;
+        return true;
+    }
+    *comparison = type;
+    return parse_integer(token, value);
+}
+
+/**
+ * parse_select reads select(col,low,high) or select(pos,val,low,high).
+ * low is inclusive and high exclusive.
+ **/
+DbOperator* parse_select(Slice handle, Tokenizer* tokenizer, message* send_message, ClientContext* context) {
+    Slice arguments[4];
+    size_t num_arguments = 0;
+    while (num_arguments < 4 && next_argument(tokenizer, &arguments[num_arguments])) {
+        num_arguments++;
+    }
+    if (num_arguments < 3 || !end_of_command(tokenizer)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    ComparatorType type1;
+    ComparatorType type2;
+    long int low;
+    long int high;
+    if (!parse_bound(arguments[num_arguments - 2], GREATER_THAN_OR_EQUAL, &type1, &low) ||
+        !parse_bound(arguments[num_arguments - 1], LESS_THAN, &type2, &high)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    SelectOperator* op = &dbo->operator_fields.select_operator;
+    dbo->type = SELECT;
+    if (num_arguments == 3) {
+        op->column.column_type = COLUMN;
+        op->column.column_pointer.column = resolve_column(arguments[0].start, arguments[0].length, &op->table);
+        op->positions = NULL;
+        if (op->column.column_pointer.column == NULL) {
+            send_message->status = OBJECT_NOT_FOUND;
+            arena_free(dbo);
             return NULL;
         }
-        // lookup the table and make sure it exists. 
-        Table* insert_table = lookup_table(table_name);
-        if (insert_table == NULL) {
+    } else {
+        op->column.column_type = RESULT;
+        op->column.column_pointer.result = lookup_result(context, arguments[1].start, arguments[1].length);
+        op->positions = lookup_result(context, arguments[0].start, arguments[0].length);
+        op->table = NULL;
+        if (op->column.column_pointer.result == NULL || op->positions == NULL) {
             send_message->status = OBJECT_NOT_FOUND;
+            arena_free(dbo);
             return NULL;
         }
-        // make insert operator. 
-        DbOperator* dbo = malloc(sizeof(DbOperator));
-        dbo->type = INSERT;
-        dbo->operator_fields.insert_operator.table = insert_table;
-        dbo->operator_fields.insert_operator.values = malloc(sizeof(int) * insert_table->col_count);
-        // parse inputs until we reach the end. Turn each given string into an integer. 
-        while ((token = strsep(command_index, ",")) != NULL) {
-            int insert_val = atoi(token);
-            dbo->operator_fields.insert_operator.values[columns_inserted] = insert_val;
-            columns_inserted++;
+    }
+    op->comparator.gen_col = &op->column;
+    op->comparator.type1 = type1;
+    op->comparator.p_low = low;
+    op->comparator.type2 = type2;
+    op->comparator.p_high = high;
+    copy_handle(op->comparator.handle, handle);
+    return dbo;
+}
+
+/**
+ * parse_fetch reads fetch(col,pos)
+ **/
+DbOperator* parse_fetch(Slice handle, Tokenizer* tokenizer, message* send_message, ClientContext* context) {
+    // column name and positions
+    Slice arguments[2];
+    if (!read_arguments(tokenizer, arguments, 2)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    Table* table;
+    Column* column = resolve_column(arguments[0].start, arguments[0].length, &table);
+    Result* positions = lookup_result(context, arguments[1].start, arguments[1].length);
+    if (column == NULL || positions == NULL) {
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    dbo->type = FETCH;
+    dbo->operator_fields.fetch_operator.table = table;
+    dbo->operator_fields.fetch_operator.column = column;
+    dbo->operator_fields.fetch_operator.positions = positions;
+    copy_handle(dbo->operator_fields.fetch_operator.handle, handle);
+    return dbo;
+}
+
+/**
+ * parse_aggregate reads min(x), max(x), sum(x) or avg(x), x is a result
+ * or a base column such as db1.tbl1.col1
+ **/
+DbOperator* parse_aggregate(Slice handle, Tokenizer* tokenizer, AggregateType type,
+                            message* send_message, ClientContext* context) {
+    Slice name;
+    if (!read_arguments(tokenizer, &name, 1)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    AggregateOperator* op = &dbo->operator_fields.aggregate_operator;
+    dbo->type = AGGREGATE;
+    op->type = type;
+    if (memchr(name.start, '.', name.length) != NULL) {
+        op->input.column_type = COLUMN;
+        op->input.column_pointer.column = resolve_column(name.start, name.length, &op->table);
+    } else {
+        op->input.column_type = RESULT;
+        op->input.column_pointer.result = lookup_result(context, name.start, name.length);
+        op->table = NULL;
+    }
+    if (op->input.column_pointer.result == NULL) {
+        send_message->status = OBJECT_NOT_FOUND;
+        arena_free(dbo);
+        return NULL;
+    }
+    copy_handle(op->handle, handle);
+    return dbo;
+}
+
+/**
+ * parse_arithmetic reads add(x,y) or sub(x,y) over two results of the
+ * same length
+ **/
+DbOperator* parse_arithmetic(Slice handle, Tokenizer* tokenizer, bool subtract,
+                             message* send_message, ClientContext* context) {
+    // left and right operands
+    Slice arguments[2];
+    if (!read_arguments(tokenizer, arguments, 2)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    Result* left = lookup_result(context, arguments[0].start, arguments[0].length);
+    Result* right = lookup_result(context, arguments[1].start, arguments[1].length);
+    if (left == NULL || right == NULL) {
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    ArithmeticOperator* op = &dbo->operator_fields.arithmetic_operator;
+    dbo->type = ARITHMETIC;
+    op->subtract = subtract;
+    op->left = left;
+    op->right = right;
+    copy_handle(op->handle, handle);
+    return dbo;
+}
+
+/**
+ * parse_join reads t1,t2=join(val1,pos1,val2,pos2,type), a grace hash join
+ * takes an optional memory budget in bytes: join(...,grace,budget)
+ **/
+DbOperator* parse_join(const Slice* handles, Tokenizer* tokenizer, message* send_message, ClientContext* context) {
+    // values and positions of both sides, the type and the budget
+    Slice arguments[6];
+    size_t num_arguments = 0;
+    while (num_arguments < 6 && next_argument(tokenizer, &arguments[num_arguments])) {
+        num_arguments++;
+    }
+    if (num_arguments < 5 || !end_of_command(tokenizer)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    JoinType type;
+    size_t memory_budget = GRACE_DEFAULT_BUDGET;
+    if (slice_equals(arguments[4], "nested-loop")) {
+        type = NESTED_LOOP_JOIN;
+    } else if (slice_equals(arguments[4], "hash")) {
+        type = HASH_JOIN;
+    } else if (slice_equals(arguments[4], "grace")) {
+        type = GRACE_HASH_JOIN;
+        if (num_arguments == 6) {
+            long int value;
+            if (!parse_integer(arguments[5], &value) || value <= 0) {
+                send_message->status = INCORRECT_FORMAT;
+                return NULL;
+            }
+            memory_budget = value;
         }
-        // check that we received the correct number of input values
-        if (columns_inserted != insert_table->col_count) {
-            send_message->status = INCORRECT_FORMAT;
-            free (dbo);
-            return NULL;
-        } 
-        return dbo;
     } else {
-        send_message->status = UNKNOWN_COMMAND;
+        send_message->status = QUERY_UNSUPPORTED;
+        return NULL;
+    }
+    if (type != GRACE_HASH_JOIN && num_arguments == 6) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    Result* values1 = lookup_result(context, arguments[0].start, arguments[0].length);
+    Result* positions1 = lookup_result(context, arguments[1].start, arguments[1].length);
+    Result* values2 = lookup_result(context, arguments[2].start, arguments[2].length);
+    Result* positions2 = lookup_result(context, arguments[3].start, arguments[3].length);
+    if (values1 == NULL || positions1 == NULL || values2 == NULL || positions2 == NULL) {
+        send_message->status = OBJECT_NOT_FOUND;
         return NULL;
     }
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    JoinOperator* op = &dbo->operator_fields.join_operator;
+    dbo->type = JOIN;
+    op->type = type;
+    op->memory_budget = memory_budget;
+    op->values1 = values1;
+    op->positions1 = positions1;
+    op->values2 = values2;
+    op->positions2 = positions2;
+    copy_handle(op->handle1, handles[0]);
+    copy_handle(op->handle2, handles[1]);
+    return dbo;
 }
-*/
 
 /**
- * parse_create parses a create statement and then passes the necessary arguments off to the next function
+ * parse_print reads print(h1,h2,...), all results must have the same length
  **/
-DbOperator* parse_create_db(char* query_command) {
-    char* db_name = trim_quote(query_command);
-    int last_char = (int)strlen(db_name) - 1;
-    if (last_char < 0 || db_name[last_char] != ')') {
+DbOperator* parse_print(Tokenizer* tokenizer, message* send_message, ClientContext* context) {
+    Slice argument;
+    // count the results on a copy of the tokenizer to size the array
+    Tokenizer counter = *tokenizer;
+    size_t num_results = 0;
+    while (next_argument(&counter, &argument)) {
+        num_results++;
+    }
+    if (num_results == 0 || !end_of_command(&counter)) {
+        send_message->status = INCORRECT_FORMAT;
         return NULL;
     }
-    // add new null terminator
-    db_name[last_char] = '\0';
-    DbOperator* dbo = malloc(sizeof(DbOperator));
-    dbo->operator_fields.create_db_operator.db_name = malloc((strlen(db_name)+1)*sizeof(char));
-    strcpy(dbo->operator_fields.create_db_operator.db_name, db_name);
-    dbo->type = CREATE_DB;
+    Result** results = arena_malloc(sizeof(Result*) * num_results);
+    num_results = 0;
+    while (next_argument(tokenizer, &argument)) {
+        Result* result = lookup_result(context, argument.start, argument.length);
+        if (result == NULL) {
+            send_message->status = OBJECT_NOT_FOUND;
+            arena_free(results);
+            return NULL;
+        }
+        results[num_results++] = result;
+    }
+    DbOperator* dbo = arena_malloc(sizeof(DbOperator));
+    dbo->type = PRINT;
+    dbo->operator_fields.print_operator.results = results;
+    dbo->operator_fields.print_operator.num_results = num_results;
     return dbo;
 }
 
+/**
+ * is_update_command tells whether a query changes the catalog or the data
+ **/
+bool is_update_command(const char* query_command) {
+    Tokenizer tokenizer = { query_command, false, false };
+    Keyword keyword = command_keyword(next_word(&tokenizer));
+    return keyword == KEYWORD_CREATE || keyword == KEYWORD_INSERT ||
+           keyword == KEYWORD_LOAD || keyword == KEYWORD_SHUTDOWN;
+}
+
+/**
+ * is_insert_command tells whether a query is a relational_insert, which
+ * only appends to the delta buffer of its table
+ **/
+bool is_insert_command(const char* query_command) {
+    Tokenizer tokenizer = { query_command, false, false };
+    return command_keyword(next_word(&tokenizer)) == KEYWORD_INSERT;
+}
+
 /**
  * parse_command takes as input the send_message from the client and then
  * parses it into the appropriate query. Stores into send_message the
  * status to send back.
+ * A command reads [handle[,handle]=]keyword(arguments), query_command is
+ * left as it is.
  * Returns a db_operator.
  **/
-DbOperator* parse_command(char* query_command, message* send_message, int client_socket, ClientContext* context) {
-    DbOperator *dbo = NULL; // = malloc(sizeof(DbOperator)); // calloc?
+DbOperator* parse_command(const char* query_command, message* send_message, int client_socket, ClientContext* context) {
+    DbOperator *dbo = NULL;
+    Tokenizer tokenizer = { query_command, false, false };
 
-    if (strncmp(query_command, "--", 2) == 0) {
+    if (strncmp(skip_space(query_command), "--", 2) == 0) {
         send_message->status = OK_DONE;
-        // The -- signifies a comment line, no operator needed.  
+        // The -- signifies a comment line, no operator needed.
         return NULL;
     }
+    coldb_log(stdout, "QUERY: %s\n", query_command);
 
-    char *equals_pointer = strchr(query_command, '=');
-    char *handle = query_command;
-    if (equals_pointer != NULL) {
-        // handle exists, store here. 
-        *equals_pointer = '\0';
-        coldb_log(stdout, "FILE HANDLE: %s\n", handle);
-        query_command = ++equals_pointer;
-    } else {
-        handle = NULL;
+    // the words before '=' are handles, the one after it the keyword
+    Slice handles[MAX_HANDLES];
+    size_t num_handles = 0;
+    Slice word = next_word(&tokenizer);
+    while (*tokenizer.cursor == ',' && num_handles + 1 < MAX_HANDLES) {
+        handles[num_handles++] = word;
+        tokenizer.cursor++;
+        word = next_word(&tokenizer);
+    }
+    if (*tokenizer.cursor == '=') {
+        handles[num_handles++] = word;
+        tokenizer.cursor++;
+        word = next_word(&tokenizer);
+    } else if (num_handles > 0) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
     }
 
-    coldb_log(stdout, "QUERY: %s\n", query_command);
-
+    Keyword keyword = command_keyword(word);
+    if (keyword == KEYWORD_NONE) {
+        send_message->status = UNKNOWN_COMMAND;
+        return NULL;
+    }
     send_message->status = OK_WAIT_FOR_RESPONSE;
-    query_command = trim_whitespace(query_command);
-
-    // check what command is given.
-    if (strncmp(query_command, "create(db,", 10) == 0) {
-        query_command += 10;
-        dbo = parse_create_db(query_command);
+    if (num_handles != keyword_handles(keyword)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    for (size_t i = 0; i < num_handles; i++) {
+        coldb_log(stdout, "FILE HANDLE: %.*s\n", (int)handles[i].length, handles[i].start);
+        if (handles[i].length == 0 || handles[i].length >= HANDLE_MAX_SIZE) {
+            send_message->status = INCORRECT_FORMAT;
+            return NULL;
+        }
     }
-    /*
-    else if (strncmp(query_command, "relational_insert", 17) == 0) {
-        query_command += 17;
-        dbo = parse_insert(query_command, send_message);
+    // every command but shutdown takes an argument list
+    if (keyword != KEYWORD_SHUTDOWN && !open_arguments(&tokenizer)) {
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+
+    switch (keyword) {
+        case KEYWORD_CREATE:
+            dbo = parse_create(&tokenizer, send_message);
+            break;
+        case KEYWORD_INSERT:
+            dbo = parse_insert(&tokenizer, send_message);
+            break;
+        case KEYWORD_LOAD:
+            dbo = parse_load(&tokenizer, send_message);
+            break;
+        case KEYWORD_SELECT:
+            dbo = parse_select(handles[0], &tokenizer, send_message, context);
+            break;
+        case KEYWORD_FETCH:
+            dbo = parse_fetch(handles[0], &tokenizer, send_message, context);
+            break;
+        case KEYWORD_MIN:
+            dbo = parse_aggregate(handles[0], &tokenizer, AGGREGATE_MIN, send_message, context);
+            break;
+        case KEYWORD_MAX:
+            dbo = parse_aggregate(handles[0], &tokenizer, AGGREGATE_MAX, send_message, context);
+            break;
+        case KEYWORD_SUM:
+            dbo = parse_aggregate(handles[0], &tokenizer, AGGREGATE_SUM, send_message, context);
+            break;
+        case KEYWORD_AVG:
+            dbo = parse_aggregate(handles[0], &tokenizer, AGGREGATE_AVG, send_message, context);
+            break;
+        case KEYWORD_ADD:
+            dbo = parse_arithmetic(handles[0], &tokenizer, false, send_message, context);
+            break;
+        case KEYWORD_SUB:
+            dbo = parse_arithmetic(handles[0], &tokenizer, true, send_message, context);
+            break;
+        case KEYWORD_JOIN:
+            dbo = parse_join(handles, &tokenizer, send_message, context);
+            break;
+        case KEYWORD_PRINT:
+            dbo = parse_print(&tokenizer, send_message, context);
+            break;
+        case KEYWORD_BATCH_QUERIES:
+        case KEYWORD_BATCH_EXECUTE:
+            if (end_of_command(&tokenizer)) {
+                dbo = arena_malloc(sizeof(DbOperator));
+                dbo->type = keyword == KEYWORD_BATCH_QUERIES ? BATCH_QUERIES : BATCH_EXECUTE;
+            }
+            break;
+        default:
+            dbo = arena_malloc(sizeof(DbOperator));
+            dbo->type = SHUTDOWN;
+            break;
     }
-    */
-    else {
+    if (dbo == NULL) {
+        if (send_message->status == OK_WAIT_FOR_RESPONSE) {
+            send_message->status = INCORRECT_FORMAT;
+        }
         return NULL;
     }
-    
+
     dbo->client_fd = client_socket;
     dbo->context = context;
     return dbo;
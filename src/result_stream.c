@@ -0,0 +1,122 @@
+/**
+ * result_stream.c
+ * Framed streaming of results over the client socket.
+ **/
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "result_stream.h"
+#include "utils_func.h"
+
+int send_all(int socket, const void* data, size_t length) {
+    const char* p = data;
+    while (length > 0) {
+        ssize_t sent = send(socket, p, length, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+int recv_all(int socket, void* data, size_t length) {
+    char* p = data;
+    while (length > 0) {
+        ssize_t received = recv(socket, p, length, 0);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        p += received;
+        length -= received;
+    }
+    return 0;
+}
+
+/**
+ * send a frame header and its payload with a single gathered write,
+ * resuming after partial writes
+ **/
+static int send_frame(int socket, const char* payload, size_t length) {
+    frame_header header;
+    header.length = length;
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(frame_header);
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = length;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = length > 0 ? 2 : 1;
+    while (msg.msg_iovlen > 0) {
+        ssize_t sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (msg.msg_iovlen > 0 && (size_t)sent >= msg.msg_iov->iov_len) {
+            sent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + sent;
+            msg.msg_iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+void stream_flush(ResultStream* stream) {
+    if (stream->length > 0 && !stream->failed &&
+        send_frame(stream->socket, stream->buffer, stream->length) != 0) {
+        log_err("L%d: Failed to send a result frame.\n", __LINE__);
+        stream->failed = true;
+    }
+    stream->length = 0;
+}
+
+void begin_stream(ResultStream* stream, int socket, char* buffer, int flags, int sequence) {
+    stream->socket = socket;
+    stream->buffer = buffer;
+    stream->length = 0;
+    stream->failed = false;
+    message header;
+    memset(&header, 0, sizeof(message));
+    header.status = OK_STREAM_RESPONSE;
+    header.flags = flags;
+    header.length = 0;
+    header.sequence = sequence;
+    if (send_all(socket, &header, sizeof(message)) != 0) {
+        stream->failed = true;
+    }
+}
+
+char* stream_reserve(ResultStream* stream, size_t size) {
+    if (stream->length + size > MAX_FRAME_SIZE) {
+        stream_flush(stream);
+    }
+    return stream->buffer + stream->length;
+}
+
+int end_stream(ResultStream* stream) {
+    stream_flush(stream);
+    if (!stream->failed && send_frame(stream->socket, NULL, 0) != 0) {
+        stream->failed = true;
+    }
+    return stream->failed ? -1 : 0;
+}
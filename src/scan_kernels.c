@@ -0,0 +1,294 @@
+/**
+ * scan_kernels.c
+ * Branch-free range predicate kernels. Every kernel is specialised for the
+ * predicate kind, so an open bound costs no compare, and qualifying
+ * positions are written from the compare mask with a permutation lookup
+ * table instead of a branch per row.
+ **/
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "db_select.h"
+#include "scan_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+void make_scan_predicate(Comparator* comparator, ScanPredicate* predicate) {
+    if (!comparator_bounds(comparator, &predicate->low, &predicate->high)) {
+        predicate->kind = SCAN_NONE;
+    } else if (predicate->low == INT_MIN && predicate->high == INT_MAX) {
+        predicate->kind = SCAN_ALL;
+    } else if (predicate->low == INT_MIN) {
+        predicate->kind = SCAN_UPPER;
+    } else if (predicate->high == INT_MAX) {
+        predicate->kind = SCAN_LOWER;
+    } else {
+        predicate->kind = SCAN_RANGE;
+    }
+}
+
+/**
+ * Scalar kernels, low <= v <= high is a single unsigned compare which also
+ * covers the open bounds (low = INT_MIN or high = INT_MAX)
+ **/
+static size_t scalar_positions(const int* values, const int* positions, size_t begin, size_t end,
+                               const ScanPredicate* predicate, int* out) {
+    unsigned int low = (unsigned int)predicate->low;
+    unsigned int range = (unsigned int)predicate->high - low;
+    size_t k = 0;
+    if (positions == NULL) {
+        for (size_t i = begin; i < end; i++) {
+            out[k] = (int)i;
+            k += ((unsigned int)values[i] - low) <= range;
+        }
+    } else {
+        for (size_t i = begin; i < end; i++) {
+            out[k] = positions[i];
+            k += ((unsigned int)values[i] - low) <= range;
+        }
+    }
+    return k;
+}
+
+static size_t scalar_bitmap(const int* values, size_t begin, size_t end,
+                            const ScanPredicate* predicate, uint64_t* bitmap) {
+    unsigned int low = (unsigned int)predicate->low;
+    unsigned int range = (unsigned int)predicate->high - low;
+    size_t count = 0;
+    for (size_t i = begin; i < end; i += 64) {
+        size_t word_end = i + 64 < end ? i + 64 : end;
+        uint64_t word = 0;
+        for (size_t j = i; j < word_end; j++) {
+            word |= (uint64_t)(((unsigned int)values[j] - low) <= range) << (j - i);
+        }
+        bitmap[(i - begin) / 64] = word;
+        count += __builtin_popcountll(word);
+    }
+    return count;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// compact_lut8[m] lists the lanes set in the 8 bit mask m, for vpermd
+static int compact_lut8[256][8] __attribute__((aligned(32)));
+// compact_lut4[m] is the pshufb control moving the lanes set in m to the front
+static unsigned char compact_lut4[16][16] __attribute__((aligned(16)));
+static pthread_once_t lut_once = PTHREAD_ONCE_INIT;
+
+static void init_compact_luts(void) {
+    for (int mask = 0; mask < 256; mask++) {
+        int k = 0;
+        for (int lane = 0; lane < 8; lane++) {
+            if (mask & (1 << lane)) {
+                compact_lut8[mask][k++] = lane;
+            }
+        }
+        while (k < 8) {
+            compact_lut8[mask][k++] = 0;
+        }
+    }
+    for (int mask = 0; mask < 16; mask++) {
+        int k = 0;
+        memset(compact_lut4[mask], 0x80, 16);
+        for (int lane = 0; lane < 4; lane++) {
+            if (mask & (1 << lane)) {
+                for (int b = 0; b < 4; b++) {
+                    compact_lut4[mask][k * 4 + b] = (unsigned char)(lane * 4 + b);
+                }
+                k++;
+            }
+        }
+    }
+}
+
+/**
+ * AVX2: v >= low is v > low - 1 and v <= high is high + 1 > v; the kinds
+ * that use a bound guarantee that low > INT_MIN and high < INT_MAX.
+ **/
+static inline __attribute__((always_inline, target("avx2,popcnt")))
+__m256i avx2_mask(__m256i v, __m256i low_minus_one, __m256i high_plus_one, ScanKind kind) {
+    if (kind == SCAN_RANGE) {
+        return _mm256_and_si256(_mm256_cmpgt_epi32(v, low_minus_one), _mm256_cmpgt_epi32(high_plus_one, v));
+    } else if (kind == SCAN_LOWER) {
+        return _mm256_cmpgt_epi32(v, low_minus_one);
+    } else {
+        return _mm256_cmpgt_epi32(high_plus_one, v);
+    }
+}
+
+static inline __attribute__((always_inline, target("avx2,popcnt")))
+size_t avx2_positions_kind(const int* values, const int* positions, size_t begin, size_t end,
+                           const ScanPredicate* predicate, int* out, ScanKind kind) {
+    const __m256i low_minus_one = _mm256_set1_epi32(kind == SCAN_UPPER ? 0 : predicate->low - 1);
+    const __m256i high_plus_one = _mm256_set1_epi32(kind == SCAN_LOWER ? 0 : predicate->high + 1);
+    const __m256i step = _mm256_set1_epi32(8);
+    __m256i index = _mm256_add_epi32(_mm256_set1_epi32((int)begin), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    size_t k = 0;
+    size_t i = begin;
+    // k <= i - begin, so the 8 lanes stored at out + k never pass out + (end - begin)
+    for (; i + 8 <= end; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        unsigned int bits = _mm256_movemask_ps(_mm256_castsi256_ps(
+            avx2_mask(v, low_minus_one, high_plus_one, kind)));
+        __m256i source = positions == NULL ? index : _mm256_loadu_si256((const __m256i*)(positions + i));
+        __m256i permutation = _mm256_load_si256((const __m256i*)compact_lut8[bits]);
+        _mm256_storeu_si256((__m256i*)(out + k), _mm256_permutevar8x32_epi32(source, permutation));
+        k += __builtin_popcount(bits);
+        index = _mm256_add_epi32(index, step);
+    }
+    return k + scalar_positions(values, positions, i, end, predicate, out + k);
+}
+
+static __attribute__((target("avx2,popcnt")))
+size_t avx2_positions(const int* values, const int* positions, size_t begin, size_t end,
+                      const ScanPredicate* predicate, int* out) {
+    switch (predicate->kind) {
+        case SCAN_RANGE:
+            return avx2_positions_kind(values, positions, begin, end, predicate, out, SCAN_RANGE);
+        case SCAN_LOWER:
+            return avx2_positions_kind(values, positions, begin, end, predicate, out, SCAN_LOWER);
+        default:
+            return avx2_positions_kind(values, positions, begin, end, predicate, out, SCAN_UPPER);
+    }
+}
+
+static inline __attribute__((always_inline, target("avx2,popcnt")))
+size_t avx2_bitmap_kind(const int* values, size_t begin, size_t end,
+                        const ScanPredicate* predicate, uint64_t* bitmap, ScanKind kind) {
+    const __m256i low_minus_one = _mm256_set1_epi32(kind == SCAN_UPPER ? 0 : predicate->low - 1);
+    const __m256i high_plus_one = _mm256_set1_epi32(kind == SCAN_LOWER ? 0 : predicate->high + 1);
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + 64 <= end; i += 64) {
+        uint64_t word = 0;
+        for (int group = 0; group < 8; group++) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(values + i + group * 8));
+            uint64_t bits = (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(
+                avx2_mask(v, low_minus_one, high_plus_one, kind)));
+            word |= bits << (group * 8);
+        }
+        bitmap[(i - begin) / 64] = word;
+        count += __builtin_popcountll(word);
+    }
+    if (i < end) {
+        count += scalar_bitmap(values, i, end, predicate, bitmap + (i - begin) / 64);
+    }
+    return count;
+}
+
+static __attribute__((target("avx2,popcnt")))
+size_t avx2_bitmap(const int* values, size_t begin, size_t end,
+                   const ScanPredicate* predicate, uint64_t* bitmap) {
+    switch (predicate->kind) {
+        case SCAN_RANGE:
+            return avx2_bitmap_kind(values, begin, end, predicate, bitmap, SCAN_RANGE);
+        case SCAN_LOWER:
+            return avx2_bitmap_kind(values, begin, end, predicate, bitmap, SCAN_LOWER);
+        default:
+            return avx2_bitmap_kind(values, begin, end, predicate, bitmap, SCAN_UPPER);
+    }
+}
+
+/**
+ * SSE4.2: same scheme on 4 lanes, compaction with pshufb
+ **/
+static inline __attribute__((always_inline, target("sse4.2,popcnt")))
+size_t sse_positions_kind(const int* values, const int* positions, size_t begin, size_t end,
+                          const ScanPredicate* predicate, int* out, ScanKind kind) {
+    const __m128i low_minus_one = _mm_set1_epi32(kind == SCAN_UPPER ? 0 : predicate->low - 1);
+    const __m128i high_plus_one = _mm_set1_epi32(kind == SCAN_LOWER ? 0 : predicate->high + 1);
+    const __m128i step = _mm_set1_epi32(4);
+    __m128i index = _mm_add_epi32(_mm_set1_epi32((int)begin), _mm_setr_epi32(0, 1, 2, 3));
+    size_t k = 0;
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+        __m128i mask;
+        if (kind == SCAN_RANGE) {
+            mask = _mm_and_si128(_mm_cmpgt_epi32(v, low_minus_one), _mm_cmpgt_epi32(high_plus_one, v));
+        } else if (kind == SCAN_LOWER) {
+            mask = _mm_cmpgt_epi32(v, low_minus_one);
+        } else {
+            mask = _mm_cmpgt_epi32(high_plus_one, v);
+        }
+        unsigned int bits = _mm_movemask_ps(_mm_castsi128_ps(mask));
+        __m128i source = positions == NULL ? index : _mm_loadu_si128((const __m128i*)(positions + i));
+        __m128i shuffle = _mm_load_si128((const __m128i*)compact_lut4[bits]);
+        _mm_storeu_si128((__m128i*)(out + k), _mm_shuffle_epi8(source, shuffle));
+        k += __builtin_popcount(bits);
+        index = _mm_add_epi32(index, step);
+    }
+    return k + scalar_positions(values, positions, i, end, predicate, out + k);
+}
+
+static __attribute__((target("sse4.2,popcnt")))
+size_t sse_positions(const int* values, const int* positions, size_t begin, size_t end,
+                     const ScanPredicate* predicate, int* out) {
+    switch (predicate->kind) {
+        case SCAN_RANGE:
+            return sse_positions_kind(values, positions, begin, end, predicate, out, SCAN_RANGE);
+        case SCAN_LOWER:
+            return sse_positions_kind(values, positions, begin, end, predicate, out, SCAN_LOWER);
+        default:
+            return sse_positions_kind(values, positions, begin, end, predicate, out, SCAN_UPPER);
+    }
+}
+
+#endif
+
+static size_t all_positions(const int* positions, size_t begin, size_t end, int* out) {
+    if (positions != NULL) {
+        memcpy(out, positions + begin, sizeof(int) * (end - begin));
+    } else {
+        for (size_t i = begin; i < end; i++) {
+            out[i - begin] = (int)i;
+        }
+    }
+    return end - begin;
+}
+
+size_t scan_positions(const int* values, const int* positions, size_t begin, size_t end,
+                      const ScanPredicate* predicate, int* out) {
+    if (predicate->kind == SCAN_NONE || begin >= end) {
+        return 0;
+    }
+    if (predicate->kind == SCAN_ALL) {
+        return all_positions(positions, begin, end, out);
+    }
+#ifdef HAVE_X86_KERNELS
+    pthread_once(&lut_once, init_compact_luts);
+    if (__builtin_cpu_supports("avx2")) {
+        return avx2_positions(values, positions, begin, end, predicate, out);
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return sse_positions(values, positions, begin, end, predicate, out);
+    }
+#endif
+    return scalar_positions(values, positions, begin, end, predicate, out);
+}
+
+size_t scan_bitmap(const int* values, size_t begin, size_t end,
+                   const ScanPredicate* predicate, uint64_t* bitmap) {
+    size_t num_words = (end - begin + 63) / 64;
+    if (predicate->kind == SCAN_NONE || begin >= end) {
+        memset(bitmap, 0, sizeof(uint64_t) * num_words);
+        return 0;
+    }
+    if (predicate->kind == SCAN_ALL) {
+        memset(bitmap, 0xff, sizeof(uint64_t) * num_words);
+        if ((end - begin) % 64 != 0) {
+            bitmap[num_words - 1] = (UINT64_C(1) << ((end - begin) % 64)) - 1;
+        }
+        return end - begin;
+    }
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        return avx2_bitmap(values, begin, end, predicate, bitmap);
+    }
+#endif
+    return scalar_bitmap(values, begin, end, predicate, bitmap);
+}
@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/socket.h>
@@ -22,102 +23,262 @@
 #include <string.h>
 #include <libexplain/bind.h>
 
+#include "arena.h"
+#include "client_context.h"
 #include "common.h"
 #include "parse.h"
+#include "result_stream.h"
+#include "thread_pool.h"
 #include "utils_func.h"
+#include "db_delta.h"
 #include "db_element.h"
+#include "db_executor.h"
 #include "db_manager.h"
 
 #define DEFAULT_QUERY_BUFFER_SIZE 1024
+#define DEFAULT_REQUEST_WORKERS 8
+#define MAX_EVENTS 64
+// bytes read from a client at once, a longer query grows the buffer
+#define INPUT_BUFFER_SIZE (64 * 1024)
+// responses to pipelined queries are sent together, up to this many bytes
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
 
-char* exec_create_db(DbOperator* query) {
-    char* db_name = query->operator_fields.create_db_operator.db_name;
-    //current_db = create_db(db_name);
-    current_db = create_db(db_name);
+/**
+ * ClientConnection
+ * The state of one connected client. Its socket is registered in the event
+ * loop with EPOLLONESHOT, so at most one worker serves a client at a time
+ * and its queries run in the order they were sent.
+ * input holds the bytes received and not served yet: whole queries, then
+ * the start of the next one. output holds the responses not sent yet.
+ * failed is set once a send failed, the connection is then closed.
+ **/
+typedef struct ClientConnection {
+    int socket;
+    ClientContext* context;
+    char* input;
+    size_t input_length;
+    size_t input_capacity;
+    char* output;
+    size_t output_length;
+    bool failed;
+} ClientConnection;
+
+static int epoll_fd = -1;
+// written to by a worker to wake up the event loop after a shutdown
+static int wake_pipe[2];
+static WorkerPool* request_pool = NULL;
+// markers for the epoll data of the listening socket and the wake pipe
+static int listen_marker;
+static int wake_marker;
+
+static void watch_client(ClientConnection* connection, int operation) {
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = connection;
+    if (epoll_ctl(epoll_fd, operation, connection->socket, &event) == -1) {
+        log_err("L%d: Failed to watch socket %d.\n", __LINE__, connection->socket);
+    }
 }
 
+static void close_client(ClientConnection* connection) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->socket, NULL);
+    // an update of another client may be materializing the deferred
+    // results of this one
+    lock_db(false);
+    free_client_context(connection->context);
+    unlock_db();
+    log_info("Connection closed at socket %d!\n", connection->socket);
+    close(connection->socket);
+    free(connection->input);
+    free(connection->output);
+    free(connection);
+}
 
-/** execute_DbOperator takes as input the DbOperator and executes the query.
- * This should be replaced in your implementation (and its implementation possibly moved to a different file).
- * It is currently here so that you can verify that your server and client can send messages.
+/**
+ * receive_input appends what the socket holds to the input of a client,
+ * without waiting for more. The input grows to hold the whole query it
+ * starts with, and one byte is always left free after the data received.
+ * Returns -1 if the client closed the connection or it failed.
  **/
-char* execute_DbOperator(DbOperator* query) {
-    if (query->type == CREATE_DB) {
-        return exec_create_db(query);
+static int receive_input(ClientConnection* connection) {
+    size_t needed = INPUT_BUFFER_SIZE;
+    if (connection->input_length >= sizeof(message)) {
+        message header;
+        memcpy(&header, connection->input, sizeof(message));
+        if (header.length < 0) {
+            log_err("L%d: Bad message length %d.\n", __LINE__, header.length);
+            return -1;
+        }
+        if (sizeof(message) + header.length + 1 > needed) {
+            needed = sizeof(message) + header.length + 1;
+        }
     }
-    else {
-        free(query);
-        log_info("unsupported command, try again.\n");
-        return "unsupported command, try again.\n";
+    if (needed > connection->input_capacity) {
+        connection->input = realloc(connection->input, needed);
+        connection->input_capacity = needed;
     }
-
+    ssize_t received;
+    do {
+        received = recv(connection->socket, connection->input + connection->input_length,
+                        connection->input_capacity - connection->input_length - 1, MSG_DONTWAIT);
+    } while (received == -1 && errno == EINTR);
+    if (received == 0) {
+        return -1;
+    }
+    if (received == -1) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    connection->input_length += received;
+    return 0;
 }
 
 /**
- * handle_client(client_socket)
- * This is the execution routine after a client has connected.
- * It will continually listen for messages from the client and execute queries.
+ * flush_output sends the queued responses of a client
  **/
-void handle_client(int client_socket) {
-    int done = 0;
-    int length = 0;
+static void flush_output(ClientConnection* connection) {
+    if (connection->output_length > 0 && !connection->failed &&
+        send_all(connection->socket, connection->output, connection->output_length) != 0) {
+        log_err("Failed to send message.");
+        connection->failed = true;
+    }
+    connection->output_length = 0;
+}
 
-    log_info("Connected to socket: %d.\n", client_socket);
+/**
+ * queue_response adds a response and its payload to the output of a
+ * client, a response larger than the output buffer is sent on its own
+ **/
+static void queue_response(ClientConnection* connection, message* response, const char* payload) {
+    size_t size = sizeof(message) + response->length;
+    if (connection->output_length + size > OUTPUT_BUFFER_SIZE) {
+        flush_output(connection);
+    }
+    if (size > OUTPUT_BUFFER_SIZE) {
+        if (!connection->failed && (send_all(connection->socket, response, sizeof(message)) != 0 ||
+                                    send_all(connection->socket, payload, response->length) != 0)) {
+            log_err("Failed to send message.");
+            connection->failed = true;
+        }
+        return;
+    }
+    if (connection->output == NULL) {
+        connection->output = malloc(OUTPUT_BUFFER_SIZE);
+    }
+    memcpy(connection->output + connection->output_length, response, sizeof(message));
+    memcpy(connection->output + connection->output_length + sizeof(message), payload, response->length);
+    connection->output_length += size;
+}
 
-    // Create two messages, one from which to read and one from which to receive
-    message send_message;
-    message recv_message;
+/**
+ * serve_query parses and executes one query of a client and queues its
+ * response. query holds request->length bytes, followed by a byte that is
+ * set aside while the query runs.
+ **/
+static void serve_query(ClientConnection* connection, const message* request, char* query) {
+    ClientContext* context = connection->context;
+    message response;
+    memset(&response, 0, sizeof(message));
+    response.sequence = request->sequence;
+    char next = query[request->length];
+    query[request->length] = '\0';
+    context->binary_results = (request->flags & MESSAGE_BINARY_RESULTS) != 0;
+    context->sequence = request->sequence;
+
+    // updates take the database exclusively, reads share it
+    bool exclusive = is_update_command(query);
+    lock_db(exclusive);
+
+    // inserted rows are merged into their tables before any other query
+    // reads them, inserts only add to the delta buffers
+    if (deltas_pending() && !is_insert_command(query)) {
+        if (!exclusive) {
+            unlock_db();
+            lock_db(true);
+        }
+        Status merged = merge_deltas(current_db);
+        if (merged.code != OK) {
+            log_err("L%d: %s\n", __LINE__, merged.error_message);
+        }
+    }
 
-    // create the client context here
-    ClientContext* client_context = NULL;
+    // the intermediates of the query go to the arena of the client
+    use_arena(context->arena);
 
-    // Continually receive messages from client and execute queries.
-    // 1. Parse the command
-    // 2. Handle request if appropriate
-    // 3. Send status of the received message (OK, UNKNOWN_QUERY, etc)
-    // 4. Send response of request.
-    do {
-        length = recv(client_socket, &recv_message, sizeof(message), 0);
-        if (length < 0) {
-            log_err("Client connection closed!\n");
-            exit(1);
-        } else if (length == 0) {
-            done = 1;
-        }
+    // 1. Parse command
+    DbOperator* dbo = parse_command(query, &response, connection->socket, context);
 
-        if (!done) {
-            char recv_buffer[recv_message.length + 1];
-            length = recv(client_socket, recv_buffer, recv_message.length,0);
-            recv_message.payload = recv_buffer;
-            recv_message.payload[recv_message.length] = '\0';
+    // a streamed result goes straight to the socket, after the responses
+    // to the queries before it
+    if (dbo != NULL && dbo->type == PRINT) {
+        flush_output(connection);
+    }
 
-            // 1. Parse command
-            DbOperator* query = parse_command(recv_message.payload, &send_message, client_socket, client_context);
+    // 2. Handle request
+    char* result = execute_DbOperator(dbo);
+    use_arena(NULL);
+    unlock_db();
+    query[request->length] = next;
 
-            // 2. Handle request
-            char* result = execute_DbOperator(query);
+    // the event loop drains this request before exiting
+    if (atomic_load(&server_shutdown)) {
+        if (write(wake_pipe[1], "s", 1) == -1) {
+            log_err("L%d: Failed to wake up the event loop.\n", __LINE__);
+        }
+    }
 
-            send_message.length = strlen(result);
-            char send_buffer[send_message.length + 1];
-            strcpy(send_buffer, result);
-            send_message.payload = send_buffer;
+    // 3. Send status of the received message (OK, UNKNOWN_QUERY, etc)
+    // 4. Send response of request
+    // a streamed result has already been sent by the executor
+    if (result != NULL) {
+        response.length = strlen(result);
+        queue_response(connection, &response, result);
+    }
+}
 
-            // 3. Send status of the received message (OK, UNKNOWN_QUERY, etc)
-            if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-                log_err("Failed to send message.");
-                exit(1);
-            }
+/**
+ * handle_client(connection)
+ * This is the execution routine of a worker once a client socket is readable.
+ * It reads what the client sent, serves every whole query in it in order,
+ * sends the responses and hands the socket back to the event loop. A
+ * client that pipelines its queries gets many served in one turn, with
+ * their responses sent together.
+ **/
+void handle_client(void* arg) {
+    ClientConnection* connection = arg;
+    if (receive_input(connection) != 0) {
+        close_client(connection);
+        return;
+    }
 
-            // 4. Send response of request
-            if (send(client_socket, result, send_message.length, 0) == -1) {
-                log_err("Failed to send message.");
-                exit(1);
-            }
+    size_t served = 0;
+    while (!atomic_load(&server_shutdown) && !connection->failed) {
+        size_t available = connection->input_length - served;
+        message request;
+        if (available < sizeof(message)) {
+            break;
+        }
+        memcpy(&request, connection->input + served, sizeof(message));
+        if (request.length < 0) {
+            log_err("L%d: Bad message length %d.\n", __LINE__, request.length);
+            connection->failed = true;
+            break;
         }
-    } while (!done);
+        // the rest of the query comes with a later turn
+        if (available < sizeof(message) + request.length) {
+            break;
+        }
+        serve_query(connection, &request, connection->input + served + sizeof(message));
+        served += sizeof(message) + request.length;
+    }
+    memmove(connection->input, connection->input + served, connection->input_length - served);
+    connection->input_length -= served;
 
-    log_info("Connection closed at socket %d!\n", client_socket);
-    close(client_socket);
+    flush_output(connection);
+    if (connection->failed) {
+        close_client(connection);
+        return;
+    }
+    watch_client(connection, EPOLL_CTL_MOD);
 }
 
 /**
@@ -159,7 +320,7 @@ int setup_server() {
         return -1;
     }
 
-    if (listen(server_socket, 5) == -1) {
+    if (listen(server_socket, SOMAXCONN) == -1) {
         log_err("L%d: Failed to listen on socket.\n", __LINE__);
         return -1;
     }
@@ -168,30 +329,108 @@ int setup_server() {
 }
 
 /**
- * Currently this main will setup the socket and accept a single client.
- * After handling the client, it will exit.
- * You will need to extend this to handle multiple concurrent clients
- * and remain running until it receives a shut-down command.
+ * accept_client registers a new connection in the event loop
+ **/
+static void accept_client(int server_socket) {
+    struct sockaddr_un remote;
+    socklen_t t = sizeof(remote);
+    int client_socket = accept(server_socket, (struct sockaddr *)&remote, &t);
+    if (client_socket == -1) {
+        log_err("L%d: Failed to accept a new connection.\n", __LINE__);
+        return;
+    }
+    log_info("Connected to socket: %d.\n", client_socket);
+    ClientConnection* connection = calloc(1, sizeof(ClientConnection));
+    connection->socket = client_socket;
+    connection->context = create_client_context();
+    watch_client(connection, EPOLL_CTL_ADD);
+}
+
+/**
+ * This main sets up the socket and runs an epoll event loop: new clients
+ * are accepted, and whenever a client sends a query, the request is handed
+ * to a worker so that one slow query does not block the other sessions.
+ * The server runs until a shutdown command arrives, then drains the
+ * queries in flight, persists the database and exits.
+ *
+ * Usage: ./server [-t num_threads] [-w num_workers] [-m client_memory_mb]
+ * num_threads is the number of cores parallel operators use (default: all),
+ * num_workers the number of requests served concurrently, client_memory_mb
+ * the megabytes of intermediates each client may hold (default: no limit).
  */
-int main(void)
+int main(int argc, char** argv)
 {
+    size_t num_threads = default_num_threads();
+    size_t num_workers = DEFAULT_REQUEST_WORKERS;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            int requested = atoi(argv[++i]);
+            num_threads = requested > 0 ? (size_t)requested : 1;
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            int requested = atoi(argv[++i]);
+            num_workers = requested > 0 ? (size_t)requested : 1;
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            int requested = atoi(argv[++i]);
+            client_memory_limit = requested > 0 ? (size_t)requested << 20 : 0;
+        } else {
+            log_err("usage: %s [-t num_threads] [-w num_workers] [-m client_memory_mb]\n", argv[0]);
+            exit(1);
+        }
+    }
+    parallel_pool = create_thread_pool(num_threads);
+    request_pool = create_worker_pool(num_workers);
+    log_info("Using %zu threads for parallel operators, %zu request workers.\n", num_threads, num_workers);
+
+    // map the columns of the database persisted by the previous run
+    if (load_db().code != OK) {
+        exit(1);
+    }
+
     int server_socket = setup_server();
     if (server_socket < 0) {
         exit(1);
     }
 
-    log_info("Waiting for a connection %d ...\n", server_socket);
-
-    struct sockaddr_un remote;
-    socklen_t t = sizeof(remote);
-    int client_socket = 0;
-
-    if ((client_socket = accept(server_socket, (struct sockaddr *)&remote, &t)) == -1) {
-        log_err("L%d: Failed to accept a new connection.\n", __LINE__);
+    struct epoll_event event;
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd == -1 || pipe(wake_pipe) == -1) {
+        log_err("L%d: Failed to set up the event loop.\n", __LINE__);
         exit(1);
     }
+    event.events = EPOLLIN;
+    event.data.ptr = &listen_marker;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &event);
+    event.data.ptr = &wake_marker;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_pipe[0], &event);
 
-    handle_client(client_socket);
+    log_info("Waiting for a connection %d ...\n", server_socket);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!atomic_load(&server_shutdown)) {
+        int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (num_events == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_err("L%d: epoll_wait failed.\n", __LINE__);
+            break;
+        }
+        for (int i = 0; i < num_events && !atomic_load(&server_shutdown); i++) {
+            if (events[i].data.ptr == &listen_marker) {
+                accept_client(server_socket);
+            } else if (events[i].data.ptr != &wake_marker) {
+                worker_pool_submit(request_pool, handle_client, events[i].data.ptr);
+            }
+        }
+    }
 
+    // stop accepting, let the queries in flight finish, then persist
+    close(server_socket);
+    worker_pool_drain(request_pool);
+    shutdown_db();
+    destroy_worker_pool(request_pool);
+    destroy_thread_pool(parallel_pool);
+    unlink(SOCK_PATH);
+    log_info("Server shut down.\n");
     return 0;
 }
@@ -0,0 +1,94 @@
+/**
+ * shared_scan.c
+ * Scan sharing for batched selects over one column: the column is read
+ * once per group of queries, block by block, and every predicate of the
+ * group is evaluated on a block while it is hot in cache. The zone map of
+ * the column tells per block which predicates skip it, take it whole or
+ * scan it.
+ **/
+#include <stdlib.h>
+
+#include "arena.h"
+#include "db_zonemap.h"
+#include "scan_kernels.h"
+#include "shared_scan.h"
+#include "utils_func.h"
+
+/**
+ * ScanQuery holds the state of one predicate during a pass
+ **/
+typedef struct ScanQuery {
+    ScanPredicate predicate;
+    int* out;
+    size_t count;
+    size_t capacity;
+    size_t zones_skipped;
+} ScanQuery;
+
+static void scan_block(ScanQuery* query, const int* values, size_t begin, size_t end, ZoneMatch match) {
+    // the block can at most add end - begin positions
+    if (query->count + (end - begin) > query->capacity) {
+        query->capacity = query->capacity * 2 + (end - begin);
+        query->out = arena_realloc(query->out, sizeof(int) * query->capacity);
+    }
+    if (match == ZONE_ALL) {
+        for (size_t i = begin; i < end; i++) {
+            query->out[query->count++] = i;
+        }
+        return;
+    }
+    query->count += scan_positions(values, NULL, begin, end, &query->predicate, query->out + query->count);
+}
+
+static void scan_group(const int* values, const ZoneMap* zones, size_t length,
+                       ScanQuery* queries, size_t num_queries) {
+    for (size_t begin = 0; begin < length; begin += SHARED_SCAN_BLOCK_SIZE) {
+        size_t end = begin + SHARED_SCAN_BLOCK_SIZE < length ? begin + SHARED_SCAN_BLOCK_SIZE : length;
+        size_t zone = begin / ZONE_SIZE;
+        bool mapped = zones != NULL && zone < zones->num_zones;
+        for (size_t q = 0; q < num_queries; q++) {
+            ZoneMatch match = mapped ? zone_match(zones, zone, &queries[q].predicate) : ZONE_SOME;
+            if (match != ZONE_NONE) {
+                scan_block(&queries[q], values, begin, end, match);
+            } else if (begin % ZONE_SIZE == 0) {
+                queries[q].zones_skipped++;
+            }
+        }
+    }
+}
+
+size_t shared_scan(const Column* column, size_t length, Comparator** comparators,
+                   Result** results, size_t num_queries) {
+    size_t passes = 0;
+    ScanQuery queries[SHARED_SCAN_GROUP_SIZE];
+    for (size_t first = 0; first < num_queries; first += SHARED_SCAN_GROUP_SIZE) {
+        size_t group_size = num_queries - first < SHARED_SCAN_GROUP_SIZE ?
+                            num_queries - first : SHARED_SCAN_GROUP_SIZE;
+        for (size_t q = 0; q < group_size; q++) {
+            ScanQuery* query = &queries[q];
+            make_scan_predicate(comparators[first + q], &query->predicate);
+            query->out = NULL;
+            query->count = 0;
+            query->capacity = 0;
+            query->zones_skipped = 0;
+        }
+        scan_group(column->data, column->zones, length, queries, group_size);
+        passes++;
+        for (size_t q = 0; q < group_size; q++) {
+            Result* result = arena_malloc(sizeof(Result));
+            result->data_type = INT;
+            result->num_tuples = queries[q].count;
+            result->payload = queries[q].out;
+            result->format = POSITION_ARRAY;
+            result->copy = NULL;
+            result->table = NULL;
+            result->version = 0;
+            result->deferred = NULL;
+            results[first + q] = result;
+            log_info("shared scan of %s for %s: %zu rows, %zu zones skipped\n", column->name,
+                     comparators[first + q]->handle, result->num_tuples, queries[q].zones_skipped);
+        }
+    }
+    log_info("shared scan: %zu queries over %zu values in %zu passes\n", num_queries, length, passes);
+    return passes;
+}
@@ -0,0 +1,209 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+ThreadPool* parallel_pool = NULL;
+
+typedef struct WorkerArg {
+    ThreadPool* pool;
+    size_t worker;
+} WorkerArg;
+
+static void* worker_main(void* arg) {
+    WorkerArg* worker_arg = arg;
+    ThreadPool* pool = worker_arg->pool;
+    size_t worker = worker_arg->worker;
+    size_t seen_generation = 0;
+    free(worker_arg);
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->stop && pool->generation == seen_generation) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen_generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->routine(pool->arg, worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+size_t default_num_threads(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (size_t)cores : 1;
+}
+
+ThreadPool* create_thread_pool(size_t num_threads) {
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+    pool->num_threads = num_threads > 0 ? num_threads : 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->threads = calloc(pool->num_threads, sizeof(pthread_t));
+    for (size_t i = 1; i < pool->num_threads; i++) {
+        WorkerArg* arg = malloc(sizeof(WorkerArg));
+        arg->pool = pool;
+        arg->worker = i;
+        pthread_create(&pool->threads[i], NULL, worker_main, arg);
+    }
+    return pool;
+}
+
+void thread_pool_run(ThreadPool* pool, void (*routine)(void* arg, size_t worker), void* arg) {
+    pthread_mutex_lock(&pool->run_lock);
+    pthread_mutex_lock(&pool->lock);
+    pool->routine = routine;
+    pool->arg = arg;
+    pool->running = pool->num_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    routine(arg, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->run_lock);
+}
+
+size_t parallel_workers(size_t length, size_t threshold) {
+    if (parallel_pool == NULL || length < threshold) {
+        return 1;
+    }
+    return parallel_pool->num_threads;
+}
+
+void run_parallel(void (*routine)(void* arg, size_t worker), void* arg, size_t num_workers) {
+    if (num_workers > 1) {
+        thread_pool_run(parallel_pool, routine, arg);
+    } else {
+        routine(arg, 0);
+    }
+}
+
+size_t l2_cache_size(void) {
+    long l2_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    return l2_size > 0 ? (size_t)l2_size : DEFAULT_L2_CACHE_SIZE;
+}
+
+void destroy_thread_pool(ThreadPool* pool) {
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 1; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->run_lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->threads);
+    free(pool);
+}
+
+static void* task_worker_main(void* arg) {
+    WorkerPool* pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->stop && pool->head == NULL) {
+            pthread_cond_wait(&pool->task_ready, &pool->lock);
+        }
+        if (pool->head == NULL) {
+            break;
+        }
+        Task* task = pool->head;
+        pool->head = task->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        pool->active++;
+        pthread_mutex_unlock(&pool->lock);
+
+        task->routine(task->arg);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->active--;
+        if (pool->active == 0 && pool->head == NULL) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+WorkerPool* create_worker_pool(size_t num_threads) {
+    WorkerPool* pool = calloc(1, sizeof(WorkerPool));
+    pool->num_threads = num_threads > 0 ? num_threads : 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->task_ready, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pool->threads = calloc(pool->num_threads, sizeof(pthread_t));
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        pthread_create(&pool->threads[i], NULL, task_worker_main, pool);
+    }
+    return pool;
+}
+
+void worker_pool_submit(WorkerPool* pool, void (*routine)(void* arg), void* arg) {
+    Task* task = malloc(sizeof(Task));
+    task->routine = routine;
+    task->arg = arg;
+    task->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail == NULL) {
+        pool->head = task;
+    } else {
+        pool->tail->next = task;
+    }
+    pool->tail = task;
+    pthread_cond_signal(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void worker_pool_drain(WorkerPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->head != NULL || pool->active > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void destroy_worker_pool(WorkerPool* pool) {
+    if (pool == NULL) {
+        return;
+    }
+    // queued tasks still run before the workers exit
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->task_ready);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->threads);
+    free(pool);
+}
@@ -3,7 +3,6 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <ctype.h>
-#include <math.h>
 #include "utils_func.h"
 
 #define ANSI_COLOR_RED     "\x1b[31m"
@@ -14,19 +13,6 @@
 #define LOG_ERR 1
 #define LOG_INFO 1
 
-/**
- * a hash function for kv store
- **/
-int hash_func(const char* s, size_t a, size_t m) {
-    long hash = 0;
-    size_t len_s = strlen(s);
-    for (int i = 0; i < len_s; i++) {
-        hash += (long)pow(a, len_s - (i+1)) * s[i];
-        hash = hash % m;
-    }
-    return (int)hash;
-}
-
 /**
  * Removes newline characters from the input string.
  * Shifts characters over and shortens the length of